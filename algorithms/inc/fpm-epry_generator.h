@@ -5,27 +5,55 @@
 
 #include <vector>
 
+#include "fpm-mode.h"
+#include "linear_ops.h"
+
 namespace algorithms {
 using namespace Halide;
 
-enum fpm_mode_t : int32_t { AUTO_BRIGHTNESS = 0, PUPIL_RECOVERY = 1 };
-
-/** Simulate the low-resolution image */
+/** Simulate the low-resolution image
+ *
+ * The last dimension of all inputs and outputs indexes the tiles of a batch.
+ * All tiles in the batch are reconstructed independently in one pipeline
+ * invocation.
+ *
+ * In the in-place mode, the pipeline processes one illumination only, and
+ * updates the high resolution spectrum directly in the output buffer. The
+ * caller aliases high_res_prev and high_res_new, and crops high_res_new to the
+ * window at k_offset. Only the window is read and written, instead of the
+ * full oversampled plane.
+ *
+ * The storage type of the amplitudes, spectra and pupil functions is selected
+ * at build time with the `<name>.type` generator params, e.g. float32 or
+ * bfloat16. The arithmetic is always carried out in fp32.
+ */
 class FPMEpry : public Generator<FPMEpry> {
-    Input<Buffer<const float, 3>> low_res{"low_res"};
-    Input<Buffer<float, 3>> high_res_prev{"high_res_prev"};
-    Input<Buffer<float, 3>> pupil_prev{"pupil_prev"};
+    Input<Buffer<void, 4>> low_res{"low_res"};
+    Input<Buffer<void, 4>> high_res_prev{"high_res_prev"};
+    Input<Buffer<void, 4>> pupil_prev{"pupil_prev"};
+
+    Input<Buffer<const int32_t, 3>> k_offset{"k_offset"};
 
-    Input<Buffer<const int32_t, 2>> k_offset{"k_offset"};
+    /** Support of the pupil function, dimensions (2, tile_size). Each row y
+     * of the aperture spans [pupil_support(0, y), pupil_support(1, y)). */
+    Input<Buffer<const int32_t, 2>> pupil_support{"pupil_support"};
 
-    Output<Buffer<float, 3>> high_res_new{"high_res_new"};
-    Output<Buffer<float, 3>> pupil_new{"pupil_new"};
+    Output<Buffer<void, 4>> high_res_new{"high_res_new"};
+    Output<Buffer<void, 4>> pupil_new{"pupil_new"};
 
-    GeneratorParam<uint32_t> n_illumination{"n_illumination", 3, 9, 49};
+    /** Mean absolute error between the simulated and the measured amplitudes,
+     * one value per tile. Measured before each illumination is applied. */
+    Output<Buffer<float, 1>> residual{"residual"};
+
+    GeneratorParam<uint32_t> n_illumination{"n_illumination", 3, 1, 49};
     GeneratorParam<int32_t> fpm_mode{"fpm_mode", PUPIL_RECOVERY, AUTO_BRIGHTNESS, PUPIL_RECOVERY};
-    GeneratorParam<int32_t> tile_size{"tile_size", 128, 0, 256};
+    GeneratorParam<int32_t> tile_size{"tile_size", 128, 0, 512};
+    GeneratorParam<linear_ops::fft_backend_t> fft_backend{
+        "fft_backend", linear_ops::fft_backend_t::CUFFT, linear_ops::fft_backend_names};
+    GeneratorParam<bool> in_place{"in_place", false};
 
     RDom r;
+    RDom r_aperture;
     Func sumsq_alpha;
     Func alpha;
     Func beta{"beta"};
@@ -36,6 +64,8 @@ class FPMEpry : public Generator<FPMEpry> {
     std::vector<Func> fft2;
     std::vector<Func> ifft2;
     std::vector<ComplexFunc> delta;
+    std::vector<ComplexFunc> f_estimated;
+    std::vector<Func> abs_error;
     std::vector<ComplexFunc> high_res;
     std::vector<ComplexFunc> f_difference;
     std::vector<ComplexFunc> pupil;
@@ -44,6 +74,13 @@ class FPMEpry : public Generator<FPMEpry> {
     void design();
     void implementation();
 
+    /** Multi-core, SIMD implementation for host-only targets. */
+    void implementationCPU();
+
+    /** Tail strategy of the splits of high_res_new, guarded in the in-place
+     * mode. */
+    TailStrategy outputTail() const;
+
    public:
     static constexpr auto oversampling_factor = 2;
 
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <map>
+#include <string>
+#include <vector>
+
 #include "Halide.h"
 #include "complex.h"
 #include "vars.hpp"
@@ -50,18 +54,29 @@ Func deinterleave(const Func raw_green, const Func raw_red);
 /** Deinterleave and interpolate the Green channel */
 std::pair<Func, Func> deinterleaveGreen(const Func& raw, const Expr width, const Expr height);
 
+/** Implementation of the 2D FFT extern stages. */
+enum class fft_backend_t { CUFFT, FFTW };
+
+/** Mapping from GeneratorParam string to the FFT implementation. */
+inline const std::map<std::string, fft_backend_t> fft_backend_names{
+    {"cufft", fft_backend_t::CUFFT},
+    {"fftw", fft_backend_t::FFTW},
+};
+
 template <typename T>
 std::tuple<ComplexFunc, Func, Func>
-fft2C2C(const T& input, const int width, bool is_fwd = true, std::string&& label = "input_mux") {
+fft2C2C(const T& input, const int width, bool is_fwd = true, std::string&& label = "input_mux",
+        fft_backend_t backend = fft_backend_t::CUFFT) {
     using vars::i;
-    using vars::k;
+    using vars::t;
     using vars::x;
     using vars::y;
 
     Func fft2_internal{is_fwd ? "fft2_mux" : "ifft2_mux"};
 
-    const auto extern_func =
-        (is_fwd) ? std::string{"externCufftFwd"} : std::string{"externCufftInv"};
+    const bool is_cufft = (backend == fft_backend_t::CUFFT);
+    const auto extern_func = is_cufft ? std::string{is_fwd ? "externCufftFwd" : "externCufftInv"}
+                                      : std::string{is_fwd ? "externFftwFwd" : "externFftwInv"};
 
     std::vector<ExternFuncArgument> input_args;
 
@@ -70,8 +85,10 @@ fft2C2C(const T& input, const int width, bool is_fwd = true, std::string&& label
         input_func = input;
     } else {  // T == ComplexFunc
         using vars_t = std::vector<Var>;
-        const auto vars_dst = (input.dimensions() == 3) ? vars_t{i, x, y, k} : vars_t{i, x, y};
-        const auto vars_src = (input.dimensions() == 3) ? vars_t{x, y, k} : vars_t{x, y};
+        // The optional 3rd dimension is a batch of images to be transformed in
+        // one extern call.
+        const auto vars_dst = (input.dimensions() == 3) ? vars_t{i, x, y, t} : vars_t{i, x, y};
+        const auto vars_src = (input.dimensions() == 3) ? vars_t{x, y, t} : vars_t{x, y};
 
         input_func(vars_dst) = mux(i, {
                                           input(vars_src).re(),
@@ -82,11 +99,18 @@ fft2C2C(const T& input, const int width, bool is_fwd = true, std::string&& label
 
     const auto n_dim = input_func.dimensions();
     fft2_internal.define_extern(extern_func, {input_func}, halide_type_of<float>(), n_dim,
-                                NameMangling::Default, DeviceAPI::CUDA);
-
-    assert(input_func.dimensions() == 3);
+                                NameMangling::Default,
+                                is_cufft ? DeviceAPI::CUDA : DeviceAPI::Host);
+
+    assert(n_dim == 3 || n_dim == 4);
+    std::vector<Expr> first_pixel{0, 0, 0};
+    std::vector<Expr> last_pixel{1, width - 1, width - 1};
+    if (n_dim == 4) {
+        first_pixel.emplace_back(0);
+        last_pixel.emplace_back(0);
+    }
     fft2_internal.function().extern_definition_proxy_expr() =
-        input_func(0, 0, 0) + input_func(1, width - 1, width - 1);
+        input_func(first_pixel) + input_func(last_pixel);
 
     ComplexFunc transformed{"transformed"};
     transformed(x, y, _) = ComplexExpr{fft2_internal(0, x, y, _), fft2_internal(1, x, y, _)};
@@ -10,5 +10,6 @@ const Var x{"x"};  //!< column id of the image
 const Var y{"y"};  //!< row id of the image
 const Var c{"c"};  //!< RGB color channel
 const Var k{"k"};  //!< k-th low-res image
+const Var t{"t"};  //!< t-th tile of the batch
 
 }  // namespace vars
\ No newline at end of file
@@ -9,6 +9,7 @@ using namespace Halide;
 
 using vars::i;
 using vars::k;
+using vars::t;
 using vars::x;
 using vars::y;
 
@@ -22,9 +23,9 @@ generateLR(const ComplexFunc& high_res, const Func& offset, const int32_t k,
            const ComplexFunc& pupil, const Expr width) {
     const ComplexFunc shift_multiplied;
 
-    const Expr new_x = clamp(x + offset(X, k), 0, width * 2 - 1);
-    const Expr new_y = clamp(y + offset(Y, k), 0, width * 2 - 1);
-    shift_multiplied(x, y) = high_res(new_x, new_y) * pupil(x, y);
+    const Expr new_x = clamp(x + offset(X, k, t), 0, width * 2 - 1);
+    const Expr new_y = clamp(y + offset(Y, k, t), 0, width * 2 - 1);
+    shift_multiplied(x, y, t) = high_res(new_x, new_y, t) * pupil(x, y, t);
 
     return shift_multiplied;
 }
@@ -33,75 +34,99 @@ std::pair<ComplexFunc, Func>
 replaceIntensity(const ComplexFunc& simulated, const Func& low_res,
                  const int32_t illumination_idx) {
     const Func magn{"magn_low_res"};
-    magn(x, y) = abs(simulated(x, y)) + 1e-6f;
+    magn(x, y, t) = abs(simulated(x, y, t)) + 1e-6f;
 
-    const ComplexExpr phase_angle = simulated(x, y) / magn(x, y);
+    const ComplexExpr phase_angle = simulated(x, y, t) / magn(x, y, t);
 
     ComplexFunc replaced;
-    replaced(x, y) = phase_angle * low_res(x, y, illumination_idx);
+    replaced(x, y, t) = phase_angle * low_res(x, y, illumination_idx, t);
 
     return {replaced, magn};
 }
 
+/** Sum of the absolute errors between the simulated and the measured amplitudes. */
+Func
+amplitudeError(const ComplexFunc& simulated, const Func& low_res, const RDom& r,
+               const int32_t illumination_idx) {
+    Func error{"abs_error"};
+    error(t) = 0.0f;
+    error(t) += abs(abs(simulated(r.x, r.y, t)) - low_res(r.x, r.y, illumination_idx, t));
+
+    return error;
+}
+
 std::pair<Func, Func>
 normInf(const ComplexFunc input, const RDom& r, const std::string& label) {
     Func sumsq{"sumsq_" + label};
-    sumsq(x, y) = re(input(x, y)) * re(input(x, y)) + im(input(x, y)) * im(input(x, y));
+    sumsq(x, y, t) =
+        re(input(x, y, t)) * re(input(x, y, t)) + im(input(x, y, t)) * im(input(x, y, t));
 
     Func alpha{label};
-    alpha(x) = 0.0f;
-    alpha(x) = max(alpha(x), sumsq(r.x, r.y));
-    alpha(x) = sqrt(alpha(x));
+    alpha(t) = 0.0f;
+    alpha(t) = max(alpha(t), sumsq(r.x, r.y, t));
+    alpha(t) = sqrt(alpha(t));
 
     return {alpha, sumsq};
 }
 
 std::pair<ComplexFunc, ComplexFunc>
 updateHR(const ComplexFunc& high_res, const ComplexFunc& f_difference, const ComplexFunc& pupil,
-         const Func& offset, const Expr alpha, const int32_t k, const Expr width,
-         const float eps = 1e-6f) {
+         const RDom& aperture, const Func& offset, const Expr alpha, const int32_t k,
+         const Expr width, const Expr guard = const_true(), const float eps = 1e-6f) {
     Func pupil_sumsq{"pupil_sumsq"};
-    pupil_sumsq(x, y) = re(pupil(x, y) * conj(pupil(x, y)));
+    pupil_sumsq(x, y, t) = re(pupil(x, y, t) * conj(pupil(x, y, t)));
 
     // Step size of the pseudo-Newton update
     Func step_size{"step_size_newton"};
-    step_size(x, y) = sqrt(pupil_sumsq(x, y)) / (pupil_sumsq(x, y) + eps) / alpha;
+    step_size(x, y, t) = sqrt(pupil_sumsq(x, y, t)) / (pupil_sumsq(x, y, t) + eps) / alpha;
+
+    // The pupil function vanishes outside of the aperture, and so does the
+    // gradient step. Evaluate it inside the aperture only.
+    const RVar& u = aperture.x;
+    const RVar& v = aperture.y;
 
     ComplexFunc delta{"delta"};
-    delta(x, y) = step_size(x, y) * conj(pupil(x, y)) * f_difference(x, y);
+    delta(x, y, t) = ComplexExpr{0.0f, 0.0f};
+    delta(u, v, t) = step_size(u, v, t) * conj(pupil(u, v, t)) * f_difference(u, v, t);
 
-    const Expr in_x_range = (x >= offset(X, k)) && (x < (offset(X, k) + width));
-    const Expr in_y_range = (y >= offset(Y, k)) && (y < (offset(Y, k) + width));
+    const Expr in_x_range = (x >= offset(X, k, t)) && (x < (offset(X, k, t) + width));
+    const Expr in_y_range = (y >= offset(Y, k, t)) && (y < (offset(Y, k, t) + width));
 
     ComplexFunc high_res_new{"high_res"};
-    const Expr new_x = clamp(x - offset(X, k), 0, width - 1);
-    const Expr new_y = clamp(y - offset(Y, k), 0, width - 1);
+    const Expr new_x = clamp(x - offset(X, k, t), 0, width - 1);
+    const Expr new_y = clamp(y - offset(Y, k, t), 0, width - 1);
 
     // Halide language always assumes an infinite area of (optical conjugate)
     // planes. Pass though unchanged values.
-    high_res_new(x, y) = select(               //
-        in_x_range && in_y_range,              //
-        high_res(x, y) - delta(new_x, new_y),  //
-        high_res(x, y));
+    high_res_new(x, y, t) = select(                  //
+        in_x_range && in_y_range && guard,           //
+        high_res(x, y, t) - delta(new_x, new_y, t),  //
+        high_res(x, y, t));
 
     return {high_res_new, delta};
 }
 
 ComplexFunc
 updatePupil(const ComplexFunc& current_pupil, const ComplexFunc& f_difference,
-            const ComplexFunc& f_object, const Expr beta, const Expr weight = 1e-6f) {
+            const ComplexFunc& f_object, const RDom& aperture, const Expr beta,
+            const Expr weight = 1e-6f) {
     constexpr auto Abs = [](ComplexExpr v) { return sqrt(re(v * conj(v))); };
 
     Func f_object_magn{"f_object_magn"};
-    f_object_magn(x, y) = Abs(f_object(x, y));
+    f_object_magn(x, y, t) = Abs(f_object(x, y, t));
 
     // Step size normalized by the power spectrum intensity.
     Func step_size{"step_size_epry"};
-    step_size(x, y) = fast_inverse(lerp(beta, f_object_magn(x, y), weight));
+    step_size(x, y, t) = fast_inverse(lerp(beta, f_object_magn(x, y, t), weight));
+
+    // Constrain the pupil function to the support of the aperture.
+    const RVar& u = aperture.x;
+    const RVar& v = aperture.y;
 
     ComplexFunc new_pupil{"pupil"};
-    new_pupil(x, y) =
-        current_pupil(x, y) - step_size(x, y) * conj(f_object(x, y)) * f_difference(x, y);
+    new_pupil(x, y, t) = current_pupil(x, y, t);
+    new_pupil(u, v, t) = current_pupil(u, v, t) -
+                         step_size(u, v, t) * conj(f_object(u, v, t)) * f_difference(u, v, t);
 
     return new_pupil;
 }
@@ -118,7 +143,8 @@ FPMEpry::design() {
         // Initialize the high resolution image in Fourier domain.
         high_res.resize(n_illumination + 1);
         ComplexFunc h{"high_res"};
-        h(x, y) = {high_res_prev(x, y, RE), high_res_prev(x, y, IM)};
+        h(x, y, t) = {cast<float>(high_res_prev(x, y, RE, t)),
+                      cast<float>(high_res_prev(x, y, IM, t))};
         high_res.front() = std::move(h);
     }
 
@@ -126,7 +152,7 @@ FPMEpry::design() {
         // The || x ||_00, aka peak value of the Fourier spectrum is located at the center.
         const Expr center_x = width;
         const Expr center_y = width;
-        beta() = abs(high_res.front()(center_x, center_y));
+        beta(t) = abs(high_res.front()(center_x, center_y, t));
     }
 
     {
@@ -135,16 +161,33 @@ FPMEpry::design() {
         // Initialize the pupil function.
         pupil.reserve(fpm_mode == AUTO_BRIGHTNESS ? 1 : n_illumination);
         ComplexFunc p{"pupil"};
-        p(x, y) = {pupil_prev(RE, x, y), pupil_prev(IM, x, y)};
+        p(x, y, t) = {cast<float>(pupil_prev(RE, x, y, t)),
+                      cast<float>(pupil_prev(IM, x, y, t))};
         pupil.emplace_back(std::move(p));
     }
 
+    // Widen the measured amplitudes from the storage type.
+    Func measured{"measured"};
+    measured(x, y, k, t) = cast<float>(low_res(x, y, k, t));
+
     // Cropbox's width and height
     r = RDom(0, width, 0, width, "r");
 
     // Compute the max value of the pupil function.
     std::tie(alpha, sumsq_alpha) = normInf(pupil.front(), r, "alpha");
 
+    // Support of the pupil function: span [start, end) of each row.
+    r_aperture = RDom(0, width, 0, width, "r_aperture");
+    r_aperture.where(r_aperture.x >= pupil_support(0, r_aperture.y) &&
+                     r_aperture.x < pupil_support(1, r_aperture.y));
+
+    // The high-res spectrum is overwritten in place. The peak value must be
+    // read beforehand, so the update is guarded by beta. A blank tile, i.e.
+    // beta == 0, is left unchanged.
+    const Expr guard = in_place ? beta(t) > 0.0f : const_true();
+    user_assert(!in_place || n_illumination == 1)
+        << "The in-place mode processes one illumination per pipeline invocation.\n";
+
     // Define the main FPM Maths.
     const auto fpmIter = [&](const ComplexFunc& high_res_prev, const ComplexFunc& current_pupil,
                              const int32_t illumination_idx)
@@ -162,30 +205,34 @@ FPMEpry::design() {
         Func f_estimated_interleaved;
         Func ifft2;
         std::tie(estimated, ifft2, f_estimated_interleaved) =
-            fft2C2C(f_estimated, width, INVERSE, "f_estimated_interleaved");
+            fft2C2C(f_estimated, width, INVERSE, "f_estimated_interleaved", fft_backend);
+
+        // Measure the residual before replacing the intensity.
+        abs_error[illumination_idx] = amplitudeError(estimated, measured, r, illumination_idx);
 
         // Replace the intensity.
         const auto [replaced, magn_low_res] =
-            replaceIntensity(estimated, low_res, illumination_idx);
+            replaceIntensity(estimated, measured, illumination_idx);
 
         // Compensate the FFT gain
         ComplexFunc normalized{"normalized"};
-        normalized(x, y) = replaced(x, y) / tile_size / tile_size;
+        normalized(x, y, t) = replaced(x, y, t) / tile_size / tile_size;
 
         // Simulate the Fourier plane.
         ComplexFunc f_replaced;
         Func fft2;
         Func replaced_interleaved;
         std::tie(f_replaced, fft2, replaced_interleaved) =
-            fft2C2C(normalized, width, FORWARD, "replaced_interleaved");
+            fft2C2C(normalized, width, FORWARD, "replaced_interleaved", fft_backend);
 
         // Update the high resolution image in Fourier domain via backward
         // propagation.
         ComplexFunc f_difference{"f_difference"};
-        f_difference(x, y) = f_replaced(x, y) - f_estimated(x, y);
+        f_difference(x, y, t) = f_replaced(x, y, t) - f_estimated(x, y, t);
 
-        const auto [this_high_res, delta] = updateHR(high_res_prev, f_difference, current_pupil,
-                                                     k_offset, alpha(0), illumination_idx, width);
+        const auto [this_high_res, delta] =
+            updateHR(high_res_prev, f_difference, current_pupil, r_aperture, k_offset, alpha(t),
+                     illumination_idx, width, guard);
 
         // Return all intermediate (optical) planes for GPU experts to tune the
         // GPU performance.
@@ -199,16 +246,29 @@ FPMEpry::design() {
     // cannot simply "update" a small region of interest of the high resolution
     // image in the Fourier domain. One must always describe a new (Fourier)
     // plane and define the values inside and outside the ROIs. Halide compiler
-    // smartly figures out which direct copies can be skipped.
+    // smartly figures out which direct copies can be skipped. The in_place
+    // mode sidesteps it by letting the caller alias the input and output
+    // buffers, and restrict the output to the ROI.
     f_estimated_interleaved.resize(n_illumination);
     replaced_interleaved.resize(n_illumination);
     fft2.resize(n_illumination);
     ifft2.resize(n_illumination);
     delta.resize(n_illumination);
     magn_low_res.resize(n_illumination);
+    f_estimated.resize(n_illumination);
+    abs_error.resize(n_illumination);
 
     f_difference.reserve(n_illumination);
 
+    // Mean absolute amplitude error over all pixels and illuminations.
+    const auto reduceResidual = [&]() {
+        Expr sum = abs_error.front()(t);
+        for (uint32_t i = 1; i < n_illumination; i++) {
+            sum += abs_error[i](t);
+        }
+        residual(t) = sum / float(width * width * n_illumination);
+    };
+
     if (fpm_mode == AUTO_BRIGHTNESS) {
         // Lock the pupil function. Perform FPM iterations for all low-res
         // images. Pupil update steps are defined and discarded on the fly.
@@ -217,34 +277,40 @@ FPMEpry::design() {
             using std::ignore;
             const auto& original_pupil = pupil.front();
 
-            std::tie(high_res.at(i + 1), ignore, ignore, f_estimated_interleaved[i],
+            std::tie(high_res.at(i + 1), ignore, f_estimated[i], f_estimated_interleaved[i],
                      replaced_interleaved[i], ifft2[i], fft2[i], delta[i], magn_low_res[i]) =
                 fpmIter(high_res[i], original_pupil, i % n_illumination);
         }
 
         const auto& most_recent_high_res = high_res.back();
-        high_res_new(i, x, y) =
-            mux(i, {most_recent_high_res(x, y).re(), most_recent_high_res(x, y).im()});
-
-        // Fill with zeros to indicate no action.
-        pupil_new(i, x, y) = 0.0f;
+        high_res_new(x, y, i, t) =
+            cast(high_res_new.type(),
+                 mux(i, {most_recent_high_res(x, y, t).re(), most_recent_high_res(x, y, t).im()}));
+
+        // Pass the locked pupil through, so that the caller can alias the
+        // input and output buffers across iterations.
+        pupil_new(i, x, y, t) = pupil_prev(i, x, y, t);
+        reduceResidual();
         return;
     }
 
     // else fpm_mode == PUPIL_RECOVERY
     for (uint32_t i = 0; i < n_illumination; i++) {
         ComplexFunc f_diff;
-        ComplexFunc f_estimated;
-        std::tie(high_res.at(i + 1), f_diff, f_estimated, f_estimated_interleaved[i],
+        std::tie(high_res.at(i + 1), f_diff, f_estimated[i], f_estimated_interleaved[i],
                  replaced_interleaved[i], ifft2[i], fft2[i], delta[i], magn_low_res[i]) =
             fpmIter(high_res[i], pupil.back(), i % n_illumination);
 
-        pupil.emplace_back(updatePupil(pupil.back(), f_diff, f_estimated, beta()));
+        pupil.emplace_back(updatePupil(pupil.back(), f_diff, f_estimated[i], r_aperture, beta(t)));
         f_difference.emplace_back(std::move(f_diff));
     }
 
-    high_res_new(x, y, i) = mux(i, {re(high_res.back()(x, y)), im(high_res.back()(x, y))});
-    pupil_new(i, x, y) = mux(i, {re(pupil.back()(x, y)), im(pupil.back()(x, y))});
+    // Narrow the results to the storage type.
+    high_res_new(x, y, i, t) = cast(high_res_new.type(),
+                                    mux(i, {re(high_res.back()(x, y, t)), im(high_res.back()(x, y, t))}));
+    pupil_new(i, x, y, t) =
+        cast(pupil_new.type(), mux(i, {re(pupil.back()(x, y, t)), im(pupil.back()(x, y, t))}));
+    reduceResidual();
 }
 }  // namespace algorithms
 
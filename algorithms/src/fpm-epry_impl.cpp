@@ -5,6 +5,7 @@ using namespace Halide;
 
 using vars::i;
 using vars::k;
+using vars::t;
 using vars::x;
 using vars::y;
 
@@ -14,18 +15,38 @@ FPMEpry::setBounds() {
     const int W = tile_size;
     const int W2 = W * oversampling_factor;
 
+    // The pipeline is specialized for the number of illuminations. Reject
+    // the buffers of any other size.
+    const int n_slides = n_illumination;
     low_res.dim(0).set_bounds(0, W).set_stride(1);
     low_res.dim(1).set_bounds(0, W).set_stride(W);
-    low_res.dim(2).set_min(0).set_stride(W * W);
-    const auto n_slides = low_res.dim(2).extent();
+    low_res.dim(2).set_bounds(0, n_slides).set_stride(W * W);
+
+    // Tiles of the batch are stacked in the last dimension.
+    const auto n_tiles = low_res.dim(3).extent();
+    low_res.dim(3).set_min(0);
 
     k_offset.dim(0).set_bounds(0, 2).set_stride(1);
     k_offset.dim(1).set_bounds(0, n_slides).set_stride(2);
+    k_offset.dim(2).set_bounds(0, n_tiles);
+
+    pupil_support.dim(0).set_bounds(0, 2).set_stride(1);
+    pupil_support.dim(1).set_bounds(0, W).set_stride(2);
+
+    // The caller may pass a subset of the illuminations, e.g. one chunk of a
+    // larger stack. The stride between the tiles remains that of the full
+    // stack, hence not constrained.
 
-    const auto setComplexBound = [=](auto& p, const int w, bool demux_real_imag) {
+    const auto setComplexBound = [=](auto& p, const int w, bool demux_real_imag,
+                                     bool is_cropped = false) {
         if (demux_real_imag) {
-            p.dim(0).set_bounds(0, w).set_stride(1);
-            p.dim(1).set_bounds(0, w).set_stride(w);
+            if (is_cropped) {
+                p.dim(0).set_stride(1);
+                p.dim(1).set_stride(w);
+            } else {
+                p.dim(0).set_bounds(0, w).set_stride(1);
+                p.dim(1).set_bounds(0, w).set_stride(w);
+            }
             p.dim(2).set_bounds(0, 2).set_stride(w * w);
 
         } else {
@@ -33,12 +54,23 @@ FPMEpry::setBounds() {
             p.dim(1).set_bounds(0, w).set_stride(2);
             p.dim(2).set_bounds(0, w).set_stride(2 * w);
         }
+        p.dim(3).set_bounds(0, n_tiles).set_stride(2 * w * w);
     };
 
     setComplexBound(high_res_prev, W2, true);
-    setComplexBound(high_res_new, W2, true);
+    setComplexBound(high_res_new, W2, true, in_place);
     setComplexBound(pupil_prev, W, false);
     setComplexBound(pupil_new, W, false);
+
+    residual.dim(0).set_bounds(0, n_tiles).set_stride(1);
+}
+
+TailStrategy
+FPMEpry::outputTail() const {
+    // The cropped window is rarely a multiple of the split. Shifting the
+    // last split inwards would recompute the pixels from the input already
+    // overwritten by the aliased output, so each pixel must be visited once.
+    return in_place ? TailStrategy::GuardWithIf : TailStrategy::Auto;
 }
 
 void
@@ -47,52 +79,99 @@ FPMEpry::implementation() {
     const int W2 = W * oversampling_factor;
 
     if (using_autoscheduler()) {
-        k_offset.set_estimates({{0, 2}, {0, n_illumination}});
+        constexpr int n_tiles = 1;
+        k_offset.set_estimates({{0, 2}, {0, n_illumination}, {0, n_tiles}});
 
-        high_res_prev.set_estimates({{0, W2}, {0, W2}, {0, 2}});
+        pupil_support.set_estimates({{0, 2}, {0, W}});
 
-        high_res_new.set_estimates({{0, W2}, {0, W2}, {0, 2}});
+        high_res_prev.set_estimates({{0, W2}, {0, W2}, {0, 2}, {0, n_tiles}});
 
-        pupil_prev.set_estimates({{0, 2}, {0, W}, {0, W}});
+        high_res_new.set_estimates({{0, W2}, {0, W2}, {0, 2}, {0, n_tiles}});
 
-        pupil_new.set_estimates({{0, 2}, {0, W}, {0, W}});
+        pupil_prev.set_estimates({{0, 2}, {0, W}, {0, W}, {0, n_tiles}});
+
+        pupil_new.set_estimates({{0, 2}, {0, W}, {0, W}, {0, n_tiles}});
+
+        residual.set_estimates({{0, n_tiles}});
 
         return;
     }
 
     const auto target = get_target();
-    assert(target.has_gpu_feature() && "GPU target required for manual implementation.");
+    if (!target.has_gpu_feature()) {
+        implementationCPU();
+        return;
+    }
 
     const Var x_vo{"xo"}, y_o{"yo"}, x_vi{"xi"}, y_i{"yi"};
 
+    // Tiles of the batch are mapped to the 3rd dimension of the GPU blocks.
     pupil_new  //
         .gpu_tile(x, y, x_vo, y_o, x_vi, y_i, W, 1)
+        .gpu_blocks(t)
         .unroll(i);
 
     high_res_new  //
-        .gpu_tile(x, y, x_vo, y_o, x_vi, y_i, W, 1)
+        .reorder(i, x, y, t)
+        .gpu_tile(x, y, x_vo, y_o, x_vi, y_i, W, 1, outputTail())
+        .gpu_blocks(t)
         .unroll(i);
 
+    // One GPU block per row of the aperture. The threads outside of the
+    // pupil support are idle.
+    const auto scheduleAperture = [&](Func& f) {
+        f.update(0).gpu_blocks(r_aperture.y, t).gpu_threads(r_aperture.x);
+    };
+
     for (auto& s : pupil) {
         s.compute_root()  //
-            .gpu_tile(x, y, x_vo, y_o, x_vi, y_i, 128, 1);
+            .gpu_tile(x, y, x_vo, y_o, x_vi, y_i, 128, 1)
+            .gpu_blocks(t);
+
+        if (s.has_update_definition()) {
+            scheduleAperture(s);
+        }
     }
 
     for (auto& s : f_difference) {
         s.compute_root()  //
-            .gpu_tile(x, y, x_vo, y_o, x_vi, y_i, 128, 1);
+            .gpu_tile(x, y, x_vo, y_o, x_vi, y_i, 128, 1)
+            .gpu_blocks(t);
     }
 
-    for (auto& s : high_res) {
-        s.compute_root()  //
-            .gpu_tile(x, y, x_vo, y_o, x_vi, y_i, 128, 1);
+    // In the in-place mode, the high-res planes are inlined into the cropped
+    // output. Do not materialize the full oversampled plane.
+    if (!in_place) {
+        for (auto& s : high_res) {
+            s.compute_root()  //
+                .gpu_tile(x, y, x_vo, y_o, x_vi, y_i, 128, 1)
+                .gpu_blocks(t);
+        }
     }
 
     for (auto& s : delta) {
         s.compute_root()  //
             .bound(x, 0, W)
             .bound(y, 0, W)
-            .gpu_tile(x, y, x_vo, y_o, x_vi, y_i, 128, 1);
+            .gpu_tile(x, y, x_vo, y_o, x_vi, y_i, 128, 1)
+            .gpu_blocks(t);
+
+        scheduleAperture(s);
+    }
+
+    // Read the window of the high-res spectrum, and its peak value, before the
+    // output overwrites them.
+    if (in_place) {
+        for (auto& s : f_estimated) {
+            s.compute_root()  //
+                .bound(x, 0, W)
+                .bound(y, 0, W)
+                .gpu_tile(x, y, x_vo, y_o, x_vi, y_i, 128, 1)
+                .gpu_blocks(t);
+        }
+
+        const Var b_o{"bo"}, b_i{"bi"};
+        beta.compute_root().split(t, b_o, b_i, 1).gpu(b_o, b_i);
     }
 
     for (auto& s : fft2) {
@@ -104,6 +183,7 @@ FPMEpry::implementation() {
             .bound(x, 0, W)
             .bound(y, 0, W)
             .gpu_tile(x, y, x_vo, y_o, x_vi, y_i, 128, 1)
+            .gpu_blocks(t)
             .bound(i, 0, 2)
             .unroll(i);
     }
@@ -121,21 +201,39 @@ FPMEpry::implementation() {
             .bound(x, 0, W)
             .bound(y, 0, W)
             .gpu_tile(x, y, x_vo, y_o, x_vi, y_i, 128, 1)
+            .gpu_blocks(t)
             .bound(i, 0, 2)
             .unroll(i);
     }
 
-    // Fuse zero-init, maximum(), and sqrt() into one single GPU kernel.
-    alpha.compute_at(alpha.in(), x_vi);
+    // Sum the absolute errors by rows, one GPU thread per row, and then sum
+    // the rows in a single thread per tile.
+    const Var t_o{"to"}, t_i{"ti"};
+    residual.split(t, t_o, t_i, 1).gpu(t_o, t_i);
+
+    for (auto& s : abs_error) {
+        const Var v{"v"};
+        auto error_intm = s.update(0).rfactor(r.y, v);
+
+        s.compute_root().split(t, t_o, t_i, 1).gpu(t_o, t_i);
+        s.update(0).split(t, t_o, t_i, 1).gpu(t_o, t_i);
+
+        error_intm.compute_root().gpu_blocks(t).gpu_threads(v);
+        error_intm.update(0).gpu_blocks(t).gpu_threads(v);
+    }
+
+    // Fuse zero-init, maximum(), and sqrt() into one single GPU kernel per
+    // tile.
+    alpha.compute_at(alpha.in(), t_i);
 
-    alpha.in().compute_root().split(x, x_vo, x_vi, 1).gpu(x_vo, x_vi);
+    alpha.in().compute_root().split(t, t_o, t_i, 1).gpu(t_o, t_i);
 
     // Compute intermediate max values by columns.
     const RVar rxo{"rxo"}, ryo{"ryo"}, rxi{"rxi"}, ryi{"ryi"};
     alpha.update(0).tile(r.x, r.y, rxo, ryo, rxi, ryi, 1, W);
 
     // implement sqrt() in GPU thread
-    alpha.update(1).gpu_threads(x);
+    alpha.update(1).gpu_threads(t);
 
     const Var u{"u"};
     const Var v{"v"};
@@ -148,7 +246,162 @@ FPMEpry::implementation() {
     alpha_intm.compute_at(alpha_intm.in(), u);
 
     // Iterate over rows via SIMD.
-    alpha_intm.in().compute_at(alpha.in(), x_vo).gpu_threads(u);
+    alpha_intm.in().compute_at(alpha.in(), t_o).gpu_threads(u);
+}
+
+void
+FPMEpry::implementationCPU() {
+    const int W = tile_size;
+    const int vector_size = get_target().natural_vector_size<float>();
+
+    // Each thread processes a strip of rows of one tile; the strip is small
+    // enough to keep the per-illumination intermediates in the L2 cache.
+    constexpr int rows_per_task = 8;
+    const Var y_o{"yo"}, y_i{"yi"};
+
+    pupil_new  //
+        .bound(i, 0, 2)
+        .unroll(i)
+        .vectorize(x, vector_size)
+        .parallel(y)
+        .parallel(t);
+
+    high_res_new  //
+        .reorder(x, i, y, t)
+        .unroll(i)
+        .vectorize(x, vector_size, outputTail())
+        .parallel(y)
+        .parallel(t);
+
+    // The rows of the aperture are trimmed to the pupil support.
+    const auto scheduleAperture = [&](Func& f) {
+        f.update(0).parallel(r_aperture.y).parallel(t);
+    };
+
+    for (auto& s : pupil) {
+        s.compute_root()  //
+            .split(y, y_o, y_i, rows_per_task)
+            .parallel(y_o)
+            .parallel(t)
+            .vectorize(x, vector_size);
+
+        if (s.has_update_definition()) {
+            scheduleAperture(s);
+        }
+    }
+
+    // The gradient step is evaluated over the aperture once, instead of per
+    // strip of the consumer.
+    for (auto& s : delta) {
+        s.compute_root()  //
+            .bound(x, 0, W)
+            .bound(y, 0, W)
+            .split(y, y_o, y_i, rows_per_task)
+            .parallel(y_o)
+            .parallel(t)
+            .vectorize(x, vector_size);
+
+        scheduleAperture(s);
+    }
+
+    for (auto& s : f_difference) {
+        s.compute_root()  //
+            .split(y, y_o, y_i, rows_per_task)
+            .parallel(y_o)
+            .parallel(t)
+            .vectorize(x, vector_size);
+    }
+
+    if (in_place) {
+        // The high-res planes are inlined into the cropped output. Read the
+        // window of the high-res spectrum, and its peak value, before the
+        // output overwrites them.
+        for (auto& s : f_estimated) {
+            s.compute_root()  //
+                .bound(x, 0, W)
+                .bound(y, 0, W)
+                .split(y, y_o, y_i, rows_per_task)
+                .parallel(y_o)
+                .parallel(t)
+                .vectorize(x, vector_size);
+        }
+
+        beta.compute_root();
+    } else {
+        for (auto& s : high_res) {
+            s.compute_root()  //
+                .split(y, y_o, y_i, rows_per_task)
+                .parallel(y_o)
+                .parallel(t)
+                .vectorize(x, vector_size);
+        }
+    }
+
+    for (auto& s : fft2) {
+        s.compute_root();
+    }
+
+    for (auto& s : replaced_interleaved) {
+        s.compute_root()  //
+            .bound(x, 0, W)
+            .bound(y, 0, W)
+            .bound(i, 0, 2)
+            .unroll(i)
+            .vectorize(x, vector_size)
+            .parallel(y)
+            .parallel(t);
+    }
+
+    for (size_t idx = 0; idx < replaced_interleaved.size(); idx++) {
+        magn_low_res[idx]
+            .compute_at(replaced_interleaved[idx], y)  //
+            .vectorize(x, vector_size);
+    }
+
+    for (auto& s : ifft2) {
+        s.compute_root();
+    }
+
+    for (auto& s : f_estimated_interleaved) {
+        s.compute_root()  //
+            .bound(x, 0, W)
+            .bound(y, 0, W)
+            .bound(i, 0, 2)
+            .unroll(i)
+            .vectorize(x, vector_size)
+            .parallel(y)
+            .parallel(t);
+    }
+
+    // Parallel max() reduction: one partial result per strip of rows, followed
+    // by a serial max() over the strips, and then sqrt().
+    alpha.compute_root().parallel(t);
+
+    const RVar ryo{"ryo"}, ryi{"ryi"};
+    const Var v{"v"};
+
+    // Likewise, parallel sum of the absolute errors.
+    for (auto& s : abs_error) {
+        s.compute_root().parallel(t);
+
+        auto error_intm = s.update(0)  //
+                              .split(r.y, ryo, ryi, rows_per_task)
+                              .rfactor(ryo, v);
+
+        error_intm.compute_root()  //
+            .update(0)
+            .parallel(v)
+            .parallel(t);
+    }
+
+    auto alpha_intm = alpha.update(0)  //
+                          .split(r.y, ryo, ryi, rows_per_task)
+                          .rfactor(ryo, v);
+
+    alpha_intm.compute_root()  //
+        .update(0)
+        .parallel(v)
+        .parallel(t);
 }
 
 }  // namespace algorithms
\ No newline at end of file
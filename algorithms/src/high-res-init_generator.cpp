@@ -8,11 +8,11 @@
 namespace {
 using namespace Halide;
 
-using constants::tile_size;
 using linear_ops::fft2C2C;
 using std::ignore;
 using vars::i;
 using vars::k;
+using vars::t;
 using vars::x;
 using vars::y;
 const Var kx{"kx"};
@@ -20,10 +20,19 @@ const Var ky{"ky"};
 
 constexpr bool FORWARD = true;
 
+/** Initialize the high-resolution spectrum of a batch of tiles.
+ *
+ * The storage types of low_res and f_high_res are selected with the
+ * `<name>.type` generator params.
+ */
 class HighResInit : public Generator<HighResInit> {
    public:
-    Input<Buffer<float, 3>> low_res{"low_res"};
-    Output<Buffer<float, 3>> f_high_res{"f_high_res"};
+    Input<Buffer<void, 4>> low_res{"low_res"};
+    Output<Buffer<void, 4>> f_high_res{"f_high_res"};
+
+    GeneratorParam<linear_ops::fft_backend_t> fft_backend{
+        "fft_backend", linear_ops::fft_backend_t::CUFFT, linear_ops::fft_backend_names};
+    GeneratorParam<int32_t> tile_size{"tile_size", constants::tile_size, 0, 512};
 
     void generate();
     void schedule();
@@ -38,10 +47,12 @@ class HighResInit : public Generator<HighResInit> {
 
 void
 HighResInit::generate() {
+    const int W = tile_size;
+
     // Select the 1st image and convert to complex value. Also multiply it with
     // a phase ramp; it is equivalent to the FFT2Shift in Fourier space.
     constexpr auto first_frame_id = 0;
-    cx_low_res(x, y) = {low_res(x, y, first_frame_id), 0.0f};
+    cx_low_res(x, y, t) = {cast<float>(low_res(x, y, first_frame_id, t)), 0.0f};
 
     // Compute the Fourier domain of the brightfield image
     //
@@ -49,51 +60,79 @@ HighResInit::generate() {
     // symmetry in Fourier domain. Since this operation is one-off outside the
     // FPM-EPRY loop, we choose not to implement it.
     std::tie(ignore, f_low_res_internal, low_res_internal) =
-        fft2C2C(cx_low_res, tile_size, FORWARD, "f_low_res");
+        fft2C2C(cx_low_res, W, FORWARD, "f_low_res", fft_backend);
 
     // Demultiplex the real/imaginary components
     Func demux{"demux"};
-    demux(kx, ky, i) = f_low_res_internal(i, kx, ky);
+    demux(kx, ky, i, t) = f_low_res_internal(i, kx, ky, t);
 
     // Unfold the FFT result to the infinite Fourier plane.
-    const Func tiled = BoundaryConditions::repeat_image(demux, {{0, tile_size}, {0, tile_size}});
+    const Func tiled = BoundaryConditions::repeat_image(demux, {{0, W}, {0, W}});
 
     // Interpolation in spatial domain is zero-padding in Fourier domain.
     Func zeropadded{"zeropadded"};
-    const Expr is_in_xrange = (-tile_size / 2 <= kx) && (kx < tile_size / 2);
-    const Expr is_in_yrange = (-tile_size / 2 <= ky) && (ky < tile_size / 2);
-    zeropadded(kx, ky, i) = select(is_in_xrange && is_in_yrange,  //
-                                   tiled(kx, ky, i), 0.0f);
+    const Expr is_in_xrange = (-W / 2 <= kx) && (kx < W / 2);
+    const Expr is_in_yrange = (-W / 2 <= ky) && (ky < W / 2);
+    zeropadded(kx, ky, i, t) = select(is_in_xrange && is_in_yrange,  //
+                                      tiled(kx, ky, i, t), 0.0f);
 
     // Center the Fourier space to the coordinate (T, T). The full view is (2T, 2T).
-    f_high_res(kx, ky, i) = zeropadded(kx - tile_size, ky - tile_size, i);
+    f_high_res(kx, ky, i, t) =
+        cast(f_high_res.type(), zeropadded(kx - W, ky - W, i, t));
 }
 
 void
 HighResInit::setBounds() {
-    constexpr auto T2 = tile_size * 2;
+    const int T2 = tile_size * 2;
     f_high_res.dim(0).set_bounds(0, T2).set_stride(1);
     f_high_res.dim(1).set_bounds(0, T2).set_stride(T2);
     f_high_res.dim(2).set_bounds(0, 2).set_stride(T2 * T2);
 
-    constexpr auto T = tile_size;
+    const int T = tile_size;
     low_res.dim(0).set_bounds(0, T).set_stride(1);
     low_res.dim(1).set_bounds(0, T).set_stride(T);
     low_res.dim(2).set_min(0).set_stride(T * T);
+
+    const auto n_slides = low_res.dim(2).extent();
+    low_res.dim(3).set_min(0).set_stride(T * T * n_slides);
+
+    const auto n_tiles = low_res.dim(3).extent();
+    f_high_res.dim(3).set_bounds(0, n_tiles).set_stride(T2 * T2 * 2);
 }
 
 void
 HighResInit::schedule() {
     assert(!using_autoscheduler() && "Autoschedule not implemented");
-    assert(get_target().has_gpu_feature() && "Only GPU implementation is supported.");
 
     setBounds();
 
     const Var xi{"xi"};
     const Var yi{"yi"};
 
-    f_high_res.reorder(i, kx, ky)
+    if (!get_target().has_gpu_feature()) {
+        const int vector_size = get_target().natural_vector_size<float>();
+
+        f_high_res.reorder(kx, i, ky, t)  //
+            .unroll(i)
+            .vectorize(kx, vector_size)
+            .parallel(ky)
+            .parallel(t);
+
+        f_low_res_internal.compute_root();
+
+        low_res_internal
+            .compute_root()  //
+            .bound(i, 0, 2)
+            .unroll(i)
+            .vectorize(x, vector_size)
+            .parallel(y)
+            .parallel(t);
+        return;
+    }
+
+    f_high_res.reorder(i, kx, ky, t)
         .gpu_tile(kx, ky, xi, yi, 32, 32)  //
+        .gpu_blocks(t)
         .unroll(i);
 
     f_low_res_internal.compute_root();
@@ -101,6 +140,7 @@ HighResInit::schedule() {
     low_res_internal
         .compute_root()  //
         .gpu_tile(x, y, xi, yi, 128, 1)
+        .gpu_blocks(t)
         .unroll(i);
 }
 
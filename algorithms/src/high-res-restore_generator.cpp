@@ -9,7 +9,6 @@
 namespace {
 using namespace Halide;
 
-using constants::tile_size;
 using linear_ops::fft2C2C;
 using std::ignore;
 using vars::i;
@@ -18,10 +17,16 @@ using vars::y;
 
 class HighResRestore : public Generator<HighResRestore> {
    public:
-    Input<Buffer<const float, 3>> f_high_res{"f_high_res"};
+    /** Storage type selected with the `f_high_res.type` generator param. */
+    Input<Buffer<void, 3>> f_high_res{"f_high_res"};
     Output<Buffer<float, 3>> high_res{"high_res"};
 
-    GeneratorParam<float> gain{"gain", 1.0f / tile_size / tile_size, 1e-12f, 1.0f};
+    GeneratorParam<int32_t> tile_size{"tile_size", constants::tile_size, 0, 512};
+
+    /** Gain of the inverse FFT; zero to normalize by the tile area. */
+    GeneratorParam<float> gain{"gain", 0.0f, 0.0f, 1.0f};
+    GeneratorParam<linear_ops::fft_backend_t> fft_backend{
+        "fft_backend", linear_ops::fft_backend_t::CUFFT, linear_ops::fft_backend_names};
 
     void generate();
     void schedule();
@@ -37,21 +42,26 @@ class HighResRestore : public Generator<HighResRestore> {
 
 void
 HighResRestore::generate() {
+    const int W = tile_size;
+    const float g = (gain > 0.0f) ? float(gain) : 1.0f / float(W * W);
+
     // Since we don't have darkfield images, the superresolution Nyquist
     // bandwidth is far less than 4x of the raw images. Crop to the center of
     // the Fourier domain. This is equivalent to downsampling in spatial domain.
     {
         using namespace types;
-        static_assert(tile_size % 2 == 0,
-                      "Tile size must be an even number for 2D sub-sampling to work.");
-        cropped(x, y) = {f_high_res(x + tile_size / 2, y + tile_size / 2, RE) * gain,
-                         f_high_res(x + tile_size / 2, y + tile_size / 2, IM) * gain};
+        user_assert(W % 2 == 0)
+            << "Tile size must be an even number for 2D sub-sampling to work.\n";
+        const Expr cx = x + W / 2;
+        const Expr cy = y + W / 2;
+        cropped(x, y) = {cast<float>(f_high_res(cx, cy, RE)) * g,
+                         cast<float>(f_high_res(cx, cy, IM)) * g};
     }
 
     // Compute the Spatial domain of the high-resolution image
     constexpr bool INVERSE = false;
     std::tie(ifft_transformed, ifft_internal, f_high_res_internal) =
-        fft2C2C(cropped, tile_size, INVERSE, "f_high_res_internal");
+        fft2C2C(cropped, W, INVERSE, "f_high_res_internal", fft_backend);
 
     // iFFTShift in Fourier space is equivalent to phase ramp in spatial domain.
     const auto [phase_shifted, sign] = linear_ops::applyCheckerboard(ifft_transformed);
@@ -62,12 +72,12 @@ HighResRestore::generate() {
 
 void
 HighResRestore::setBounds() {
-    constexpr auto T = tile_size;
+    const int T = tile_size;
     high_res.dim(0).set_bounds(0, 2).set_stride(1);
     high_res.dim(1).set_bounds(0, T).set_stride(2);
     high_res.dim(2).set_bounds(0, T).set_stride(T * 2);
 
-    constexpr auto T2 = tile_size * 2;
+    const int T2 = tile_size * 2;
     f_high_res.dim(0).set_bounds(0, T2).set_stride(1);
     f_high_res.dim(1).set_bounds(0, T2).set_stride(T2);
     f_high_res.dim(2).set_bounds(0, 2).set_stride(T2 * T2);
@@ -76,12 +86,29 @@ HighResRestore::setBounds() {
 void
 HighResRestore::schedule() {
     assert(!using_autoscheduler() && "Autoschedule not implemented");
-    assert(get_target().has_gpu_feature() && "Only GPU implementation is supported.");
 
     setBounds();
 
     const Var xi, yi;
 
+    if (!get_target().has_gpu_feature()) {
+        const int vector_size = get_target().natural_vector_size<float>();
+
+        high_res
+            .unroll(i)  //
+            .vectorize(x, vector_size)
+            .parallel(y);
+
+        ifft_internal.compute_root();
+
+        f_high_res_internal.compute_root()
+            .bound(i, 0, 2)  //
+            .unroll(i)
+            .vectorize(x, vector_size)
+            .parallel(y);
+        return;
+    }
+
     high_res
         .gpu_tile(x, y, xi, yi, 128, 1)  //
         .unroll(i);
@@ -12,14 +12,16 @@ using vars::k;
 using vars::x;
 using vars::y;
 
-constexpr auto T = constants::tile_size;
-
 /** Given a stack of 16-bit raw images, apply gamma correction. */
 class LowResInit : public Generator<LowResInit> {
    public:
     Input<Buffer<const uint8_t, 3>> raw{"raw"};
     Input<float> gamma{"gamma", 0.5f, 0.2f, 1.0f};
-    Output<Buffer<float, 3>> amplitude{"amplitude"};
+
+    /** Storage type selected with the `amplitude.type` generator param. */
+    Output<Buffer<void, 3>> amplitude{"amplitude"};
+
+    GeneratorParam<int32_t> tile_size{"tile_size", constants::tile_size, 0, 512};
 
     void generate();
     void schedule();
@@ -33,17 +35,20 @@ class LowResInit : public Generator<LowResInit> {
 
 void
 LowResInit::generate() {
+    const int T = tile_size;
     const RDom r{0, T, 0, T, "all_pixels"};
     average_brightness(k) = 0.0f;
     average_brightness(k) += raw(r.x, r.y, k);
 
     normalized(x, y, k) = average_brightness(0) / average_brightness(k) * raw(x, y, k);
 
-    amplitude = linear_ops::adjustBrightness(normalized, gamma, 0.0f, 255.0f);
+    const Func adjusted = linear_ops::adjustBrightness(normalized, gamma, 0.0f, 255.0f);
+    amplitude(x, y, k) = cast(amplitude.type(), adjusted(x, y, k));
 }
 
 void
 LowResInit::setBounds() {
+    const int T = tile_size;
     raw.dim(0).set_bounds(0, T).set_stride(1);
     raw.dim(1).set_bounds(0, T).set_stride(T);
     raw.dim(2).set_min(0).set_stride(T * T);
@@ -59,6 +64,7 @@ LowResInit::schedule() {
 
     setBounds();
 
+    const int T = tile_size;
     constexpr auto n_illuminations = 49;
     raw.set_estimates({{0, T}, {0, T}, {0, n_illuminations}});
     gamma.set_estimate(0.6f);
@@ -1,7 +1,5 @@
 #include "decode-fluorescence.h"
 
-#include <halide_image_io.h>
-
 #include <armadillo>
 #include <highfive/H5DataSet.hpp>
 #include <highfive/H5File.hpp>
@@ -9,7 +7,7 @@
 
 #include "constants.h"
 #include "raw2bgr.h"
-#include "save_xml_raw.h"
+#include "save-plane.h"
 
 using cmos::height;
 using cmos::width;
@@ -42,33 +40,24 @@ DecodeFluorescence::definePipeflow() {
         constexpr auto focal_shift = 2;
         plane_id(1) = std::min(plane_id(0) + focal_shift, zsize - 1);
 
-        using storage::readSlice;
-        auto egfp_plane = readSlice(dataset, well_id, plane_id(0), width, height);
-        auto txred_plane = readSlice(dataset, well_id, plane_id(1), width, height);
-
         const auto line_id = pf.line();
-        buffer[line_id] = input_t{std::move(egfp_plane), std::move(txred_plane)};
+        using storage::readSlice;
+        readSlice(dataset, well_id, plane_id(0), planes[line_id].egfp);
+        readSlice(dataset, well_id, plane_id(1), planes[line_id].txred);
     };
 
     auto decode = [&](const tf::Pipeflow& pf) {
-        using storage::slice_t;
-
         const auto line_id = pf.line();
-        auto& image_pair = std::get<input_t>(buffer[line_id]);
-
-        using Halide::Runtime::Buffer;
-        output_t output(width, height, 3);
+        auto& image_pair = planes[line_id];
 
         // TODO(Antony): Output the interleaved image, not planar.
-        const auto error = raw2bgr(image_pair.egfp, image_pair.txred, output);
+        const auto error = raw2bgr(image_pair.egfp, image_pair.txred, bgr[line_id]);
         assert(!error && "Halide error.");
-
-        buffer[line_id] = std::move(output);
     };
 
     auto writeImage = [&](const tf::Pipeflow& pf) {
         const auto line_id = pf.line();
-        auto normalized_image = std::move(std::get<output_t>(buffer[line_id]));
+        auto& normalized_image = bgr[line_id];
 
         const auto job_id = pf.token();
         const int well_id = image_list[job_id].well_id;
@@ -76,21 +65,7 @@ DecodeFluorescence::definePipeflow() {
 
         const auto writeSlice = [&](int idx, const std::string& path) {
             auto slice = normalized_image.sliced(2, idx);
-            using f = storage::format_t;
-            switch (format) {
-                case f::TIF:
-                    [[fallthrough]];
-                case f::PNG:
-                    Halide::Tools::convert_and_save_image(slice, path);
-                    break;
-                case f::XML:
-                    storage::saveXML(
-                        storage::span_t<uint8_t>{slice.begin(), slice.number_of_elements()}, path);
-                    break;
-                case f::UNKNOWN:
-                    // Not implemented
-                    break;
-            }
+            savePlane(slice, format, path, options);
             std::cout << "Well[" << well_id << "] -> " << path << std::endl;
         };
 
@@ -119,8 +94,9 @@ DecodeFluorescence::definePipeflow() {
     cleanup.name("cleanup");
 }
 
-DecodeFluorescence::DecodeFluorescence(const HighFive::File& f, const image_list_t& list)
-    : file(f), dataset(f.getDataSet("fluorescence")) {
+DecodeFluorescence::DecodeFluorescence(const HighFive::File& f, const image_list_t& list,
+                                       const storage::image_options_t& o)
+    : options{o}, file(f), dataset(f.getDataSet("fluorescence")) {
     std::map<uint8_t, job_t> aggregated;
 
     // Manual implementation of SQL query:
@@ -150,6 +126,11 @@ DecodeFluorescence::DecodeFluorescence(const HighFive::File& f, const image_list
     image_list.resize(aggregated.size());
     std::transform(aggregated.begin(), aggregated.end(), image_list.begin(),
                    [](const auto& p) -> job_t { return p.second; });
+
+    for (size_t i = 0; i < n_lines; i++) {
+        planes[i] = {slice_t(width, height), slice_t(width, height)};
+        bgr[i] = output_t(width, height, 3);
+    }
 }
 
 void
@@ -5,10 +5,10 @@
 #include <array>
 #include <highfive/H5DataSet.hpp>
 #include <highfive/H5File.hpp>
-#include <variant>
 
 #include "metadata-parser.h"
 #include "read-slice.h"
+#include "save-image.h"
 #include "tasks.hpp"
 
 class DecodeFluorescence final : public Task {
@@ -22,7 +22,9 @@ class DecodeFluorescence final : public Task {
     };
     std::vector<job_t> image_list;
 
-    using slice_t = ::storage::slice_t;
+    const storage::image_options_t options;
+
+    using slice_t = Halide::Runtime::Buffer<uint16_t, 2>;
     struct input_t {
         slice_t egfp;
         slice_t txred;
@@ -30,8 +32,6 @@ class DecodeFluorescence final : public Task {
 
     using output_t = Halide::Runtime::Buffer<uint8_t>;
 
-    using pipe_t = std::variant<input_t, output_t>;
-
     static constexpr auto n_wells = 96;
     static constexpr auto n_lines = 3;
     static constexpr size_t zsize = 11;
@@ -40,7 +40,11 @@ class DecodeFluorescence final : public Task {
     const HighFive::DataSet dataset;
 
     std::array<uint8_t, n_wells> autofocus_plane;
-    std::array<pipe_t, n_lines> buffer;
+
+    /** Buffers of the pipeline lines, allocated once and reused for all the
+     * wells. */
+    std::array<input_t, n_lines> planes;
+    std::array<output_t, n_lines> bgr;
 
     tf::Task autofocus;
     tf::Task convert;
@@ -50,7 +54,8 @@ class DecodeFluorescence final : public Task {
     void definePipeflow();
 
    public:
-    DecodeFluorescence(const HighFive::File& f, const image_list_t& l);
+    DecodeFluorescence(const HighFive::File& f, const image_list_t& l,
+                       const storage::image_options_t& options = {});
 
     void emplace() override;
     void schedule() override;
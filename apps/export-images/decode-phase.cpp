@@ -1,19 +1,18 @@
 #include "decode-phase.h"
 
-#include <halide_image_io.h>
-
 #include <taskflow/algorithm/pipeline.hpp>
 
 #include "constants.h"
 #include "get_phase.h"
 #include "read-slice.h"
-#include "save_xml_raw.h"
+#include "save-plane.h"
 
 using cmos::height;
 using cmos::width;
 
-DecodePhase::DecodePhase(const HighFive::File& f, const image_list_t& list)
-    : dataset(f.getDataSet("himr")) {
+DecodePhase::DecodePhase(const HighFive::File& f, const image_list_t& list,
+                         const storage::image_options_t& o)
+    : dataset(f.getDataSet("himr")), options{o} {
     image_list.reserve(list.size());
 
     for (const auto& [path, image_param] : list) {
@@ -26,6 +25,11 @@ DecodePhase::DecodePhase(const HighFive::File& f, const image_list_t& list)
     }
 
     image_list.shrink_to_fit();
+
+    for (size_t i = 0; i < n_lines; i++) {
+        layers[i] = input_t(2, width, height, zsize);
+        phase[i] = output_t(width, height);
+    }
 }
 
 void
@@ -42,45 +46,24 @@ DecodePhase::definePipeflow() {
         std::cout << "Well[" << int(well_id) << "] -> " << path << std::endl;
 
         const auto line_id = pf.line();
-        buffer[line_id] = storage::readQPILayers(dataset, well_id, width, height);
+        storage::readQPILayers(dataset, well_id, layers[line_id]);
     };
 
     auto flatten_layers = [&](const tf::Pipeflow& pf) {
         const auto line_id = pf.line();
-        auto& raw = std::get<input_t>(buffer[line_id]);
-
-        output_t phase(width, height);
-
-        const auto error = get_phase(raw, phase);
+        const auto error = get_phase(layers[line_id], phase[line_id]);
         assert(!error && "Halide error.");
-
-        buffer[line_id] = std::move(phase);
     };
 
     auto write_image = [&](const tf::Pipeflow& pf) {
         const auto line_id = pf.line();
-        auto phase_image = std::move(std::get<output_t>(buffer[line_id]));
+        auto& phase_image = phase[line_id];
 
         const auto job_id = pf.token();
         const auto& image_param = image_list[job_id];
         const std::string& output_filename = image_param.path;
 
-        using f = storage::format_t;
-        switch (image_param.format) {
-            case f::TIF:
-                [[fallthrough]];
-            case f::PNG:
-                Halide::Tools::convert_and_save_image(phase_image, output_filename);
-                break;
-            case f::XML:
-                storage::saveXML(
-                    storage::span_t<uint8_t>{phase_image.begin(), phase_image.number_of_elements()},
-                    output_filename);
-                break;
-            case f::UNKNOWN:
-                // Not implemented
-                break;
-        }
+        savePlane(phase_image, image_param.format, output_filename, options);
     };
 
     using tf::Pipe;
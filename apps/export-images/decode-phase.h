@@ -5,20 +5,17 @@
 #include <array>
 #include <highfive/H5DataSet.hpp>
 #include <highfive/H5File.hpp>
-#include <variant>
 
 #include "metadata-parser.h"
 #include "read-slice.h"
+#include "save-image.h"
 #include "tasks.hpp"
 
 class DecodePhase final : public Task {
     using image_list_t = std::map<std::string, storage::external_image_t>;
 
-    using slice_t = ::storage::slice_t;
-    using input_t = Halide::Runtime::Buffer<const float, 4>;
-
+    using input_t = Halide::Runtime::Buffer<float, 4>;
     using output_t = Halide::Runtime::Buffer<uint8_t, 2>;
-    using pipe_t = std::variant<input_t, output_t>;
 
     static constexpr auto n_wells = storage::n_wells;
     static constexpr auto n_lines = 3;
@@ -33,7 +30,13 @@ class DecodePhase final : public Task {
     };
 
     std::vector<path_t> image_list;
-    std::array<pipe_t, n_lines> buffer;
+
+    const storage::image_options_t options;
+
+    /** Buffers of the pipeline lines, allocated once and reused for all the
+     * wells. */
+    std::array<input_t, n_lines> layers;
+    std::array<output_t, n_lines> phase;
 
     tf::Task convert;
     tf::Task cleanup;
@@ -41,7 +44,8 @@ class DecodePhase final : public Task {
     void definePipeflow();
 
    public:
-    DecodePhase(const HighFive::File& f, const image_list_t& image_list);
+    DecodePhase(const HighFive::File& f, const image_list_t& image_list,
+                const storage::image_options_t& options = {});
 
     void emplace() override;
     void schedule() override;
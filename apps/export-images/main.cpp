@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cxxopts.hpp>
 
 #include "decode-fluorescence.h"
@@ -12,6 +13,7 @@ struct params_t {
     bool quit_now{true};
     std::string config_path{};
     std::string raw_data_path{};
+    storage::image_options_t image_options{};
 };
 
 params_t
@@ -22,7 +24,10 @@ parseArg(int argc, const char* const* argv) {
 
     options.add_options()("h,help", "Print help")(
         "c,config", "Configuration definition file",
-        cxxopts::value<str>())("i,input", "Input HDF5 file", cxxopts::value<str>());
+        cxxopts::value<str>())("i,input", "Input HDF5 file", cxxopts::value<str>())(
+        "png-level", "zlib compression level of the PNG images, 0-9",
+        cxxopts::value<int>()->default_value("1"))(
+        "tiff-deflate", "Compress the TIFF images with deflate");
 
     auto result = options.parse(argc, argv);
 
@@ -31,7 +36,11 @@ parseArg(int argc, const char* const* argv) {
         return {true, {}, {}};
     }
 
-    return {false, std::move(result["config"].as<str>()), std::move(result["input"].as<str>())};
+    params_t params{false, std::move(result["config"].as<str>()),
+                    std::move(result["input"].as<str>())};
+    params.image_options.png_level = std::clamp(result["png-level"].as<int>(), 0, 9);
+    params.image_options.tiff_deflate = result.count("tiff-deflate") > 0;
+    return params;
 }
 
 class TaskflowTimeProfiler {
@@ -76,8 +85,8 @@ main(int argc, char** argv) {
     auto file = File(params.raw_data_path, File::ReadOnly);
 
     ////////////////////////////////////////////////////////////////////////////////
-    DecodeFluorescence decode_fluorescence{file, image_list};
-    DecodePhase decode_phase{file, image_list};
+    DecodeFluorescence decode_fluorescence{file, image_list, params.image_options};
+    DecodePhase decode_phase{file, image_list, params.image_options};
 
     decode_fluorescence.emplace();
     decode_phase.emplace();
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cassert>
+#include <string>
+
+#include "metadata-parser.h"
+#include "save-image.h"
+#include "save_xml_raw.h"
+
+/** Write the 8-bit plane, x fastest, in the format of the file. */
+template <typename Buffer>
+void
+savePlane(const Buffer& plane, storage::format_t format, const std::string& path,
+           const storage::image_options_t& options) {
+    static_assert(sizeof(*plane.data()) == 1, "8-bit images only");
+    assert(plane.dimensions() == 2 && plane.dim(0).stride() == 1);
+
+    const storage::plane_t image{reinterpret_cast<const uint8_t*>(plane.data()),
+                                 size_t(plane.dim(0).extent()), size_t(plane.dim(1).extent()),
+                                 size_t(plane.dim(1).stride())};
+
+    using f = storage::format_t;
+    switch (format) {
+        case f::TIF:
+            storage::saveTIFF(image, path, options);
+            break;
+        case f::PNG:
+            storage::savePNG(image, path, options);
+            break;
+        case f::XML:
+            assert(image.stride == image.width);
+            storage::saveXML(storage::span_t<uint8_t>{const_cast<uint8_t*>(image.data),
+                                                      image.width * image.height},
+                             path);
+            break;
+        case f::UNKNOWN:
+            // Not implemented
+            break;
+    }
+}
@@ -0,0 +1,60 @@
+#include <HalideBuffer.h>
+#include <halide_image_io.h>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <random>
+
+#include "constants.h"
+#include "save-plane.h"
+
+using cmos::height;
+using cmos::width;
+
+namespace {
+using plane_t = Halide::Runtime::Buffer<uint8_t, 2>;
+
+/** Exported per well: the EGFP and the TxRed channels, and the phase. */
+constexpr size_t n_planes = 3;
+
+plane_t
+syntheticPlane() {
+    std::mt19937 rng{42};
+    plane_t plane(width, height);
+    plane.for_each_element([&](int x, int y) {
+        plane(x, y) = uint8_t(y / 4 + x / 16) ^ ((rng() % 8 == 0) ? rng() % 4 : 0);
+    });
+    return plane;
+}
+}  // namespace
+
+SCENARIO("Benchmark the image export of one well", "[.][benchmark]") {
+    // convert_and_save_image() takes a mutable buffer.
+    auto plane = syntheticPlane();
+    storage::image_options_t options;
+
+    for (const char* const extension : {".png", ".tif"}) {
+        const std::string path = std::string{"bench-save-plane"} + extension;
+        const auto format =
+            extension == std::string{".png"} ? storage::format_t::PNG : storage::format_t::TIF;
+
+        BENCHMARK(std::string{"Halide::Tools "} + extension) {
+            for (size_t i = 0; i < n_planes; i++) {
+                Halide::Tools::convert_and_save_image(plane, path);
+            }
+        };
+
+        BENCHMARK(std::string{"storage "} + extension) {
+            for (size_t i = 0; i < n_planes; i++) {
+                savePlane(plane, format, path, options);
+            }
+        };
+    }
+
+    options.tiff_deflate = true;
+    BENCHMARK("storage .tif, deflate") {
+        for (size_t i = 0; i < n_planes; i++) {
+            savePlane(plane, storage::format_t::TIF, "bench-save-plane.tif", options);
+        }
+    };
+}
@@ -0,0 +1,257 @@
+#include <mpi.h>
+
+#include <algorithm>
+#include <cxxopts.hpp>
+#include <iostream>
+#include <numeric>
+#include <tuple>
+#include <taskflow/algorithm/for_each.hpp>
+#include <taskflow/taskflow.hpp>
+
+#include "FPM_datafile.h"
+#include "buffer-pool.h"
+#include "constants.hpp"
+#include "default-geometry.hpp"
+#include "tiled-reconstruction.h"
+
+namespace {
+
+using reconstruction::ComplexBuffer;
+using datafile_t = FPM_datafile<uint8_t, float>;
+
+struct params_t {
+    bool quit_now{true};
+    std::string raw_data_path{};
+    size_t n_wells{96};
+    size_t max_tiles{0};
+    size_t memory_budget{0};
+    reconstruction::TileSolver::params_t reconstruction{};
+};
+
+params_t
+parseArg(int argc, const char* const* argv) {
+    using str = std::string;
+    cxxopts::Options options{argv[0], "Reconstruct the 96-well phase images over MPI ranks"};
+    options.positional_help("[optional args]").show_positional_help();
+
+    options.add_options()("h,help", "Print help")(
+        "i,input", "Input/output HDF5 file", cxxopts::value<str>())(
+        "w,wells", "Reconstruct the first N wells",
+        cxxopts::value<size_t>()->default_value("96"))(
+        "max-tiles", "Reconstruct the first N tiles only; all tiles if zero",
+        cxxopts::value<size_t>()->default_value("0"))(
+        "n,iterations", "Maximum number of FPM-EPRY iterations",
+        cxxopts::value<size_t>()->default_value("20"))(
+        "tolerance", "Stop once the relative change of the residual is below the tolerance",
+        cxxopts::value<float>()->default_value("0"))(
+        "overlap", "Minimum overlap of adjacent tiles in pixels",
+        cxxopts::value<size_t>()->default_value("32"))(
+        "in-place", "Update the high-res spectrum in place, one illumination at a time")(
+        "mixed-precision", "Store the solver buffers in bfloat16, compute in fp32")(
+        "seed-pupil", "Recover the pupil function once per well, on the central tile")(
+        "preview", "Fast preview: reconstruct from the brightfield images only")(
+        "lut-dir", "Directory to cache the illumination angles of the tiles",
+        cxxopts::value<str>()->default_value(""))(
+        "memory-budget", "Memory of the I/O buffers per rank in MiB; unbounded if zero",
+        cxxopts::value<size_t>()->default_value("0"));
+
+    auto result = options.parse(argc, argv);
+
+    if (result.count("help") || !result.count("input")) {
+        std::cerr << options.help({""}) << std::endl;
+        return {};
+    }
+
+    params_t params{false, result["input"].as<str>()};
+    params.n_wells = result["wells"].as<size_t>();
+    params.max_tiles = result["max-tiles"].as<size_t>();
+    params.memory_budget = result["memory-budget"].as<size_t>() << 20;
+    params.reconstruction.max_iter = result["iterations"].as<size_t>();
+    params.reconstruction.tolerance = result["tolerance"].as<float>();
+    params.reconstruction.overlap = result["overlap"].as<size_t>();
+    params.reconstruction.lut_dir = result["lut-dir"].as<str>();
+    if (result.count("in-place")) {
+        params.reconstruction.update_mode = reconstruction::update_mode_t::IN_PLACE;
+    }
+    if (result.count("mixed-precision")) {
+        params.reconstruction.precision = reconstruction::precision_t::MIXED;
+    }
+    if (result.count("seed-pupil")) {
+        params.reconstruction.seed_pupil = true;
+    }
+    if (result.count("preview")) {
+        params.reconstruction.brightfield_only = true;
+    }
+    return params;
+}
+
+/** Contiguous block of wells of the rank. The first (n_wells % n_ranks) ranks
+ * take one more well. */
+std::pair<size_t, size_t>
+partitionWells(size_t n_wells, size_t rank, size_t n_ranks) {
+    const size_t quotient = n_wells / n_ranks;
+    const size_t remainder = n_wells % n_ranks;
+    const size_t first = rank * quotient + std::min(rank, remainder);
+    return {first, quotient + (rank < remainder ? 1 : 0)};
+}
+
+}  // namespace
+
+int
+main(int argc, char** argv) {
+    MPI_Init(&argc, &argv);
+
+    int rank;
+    int n_ranks;
+    MPI_Comm comm = MPI_COMM_WORLD;
+    MPI_Info info = MPI_INFO_NULL;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &n_ranks);
+
+    const auto params = parseArg(argc, argv);
+    if (params.quit_now) {
+        MPI_Finalize();
+        return 0;
+    }
+
+    // Before the first Halide allocation.
+    reconstruction::BufferPool::install();
+
+    using constants::tile_size;
+    WavevectorOverMeniscus wavevector{geometry::n_leds};
+    geometry::setDefault(wavevector);
+    const reconstruction::TileSolver solver{wavevector, params.reconstruction};
+    const auto& tiles = solver.getTiles();
+
+    // With a seed pupil, the seed tile comes first, such that the pupil of
+    // each well is recovered before the other tiles are reconstructed.
+    size_t n_tiles = tiles.size();
+    if (params.max_tiles > 0 && params.max_tiles < n_tiles) {
+        n_tiles = params.max_tiles;
+    }
+    std::vector<size_t> tile_order(n_tiles);
+    std::iota(tile_order.begin(), tile_order.end(), 0);
+    const size_t seed_id = solver.seedTile();
+    if (params.reconstruction.seed_pupil) {
+        tile_order.erase(std::remove(tile_order.begin(), tile_order.end(), seed_id),
+                         tile_order.end());
+        tile_order.insert(tile_order.begin(), seed_id);
+    }
+
+    // Structured bindings cannot be captured by lambdas in C++17.
+    size_t first_well;
+    size_t n_wells;
+    std::tie(first_well, n_wells) = partitionWells(params.n_wells, rank, n_ranks);
+
+    MPI_Barrier(comm);
+    const double t0 = MPI_Wtime();
+
+    // The wells of the rank are transferred in windows that fit the memory
+    // budget, one collective call per window and tile.
+    datafile_t file{params.raw_data_path.c_str(), comm, info};
+    const size_t n_windows = file.set_stream_dims(geometry::n_leds, tile_size, tile_size, n_wells,
+                                                  first_well, params.memory_budget);
+
+    std::vector<ComplexBuffer> pupil(n_wells);
+    for (size_t window = 0; window < n_windows; window++) {
+        file.set_window(window, 0);
+        file.read_pupil();
+
+        const auto& buffer = file.get_write_buffer();
+        const auto [begin, n] = file.get_window();
+        for (size_t w = 0; w < n; w++) {
+            pupil[begin + w] = ComplexBuffer{2, tile_size, tile_size};
+            std::copy_n(reinterpret_cast<const float*>(buffer.data() + w * tile_size * tile_size),
+                        2 * tile_size * tile_size, pupil[begin + w].data());
+        }
+    }
+
+    std::vector<arma::cx_fmat> high_res(n_wells);
+    std::vector<arma::cx_fmat> corrected_pupil(n_wells);
+
+    // One job per tile and window. The main thread makes all the HDF5 calls:
+    // it reads the next job into the other buffer slot, while the workers
+    // reconstruct the current one.
+    const size_t n_jobs = tile_order.size() * n_windows;
+    const auto readJob = [&](size_t job) {
+        const auto& tile = tiles[tile_order[job / n_windows]];
+        file.set_window(job % n_windows, job % 2);
+        file.read_image(tile.roi.top, tile.roi.left);
+    };
+
+    tf::Executor executor;
+    if (n_jobs > 0) {
+        readJob(0);
+    }
+    for (size_t job = 0; job < n_jobs; job++) {
+        const size_t tile_id = tile_order[job / n_windows];
+        const auto& tile = tiles[tile_id];
+
+        file.set_window(job % n_windows, job % 2);
+        size_t begin;
+        size_t n;
+        std::tie(begin, n) = file.get_window();
+        const uint8_t* block = file.get_read_buffer().data();
+
+        // The read buffer is laid out as (illumination, well, y, x), with all
+        // the illuminations. Gather the ones of the tile, in their order.
+        const auto& frame_id = solver.getFrameId(tile_id);
+        const auto gatherRaw = [&](size_t w) {
+            const size_t plane = tile_size * tile_size;
+            storage::u8_cube_t raw(tile_size, tile_size, frame_id.size());
+            for (size_t i = 0; i < frame_id.size(); i++) {
+                std::copy_n(block + (frame_id[i] * n + w) * plane, plane, raw.data() + i * plane);
+            }
+            return raw;
+        };
+
+        // Reconstruct the wells of the window on the local cores.
+        tf::Taskflow taskflow;
+        taskflow.for_each_index(size_t{0}, n, size_t{1}, [&](size_t w) {
+            if (params.reconstruction.seed_pupil && tile_id == seed_id) {
+                pupil[begin + w] = solver.seedPupil(gatherRaw(w), pupil[begin + w]);
+            }
+
+            auto runner = solver.initTile(tile_id, gatherRaw(w), pupil[begin + w]);
+            high_res[begin + w] = solver.solveTile(tile_id, *runner);
+            corrected_pupil[begin + w] = runner->downloadPupil();
+        });
+        auto reconstructed = executor.run(taskflow);
+
+        // Collective, into the other buffer slot.
+        if (job + 1 < n_jobs) {
+            readJob(job + 1);
+        }
+        reconstructed.wait();
+
+        // Both writes are collective, and share the write buffer.
+        file.set_window(job % n_windows, job % 2);
+        auto& buffer = file.get_write_buffer();
+        for (size_t w = 0; w < n; w++) {
+            std::copy(high_res[begin + w].begin(), high_res[begin + w].end(),
+                      buffer.begin() + w * tile_size * tile_size);
+        }
+        file.write_phase_image(tile.layer, tile.roi.top, tile.roi.left);
+
+        for (size_t w = 0; w < n; w++) {
+            std::copy(corrected_pupil[begin + w].begin(), corrected_pupil[begin + w].end(),
+                      buffer.begin() + w * tile_size * tile_size);
+        }
+        file.write_local_pupil(tile.layer, tile.roi.top, tile.roi.left);
+    }
+    reconstruction::BufferPool::trim();
+
+    MPI_Barrier(comm);
+    const double elapsed = MPI_Wtime() - t0;
+
+    if (rank == 0) {
+        // Parsed by scaling.sh to compute the scaling efficiency.
+        const double n_reconstructed = double(params.n_wells) * tile_order.size();
+        std::cout << "ranks=" << n_ranks << " wells=" << params.n_wells
+                  << " tiles=" << tile_order.size() << " seconds=" << elapsed
+                  << " tiles_per_second=" << n_reconstructed / elapsed << std::endl;
+    }
+
+    MPI_Finalize();
+    return 0;
+}
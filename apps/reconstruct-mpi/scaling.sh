@@ -0,0 +1,41 @@
+#!/bin/sh
+# Report the strong scaling efficiency of fpm-reconstruct-mpi on localhost.
+#
+# Usage: scaling.sh <fpm-reconstruct-mpi> <plate.hdf5> <max ranks> [driver args...]
+#
+# The plate file is copied, such that the test data stays untouched.
+set -e
+
+exe=$1
+datafile=$2
+max_ranks=$3
+shift 3
+
+# Skipped by meson without an MPI launcher.
+if ! command -v mpirun >/dev/null 2>&1; then
+    echo "mpirun not found" >&2
+    exit 77
+fi
+
+# Open MPI refuses more ranks than cores by default; MPICH allows it.
+oversubscribe=""
+if mpirun --version 2>&1 | grep -q "Open MPI"; then
+    oversubscribe="--oversubscribe"
+fi
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+
+t1=""
+n=1
+while [ "$n" -le "$max_ranks" ]; do
+    cp "$datafile" "$workdir/plate.hdf5"
+    line=$(mpirun $oversubscribe -np "$n" "$exe" -i "$workdir/plate.hdf5" "$@" | grep '^ranks=')
+    seconds=$(echo "$line" | sed 's/.*seconds=\([^ ]*\).*/\1/')
+    if [ -z "$t1" ]; then
+        t1=$seconds
+    fi
+    efficiency=$(awk -v t1="$t1" -v n="$n" -v t="$seconds" 'BEGIN { printf "%.3f", t1 / (n * t) }')
+    echo "$line efficiency=$efficiency"
+    n=$((n * 2))
+done
@@ -0,0 +1,115 @@
+#include <cxxopts.hpp>
+#include <numeric>
+
+#include "buffer-pool.h"
+#include "default-geometry.hpp"
+#include "metadata-parser.h"
+#include "reconstruct-phase.h"
+
+namespace {
+
+using HighFive::File;
+
+struct params_t {
+    bool quit_now{true};
+    std::string raw_data_path{};
+    std::vector<size_t> well_list{};
+    size_t n_lines{4};
+    reconstruction::TiledReconstruction::params_t reconstruction{};
+};
+
+params_t
+parseArg(int argc, const char* const* argv) {
+    using str = std::string;
+    cxxopts::Options options{argv[0], "Reconstruct the 96-well phase images from raw FPM data"};
+    options.positional_help("[optional args]").show_positional_help();
+
+    options.add_options()("h,help", "Print help")(
+        "i,input", "Input/output HDF5 file", cxxopts::value<str>())(
+        "w,wells", "Comma-separated well IDs; all wells if omitted",
+        cxxopts::value<std::vector<size_t>>())(
+        "l,lines", "Maximum number of tiles in flight", cxxopts::value<size_t>()->default_value("4"))(
+        "n,iterations", "Maximum number of FPM-EPRY iterations",
+        cxxopts::value<size_t>()->default_value("20"))(
+        "tolerance", "Stop once the relative change of the residual is below the tolerance",
+        cxxopts::value<float>()->default_value("0"))(
+        "overlap", "Minimum overlap of adjacent tiles in pixels",
+        cxxopts::value<size_t>()->default_value("32"))(
+        "in-place", "Update the high-res spectrum in place, one illumination at a time")(
+        "mixed-precision", "Store the solver buffers in bfloat16, compute in fp32")(
+        "seed-pupil", "Recover the pupil function once per well, on the central tile")(
+        "preview", "Fast preview: reconstruct from the brightfield images only")(
+        "lut-dir", "Directory to cache the illumination angles of the tiles",
+        cxxopts::value<str>());
+
+    auto result = options.parse(argc, argv);
+
+    if (result.count("help") || !result.count("input")) {
+        std::cerr << options.help({""}) << std::endl;
+        return {};
+    }
+
+    params_t params{false, result["input"].as<str>()};
+
+    if (result.count("wells")) {
+        params.well_list = result["wells"].as<std::vector<size_t>>();
+    } else {
+        params.well_list.resize(storage::n_wells);
+        std::iota(params.well_list.begin(), params.well_list.end(), 0);
+    }
+
+    params.n_lines = result["lines"].as<size_t>();
+    params.reconstruction.max_iter = result["iterations"].as<size_t>();
+    params.reconstruction.tolerance = result["tolerance"].as<float>();
+    params.reconstruction.overlap = result["overlap"].as<size_t>();
+    if (result.count("in-place")) {
+        params.reconstruction.update_mode = reconstruction::update_mode_t::IN_PLACE;
+    }
+    if (result.count("mixed-precision")) {
+        params.reconstruction.precision = reconstruction::precision_t::MIXED;
+    }
+    if (result.count("seed-pupil")) {
+        params.reconstruction.seed_pupil = true;
+    }
+    if (result.count("preview")) {
+        params.reconstruction.brightfield_only = true;
+    }
+    if (result.count("lut-dir")) {
+        params.reconstruction.lut_dir = result["lut-dir"].as<str>();
+    }
+
+    return params;
+}
+
+}  // namespace
+
+int
+main(int argc, char** argv) {
+    const auto params = parseArg(argc, argv);
+    if (params.quit_now) {
+        return 0;
+    }
+
+    // Before the first Halide allocation.
+    reconstruction::BufferPool::install();
+
+    auto file = File(params.raw_data_path, File::ReadWrite);
+
+    WavevectorOverMeniscus wavevector{geometry::n_leds};
+    geometry::setDefault(wavevector);
+
+    reconstruction::TiledReconstruction tiled_reconstruction{file, wavevector,
+                                                             params.reconstruction};
+
+    ////////////////////////////////////////////////////////////////////////////////
+    ReconstructPhase reconstruct_phase{tiled_reconstruction, params.well_list, params.n_lines};
+    reconstruct_phase.emplace();
+    reconstruct_phase.schedule();
+
+    // Now execute the multithreaded tasks
+    tf::Executor executor;
+    executor.run(reconstruct_phase.getTaskflow()).wait();
+    reconstruction::BufferPool::trim();
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include "reconstruct-phase.h"
+
+#include <cassert>
+#include <iostream>
+#include <taskflow/algorithm/pipeline.hpp>
+
+#include "buffer-pool.h"
+
+ReconstructPhase::ReconstructPhase(reconstruction::TiledReconstruction& r,
+                                   const std::vector<size_t>& well_list, size_t lines)
+    : reconstruction{r}, n_lines{lines}, buffer(lines), raw_buffer(lines) {
+    assert(n_lines > 0);
+
+    const auto n_tiles = reconstruction.getTiles().size();
+    job_list.reserve(well_list.size() * n_tiles);
+
+    std::vector<std::pair<size_t, size_t>> jobs;
+    jobs.reserve(well_list.size() * n_tiles);
+    for (const auto well_id : well_list) {
+        for (size_t tile_id = 0; tile_id < n_tiles; tile_id++) {
+            job_list.emplace_back(job_t{well_id, tile_id});
+            jobs.emplace_back(well_id, tile_id);
+        }
+    }
+
+    // One buffer per line, plus the tiles read ahead.
+    constexpr size_t n_read_ahead = 2;
+    prefetcher = reconstruction.prefetchTiles(jobs, n_lines + n_read_ahead);
+}
+
+void
+ReconstructPhase::definePipeflow() {
+    auto read_tile = [&](tf::Pipeflow& pf) {
+        const auto job_id = pf.token();
+        if (job_id >= job_list.size()) {
+            pf.stop();
+            return;
+        }
+
+        const auto well_id = job_list[job_id].well_id;
+
+        // The jobs are sorted by wells. Initialize the pupil once per well.
+        if (last_pupil.pupil.data() == nullptr || last_pupil.well_id != well_id) {
+            std::cout << "Well[" << well_id << "]" << std::endl;
+
+            // Release the buffers cached by the runners of the previous well;
+            // the ones still in flight are cached again.
+            reconstruction::BufferPool::trim();
+            last_pupil = {well_id, reconstruction.initPupil(well_id)};
+        }
+
+        const auto line_id = pf.line();
+        raw_buffer[line_id] = prefetcher->next();
+        buffer[line_id] = input_t{raw_buffer[line_id], last_pupil.pupil};
+    };
+
+    auto init_tile = [&](const tf::Pipeflow& pf) {
+        const auto line_id = pf.line();
+        auto input = std::move(std::get<input_t>(buffer[line_id]));
+
+        const auto tile_id = job_list[pf.token()].tile_id;
+        buffer[line_id] = reconstruction.initTile(tile_id, std::move(input.raw), input.pupil);
+    };
+
+    auto solve_tile = [&](const tf::Pipeflow& pf) {
+        const auto line_id = pf.line();
+        auto runner = std::move(std::get<runner_t>(buffer[line_id]));
+
+        const auto tile_id = job_list[pf.token()].tile_id;
+        buffer[line_id] = reconstruction.solveTile(tile_id, *runner);
+    };
+
+    auto write_tile = [&](const tf::Pipeflow& pf) {
+        const auto line_id = pf.line();
+        const auto high_res = std::move(std::get<output_t>(buffer[line_id]));
+
+        const auto [well_id, tile_id] = job_list[pf.token()];
+        reconstruction.writeTile(well_id, tile_id, high_res);
+
+        // The runner is gone; no other reference to the raw images remains.
+        prefetcher->recycle(raw_buffer[line_id]);
+        raw_buffer[line_id] = {};
+    };
+
+    using tf::Pipe;
+    using p = tf::PipeType;
+    auto pipeline = new tf::Pipeline{
+        n_lines,  //
+        Pipe{p::SERIAL, std::move(read_tile)},
+        Pipe{p::PARALLEL, std::move(init_tile)},
+        Pipe{p::PARALLEL, std::move(solve_tile)},
+        Pipe{p::SERIAL, std::move(write_tile)},
+    };
+
+    reconstruct = taskflow.composed_of(*pipeline);
+    cleanup = taskflow.emplace([=]() { delete pipeline; });
+
+    reconstruct.name("Reconstruct phase");
+    cleanup.name("Cleanup");
+}
+
+void
+ReconstructPhase::emplace() {
+    definePipeflow();
+}
+
+void
+ReconstructPhase::schedule() {
+    reconstruct.precede(cleanup);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <memory>
+#include <variant>
+#include <vector>
+
+#include "read-slice.h"
+#include "tasks.hpp"
+#include "tiled-reconstruction.h"
+
+/** Reconstruct the high resolution images of the wells, tile by tile.
+ *
+ * The tiles are streamed through a four-stage pipeline: read the raw images
+ * from disk, convert them to the initial guess, run the FPM-EPRY iterations,
+ * and write the tile back to disk. The number of tiles in flight is bounded by
+ * the number of pipeline lines.
+ */
+class ReconstructPhase final : public Task {
+    using ComplexBuffer = reconstruction::ComplexBuffer;
+
+    struct input_t {
+        storage::u8_cube_t raw;
+        ComplexBuffer pupil;
+    };
+
+    using runner_t = std::unique_ptr<reconstruction::FPMEpryRunner>;
+    using output_t = arma::cx_fmat;
+    using pipe_t = std::variant<input_t, runner_t, output_t>;
+
+    struct job_t {
+        size_t well_id{};
+        size_t tile_id{};
+    };
+
+    reconstruction::TiledReconstruction& reconstruction;
+
+    std::vector<job_t> job_list;
+    const size_t n_lines;
+    std::vector<pipe_t> buffer;
+
+    /** Raw images of the tiles in flight, returned to the prefetcher once the
+     * tile is written. */
+    std::vector<storage::u8_cube_t> raw_buffer;
+    std::unique_ptr<storage::TilePrefetcher> prefetcher;
+
+    /** Initial pupil function of the well being read. Accessed by the serial
+     * stage only. */
+    struct {
+        size_t well_id{};
+        ComplexBuffer pupil{};
+    } last_pupil;
+
+    tf::Task reconstruct;
+    tf::Task cleanup;
+
+    void definePipeflow();
+
+   public:
+    /**
+     * @param[in] reconstruction tiling and IO of the HDF5 file
+     * @param[in] well_list wells to reconstruct
+     * @param[in] n_lines maximum number of tiles in flight
+     */
+    ReconstructPhase(reconstruction::TiledReconstruction& reconstruction,
+                     const std::vector<size_t>& well_list, size_t n_lines);
+
+    void emplace() override;
+    void schedule() override;
+};
@@ -0,0 +1,105 @@
+#include <hdf5.h>
+
+#include <cxxopts.hpp>
+#include <iomanip>
+#include <iostream>
+
+#include "constants.hpp"
+#include "repack-dataset.h"
+#include "tiled-reconstruction.h"
+
+namespace {
+
+struct params_t {
+    bool quit_now{true};
+    std::string input_path{};
+    std::string output_path{};
+    repack::layout_t layout{};
+    size_t overlap{32};
+};
+
+params_t
+parseArg(int argc, const char* const* argv) {
+    using str = std::string;
+    cxxopts::Options options{argv[0], "Rewrite a plate file with chunks tuned for tile access"};
+    options.positional_help("[optional args]").show_positional_help();
+
+    options.add_options()("h,help", "Print help")(
+        "i,input", "Input HDF5 file", cxxopts::value<str>())(
+        "o,output", "Output HDF5 file, overwritten", cxxopts::value<str>())(
+        "chunk-size", "Width of the square chunks",
+        cxxopts::value<size_t>()->default_value("256"))(
+        "compress", "Shuffle and deflate the chunks, in parallel")(
+        "overlap", "Minimum overlap of adjacent tiles, for the read amplification report",
+        cxxopts::value<size_t>()->default_value("32"));
+
+    auto result = options.parse(argc, argv);
+
+    if (result.count("help") || !result.count("input") || !result.count("output")) {
+        std::cerr << options.help({""}) << std::endl;
+        return {};
+    }
+
+    params_t params{false, result["input"].as<str>(), result["output"].as<str>()};
+    params.layout.chunk_size = result["chunk-size"].as<size_t>();
+    params.layout.compress = result.count("compress") > 0;
+    params.overlap = result["overlap"].as<size_t>();
+    return params;
+}
+
+/** Print the read amplification of the tile reader, per dataset. */
+void
+report(const char* label, hid_t file, const std::vector<storage::roi_t>& tiles) {
+    for (const char* name : {"imlow", "himr"}) {
+        const auto a = repack::readAmplification(file, name, tiles);
+        std::cout << std::fixed << std::setprecision(2) << label << ' ' << name
+                  << ": decoded/requested = " << double(a.decoded) / a.requested
+                  << ", stored/requested = " << double(a.stored) / a.requested << '\n';
+    }
+}
+
+}  // namespace
+
+int
+main(int argc, char** argv) {
+    const auto params = parseArg(argc, argv);
+    if (params.quit_now) {
+        return 0;
+    }
+
+    std::vector<storage::roi_t> tiles;
+    for (const auto& tile : reconstruction::splitSensor(constants::width, constants::height,
+                                                        constants::tile_size, params.overlap)) {
+        tiles.push_back(tile.roi);
+    }
+
+    const hid_t in_file = H5Fopen(params.input_path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (in_file < 0) {
+        std::cerr << "Cannot open " << params.input_path << '\n';
+        return 1;
+    }
+    const hid_t out_file =
+        H5Fcreate(params.output_path.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if (out_file < 0) {
+        std::cerr << "Cannot create " << params.output_path << '\n';
+        return 1;
+    }
+
+    report("Before", in_file, tiles);
+
+    const std::vector<std::string> repacked{"imlow", "himr"};
+    repack::copyOthers(in_file, out_file, repacked);
+
+    tf::Executor executor;
+    for (const auto& name : repacked) {
+        std::cout << "Repacking " << name << std::endl;
+        repack::repackDataSet(in_file, out_file, name, params.layout, executor);
+    }
+    H5Fflush(out_file, H5F_SCOPE_GLOBAL);
+
+    report("After", out_file, tiles);
+
+    H5Fclose(out_file);
+    H5Fclose(in_file);
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include "repack-dataset.h"
+
+#include <hdf5.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+
+namespace {
+
+using dims_t = std::array<hsize_t, 4>;
+
+/** Same byte order as the HDF5 shuffle filter: byte b of element i goes to
+ * position b * n + i. */
+void
+shuffleBytes(const uint8_t* in, uint8_t* out, size_t n_bytes, size_t element_size) {
+    const size_t n = n_bytes / element_size;
+    for (size_t i = 0; i < n; i++) {
+        for (size_t b = 0; b < element_size; b++) {
+            out[b * n + i] = in[i * element_size + b];
+        }
+    }
+}
+
+/** One chunk of an image plane, padded to the full chunk size. */
+struct chunk_t {
+    std::vector<uint8_t> raw;
+    std::vector<uint8_t> filtered;
+    uLongf filtered_size{};
+};
+
+/** Filter a chunk as H5Pset_shuffle() + H5Pset_deflate(1) would. */
+void
+filterChunk(chunk_t& chunk, size_t element_size) {
+    std::vector<uint8_t> shuffled(chunk.raw.size());
+    shuffleBytes(chunk.raw.data(), shuffled.data(), chunk.raw.size(), element_size);
+
+    chunk.filtered.resize(compressBound(shuffled.size()));
+    chunk.filtered_size = chunk.filtered.size();
+    const int status = compress2(chunk.filtered.data(), &chunk.filtered_size, shuffled.data(),
+                                 shuffled.size(), 1);
+    assert(status == Z_OK);
+}
+
+herr_t
+copyLink(hid_t group, const char* name, const H5L_info_t*, void* data) {
+    auto* args = static_cast<std::pair<hid_t, const std::vector<std::string>*>*>(data);
+    const auto& exclude = *args->second;
+    if (std::find(exclude.begin(), exclude.end(), name) == exclude.end()) {
+        H5Ocopy(group, name, args->first, name, H5P_DEFAULT, H5P_DEFAULT);
+    }
+    return 0;
+}
+
+herr_t
+copyAttribute(hid_t location, const char* name, const H5A_info_t*, void* data) {
+    const hid_t out = *static_cast<hid_t*>(data);
+
+    const hid_t attr = H5Aopen(location, name, H5P_DEFAULT);
+    const hid_t type = H5Aget_type(attr);
+    const hid_t space = H5Aget_space(attr);
+
+    const size_t n_bytes = H5Sget_simple_extent_npoints(space) * H5Tget_size(type);
+    std::vector<uint8_t> buffer(n_bytes);
+    H5Aread(attr, type, buffer.data());
+
+    const hid_t copy = H5Acreate2(out, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+    H5Awrite(copy, type, buffer.data());
+
+    // Free the variable-length strings allocated by H5Aread().
+    if (H5Tdetect_class(type, H5T_VLEN) > 0 || H5Tis_variable_str(type) > 0) {
+        H5Dvlen_reclaim(type, space, H5P_DEFAULT, buffer.data());
+    }
+
+    H5Aclose(copy);
+    H5Sclose(space);
+    H5Tclose(type);
+    H5Aclose(attr);
+    return 0;
+}
+
+}  // namespace
+
+namespace repack {
+
+void
+repackDataSet(hid_t in_file, hid_t out_file, const std::string& name, const layout_t& layout,
+              tf::Executor& executor) {
+    const hid_t in = H5Dopen2(in_file, name.c_str(), H5P_DEFAULT);
+    assert(in >= 0);
+    const hid_t type = H5Dget_type(in);
+    const hid_t in_space = H5Dget_space(in);
+    const size_t element_size = H5Tget_size(type);
+
+    dims_t dims{};
+    H5Sget_simple_extent_dims(in_space, dims.data(), nullptr);
+    const hsize_t height = dims[2];
+    const hsize_t width = dims[3];
+
+    const dims_t chunk_dims{1, 1, std::min<hsize_t>(layout.chunk_size, height),
+                            std::min<hsize_t>(layout.chunk_size, width)};
+    const hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(dcpl, 4, chunk_dims.data());
+    if (layout.compress) {
+        H5Pset_shuffle(dcpl);
+        H5Pset_deflate(dcpl, 1);
+    }
+
+    const hid_t out = H5Dcreate2(out_file, name.c_str(), type, in_space, H5P_DEFAULT, dcpl,
+                                 H5P_DEFAULT);
+    assert(out >= 0);
+    H5Pclose(dcpl);
+
+    const size_t n_rows = (height + chunk_dims[2] - 1) / chunk_dims[2];
+    const size_t n_cols = (width + chunk_dims[3] - 1) / chunk_dims[3];
+    const size_t chunk_row_bytes = chunk_dims[3] * element_size;
+
+    std::vector<uint8_t> plane(height * width * element_size);
+    std::vector<chunk_t> chunks(n_rows * n_cols);
+    for (auto& chunk : chunks) {
+        chunk.raw.resize(chunk_dims[2] * chunk_row_bytes);
+    }
+
+    const dims_t plane_dims{1, 1, height, width};
+    const hid_t plane_space = H5Screate_simple(4, plane_dims.data(), nullptr);
+
+    for (hsize_t frame = 0; frame < dims[0]; frame++) {
+        for (hsize_t well = 0; well < dims[1]; well++) {
+            const dims_t start{frame, well, 0, 0};
+            const hid_t file_space = H5Dget_space(in);
+            H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start.data(), nullptr,
+                                plane_dims.data(), nullptr);
+            H5Dread(in, type, plane_space, file_space, H5P_DEFAULT, plane.data());
+
+            if (!layout.compress) {
+                // HDF5 splits the plane into the chunks.
+                const hid_t out_space = H5Dget_space(out);
+                H5Sselect_hyperslab(out_space, H5S_SELECT_SET, start.data(), nullptr,
+                                    plane_dims.data(), nullptr);
+                H5Dwrite(out, type, plane_space, out_space, H5P_DEFAULT, plane.data());
+                H5Sclose(out_space);
+                H5Sclose(file_space);
+                continue;
+            }
+            H5Sclose(file_space);
+
+            tf::Taskflow taskflow;
+            taskflow.for_each_index(size_t{0}, chunks.size(), size_t{1}, [&](size_t i) {
+                auto& chunk = chunks[i];
+                const size_t top = (i / n_cols) * chunk_dims[2];
+                const size_t left = (i % n_cols) * chunk_dims[3];
+                const size_t n_valid_rows = std::min<size_t>(chunk_dims[2], height - top);
+                const size_t valid_row_bytes =
+                    std::min<size_t>(chunk_dims[3], width - left) * element_size;
+
+                // Zero padding beyond the image edges.
+                std::fill(chunk.raw.begin(), chunk.raw.end(), 0);
+                for (size_t y = 0; y < n_valid_rows; y++) {
+                    std::memcpy(chunk.raw.data() + y * chunk_row_bytes,
+                                plane.data() + ((top + y) * width + left) * element_size,
+                                valid_row_bytes);
+                }
+                filterChunk(chunk, element_size);
+            });
+            executor.run(taskflow).wait();
+
+            for (size_t i = 0; i < chunks.size(); i++) {
+                const dims_t offset{frame, well, (i / n_cols) * chunk_dims[2],
+                                    (i % n_cols) * chunk_dims[3]};
+                const herr_t status = H5Dwrite_chunk(out, H5P_DEFAULT, 0, offset.data(),
+                                                     chunks[i].filtered_size,
+                                                     chunks[i].filtered.data());
+                assert(status >= 0);
+            }
+        }
+    }
+
+    H5Sclose(plane_space);
+    H5Dclose(out);
+    H5Sclose(in_space);
+    H5Tclose(type);
+    H5Dclose(in);
+}
+
+void
+copyOthers(hid_t in_file, hid_t out_file, const std::vector<std::string>& exclude) {
+    std::pair<hid_t, const std::vector<std::string>*> args{out_file, &exclude};
+    H5Literate(in_file, H5_INDEX_NAME, H5_ITER_INC, nullptr, copyLink, &args);
+
+    hid_t out_root = out_file;
+    H5Aiterate2(in_file, H5_INDEX_NAME, H5_ITER_INC, nullptr, copyAttribute, &out_root);
+}
+
+amplification_t
+readAmplification(hid_t file, const std::string& name, const std::vector<storage::roi_t>& tiles) {
+    const hid_t dataset = H5Dopen2(file, name.c_str(), H5P_DEFAULT);
+    assert(dataset >= 0);
+    const hid_t type = H5Dget_type(dataset);
+    const hid_t space = H5Dget_space(dataset);
+    const hid_t dcpl = H5Dget_create_plist(dataset);
+    const size_t element_size = H5Tget_size(type);
+
+    dims_t dims{};
+    H5Sget_simple_extent_dims(space, dims.data(), nullptr);
+
+    // A contiguous dataset reads the requested bytes only.
+    dims_t chunk = dims;
+    const bool is_chunked = H5Pget_layout(dcpl) == H5D_CHUNKED;
+    if (is_chunked) {
+        H5Pget_chunk(dcpl, 4, chunk.data());
+    }
+    const size_t chunk_bytes = chunk[0] * chunk[1] * chunk[2] * chunk[3] * element_size;
+    const size_t total_bytes = dims[0] * dims[1] * dims[2] * dims[3] * element_size;
+    const double storage_ratio = double(H5Dget_storage_size(dataset)) / total_bytes;
+
+    // Number of chunks overlapping the range [begin, end) along one axis.
+    const auto span = [](size_t begin, size_t end, size_t chunk_size) {
+        return (end - 1) / chunk_size - begin / chunk_size + 1;
+    };
+
+    amplification_t a{};
+    for (const auto& roi : tiles) {
+        const size_t W = roi.width;
+        a.requested += dims[0] * W * W * element_size;
+
+        const size_t n_chunks = span(0, dims[0], chunk[0]) *
+                                span(roi.top, roi.top + W, chunk[2]) *
+                                span(roi.left, roi.left + W, chunk[3]);
+        a.decoded += is_chunked ? n_chunks * chunk_bytes : dims[0] * W * W * element_size;
+    }
+    a.stored = a.decoded * storage_ratio;
+
+    H5Pclose(dcpl);
+    H5Sclose(space);
+    H5Tclose(type);
+    H5Dclose(dataset);
+    return a;
+}
+
+}  // namespace repack
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <H5Ipublic.h>
+
+#include <string>
+#include <taskflow/taskflow.hpp>
+#include <vector>
+
+#include "read-slice.h"
+
+namespace repack {
+
+struct layout_t {
+    /** Width of the square chunks along the image axes. The chunks span one
+     * frame and one well. */
+    size_t chunk_size{256};
+
+    /** Byte shuffle, then fast deflate (level 1). */
+    bool compress{false};
+};
+
+/** Copy the 4D dataset (frame, well, height, width) into the output file,
+ * with the new chunk layout.
+ *
+ * The dataset is copied one image plane at a time. With compression, the
+ * chunks of a plane are filtered in parallel on the executor, and written with
+ * H5Dwrite_chunk(), bypassing the serial HDF5 filter pipeline.
+ */
+void repackDataSet(hid_t in_file, hid_t out_file, const std::string& name, const layout_t& layout,
+                   tf::Executor& executor);
+
+/** Copy the other objects and the attributes of the root group. */
+void copyOthers(hid_t in_file, hid_t out_file, const std::vector<std::string>& exclude);
+
+struct amplification_t {
+    /** Bytes requested by the tile reader. */
+    size_t requested{};
+
+    /** Bytes of the chunks to decode, without the chunk cache. */
+    size_t decoded{};
+
+    /** Bytes of the chunks as stored on disk. */
+    size_t stored{};
+};
+
+/** Estimate the read amplification of the tile reader, i.e. the bytes to
+ * read and to decode for all illuminations of the tiles of one well.
+ */
+amplification_t readAmplification(hid_t file, const std::string& name,
+                                  const std::vector<storage::roi_t>& tiles);
+
+}  // namespace repack
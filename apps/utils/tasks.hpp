@@ -21,7 +21,9 @@ class Task {
     virtual void emplace() = 0;
 
     /** Schedule the tasks in a multi-threading environment.
-     * @param[in] file_lock HDF5 file lock, to work-around the slow mutex in the HDF5 driver.
+     *
+     * The HDF5 library serializes all calls behind its global lock. Readers of
+     * the uncompressed datasets may bypass it with storage::DirectReader.
      */
     virtual void schedule() = 0;
     inline tf::Taskflow& getTaskflow() { return taskflow; }
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+
+namespace algorithms {
+
+/** Whether the pupil function is refined along with the high-res spectrum.
+ * Selects the fpm_mode generator param of the FPM-EPRY pipelines, and their
+ * specialization at run time. */
+enum fpm_mode_t : int32_t {
+    /** Lock the pupil function; only the high-res spectrum is updated.
+     * Suitable for the tiles warm-started from a recovered pupil. */
+    AUTO_BRIGHTNESS = 0,
+
+    /** Update the pupil function along with the high-res spectrum. */
+    PUPIL_RECOVERY = 1,
+};
+
+}  // namespace algorithms
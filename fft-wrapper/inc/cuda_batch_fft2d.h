@@ -2,13 +2,7 @@
 #include <complex>
 
 #include "cufft.h"
-
-#pragma pack(push, 8)
-struct float2_t {
-    float re;
-    float im;
-};
-#pragma pack(pop)
+#include "float2.h"
 
 class CudaBatchFft2d {
     /** Pre-allocated memory for the cuFFT routine */
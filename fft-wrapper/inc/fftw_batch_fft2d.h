@@ -0,0 +1,49 @@
+#pragma once
+#include <fftw3.h>
+
+#include "float2.h"
+
+/** Multi-core CPU counterpart of CudaBatchFft2d, backed by the FFTW library. */
+class FftwBatchFft2d {
+    /** Pre-computed FFTW plans, reused for every invocation. */
+    fftwf_plan _fwd_plan = nullptr;
+    fftwf_plan _inv_plan = nullptr;
+
+   public:
+    /** Measure and store the fastest FFTW plans for the given shape.
+     *
+     * @param[in] batch number of image segments
+     * @param[in] width width of the image
+     * @param[in] height height of the image
+     */
+    FftwBatchFft2d(unsigned batch, int width, int height);
+
+    ~FftwBatchFft2d();
+
+    FftwBatchFft2d(const FftwBatchFft2d&) = delete;
+    FftwBatchFft2d& operator=(const FftwBatchFft2d&) = delete;
+
+    /** Obtain the plans of the given shape.
+     *
+     * FFTW planning is slow and not thread-safe. Plans are therefore measured
+     * only once per tile size and batch size, and then shared by all threads
+     * for the lifetime of the process.
+     */
+    static const FftwBatchFft2d& getInstance(unsigned batch, int width, int height);
+
+    /** Forward two-dimensional FFT.
+     *
+     * @param[in] src source image, aligned to the SIMD vector width
+     * @param[out] dst Fourier representation of the image
+     */
+    void dft2(const float2_t* src, float2_t* dst) const;
+
+    /** Backward two-dimensional FFT.
+     *
+     * @param[in] src Fourier representation of the image
+     * @param[out] dst output image
+     * @warning Unlike inverse FFT, backward FFT comes with a scaling factor.
+     *      To find the inverse, divide the result by N*N.
+     */
+    void idft2(const float2_t* src, float2_t* dst) const;
+};
@@ -0,0 +1,10 @@
+#pragma once
+
+/** Interleaved single-precision complex number, binary compatible with
+ * cufftComplex, fftwf_complex and std::complex<float>. */
+#pragma pack(push, 8)
+struct float2_t {
+    float re;
+    float im;
+};
+#pragma pack(pop)
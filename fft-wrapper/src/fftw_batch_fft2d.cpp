@@ -0,0 +1,81 @@
+#include "fftw_batch_fft2d.h"
+
+#include <cassert>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+namespace {
+
+/** The FFTW planner is not re-entrant; only fftwf_execute_*() is thread-safe. */
+std::mutex planner_mutex;
+
+fftwf_complex*
+cast(const float2_t* ptr) {
+    return reinterpret_cast<fftwf_complex*>(const_cast<float2_t*>(ptr));
+}
+
+/** FFTW plans are only valid for arrays of the same SIMD alignment. */
+bool
+isAligned(const float2_t* ptr) {
+    return fftwf_alignment_of(reinterpret_cast<float*>(cast(ptr))) == 0;
+}
+
+}  // namespace
+
+FftwBatchFft2d::FftwBatchFft2d(unsigned batch, int width, int height) {
+    const int rank[]{height, width};
+    const int n_pixels = width * height;
+
+    std::lock_guard<std::mutex> lock(planner_mutex);
+
+    // FFTW_MEASURE overwrites the arrays. Plan on scratch memory having the
+    // same SIMD alignment as the Halide buffers.
+    fftwf_complex* src = fftwf_alloc_complex(n_pixels * batch);
+    fftwf_complex* dst = fftwf_alloc_complex(n_pixels * batch);
+
+    _fwd_plan = fftwf_plan_many_dft(2, rank, batch, src, nullptr, 1, n_pixels, dst, nullptr, 1,
+                                    n_pixels, FFTW_FORWARD, FFTW_MEASURE);
+    _inv_plan = fftwf_plan_many_dft(2, rank, batch, src, nullptr, 1, n_pixels, dst, nullptr, 1,
+                                    n_pixels, FFTW_BACKWARD, FFTW_MEASURE);
+
+    fftwf_free(src);
+    fftwf_free(dst);
+
+    assert(_fwd_plan != nullptr && _inv_plan != nullptr && "fftwf_plan_many_dft");
+}
+
+FftwBatchFft2d::~FftwBatchFft2d() {
+    std::lock_guard<std::mutex> lock(planner_mutex);
+    fftwf_destroy_plan(_fwd_plan);
+    fftwf_destroy_plan(_inv_plan);
+}
+
+const FftwBatchFft2d&
+FftwBatchFft2d::getInstance(unsigned batch, int width, int height) {
+    using key_t = std::tuple<unsigned, int, int>;
+    static std::map<key_t, std::unique_ptr<const FftwBatchFft2d>> cache;
+    static std::mutex cache_mutex;
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto& plan = cache[key_t{batch, width, height}];
+    if (plan == nullptr) {
+        plan = std::make_unique<const FftwBatchFft2d>(batch, width, height);
+    }
+    return *plan;
+}
+
+void
+FftwBatchFft2d::dft2(const float2_t* src, float2_t* dst) const {
+    assert(isAligned(src) && "Misaligned FFT input");
+    assert(isAligned(dst) && "Misaligned FFT output");
+    fftwf_execute_dft(_fwd_plan, cast(src), cast(dst));
+}
+
+void
+FftwBatchFft2d::idft2(const float2_t* src, float2_t* dst) const {
+    assert(isAligned(src) && "Misaligned FFT input");
+    assert(isAligned(dst) && "Misaligned FFT output");
+    fftwf_execute_dft(_inv_plan, cast(src), cast(dst));
+}
@@ -0,0 +1,84 @@
+#include <fftw3.h>
+
+#include <armadillo>
+#include <catch2/catch_test_macros.hpp>
+#include <memory>
+
+#include "constants.hpp"
+#include "fftw_batch_fft2d.h"
+
+using namespace arma;
+
+namespace {
+constexpr auto T = constants::tile_size;
+constexpr auto n_tiles = 3;
+
+constexpr auto aligned_complex64_deleter = [](arma::cx_float* ptr) { fftwf_free(ptr); };
+using AlignedComplex64 = std::unique_ptr<arma::cx_float[], decltype(aligned_complex64_deleter)>;
+
+AlignedComplex64
+allocate(size_t n) {
+    return {reinterpret_cast<cx_float*>(fftwf_alloc_complex(n)), aligned_complex64_deleter};
+}
+
+}  // namespace
+
+SCENARIO("Forward FFT on CPU is valid", "[fftw]") {
+    GIVEN("Blank images") {
+        auto src_buffer = allocate(T * T * n_tiles);
+        auto dst_buffer = allocate(T * T * n_tiles);
+
+        cx_fcube src{src_buffer.get(), T, T, n_tiles, false, true};
+        cx_fcube dst{dst_buffer.get(), T, T, n_tiles, false, true};
+
+        // Fill values of ones; impossible numbers in the output.
+        src.fill(1.0f);
+        dst.fill(datum::nan);
+
+        WHEN("Compute forward FFT") {
+            const auto& fftpack = FftwBatchFft2d::getInstance(n_tiles, T, T);
+
+            fftpack.dft2(reinterpret_cast<float2_t*>(src_buffer.get()),
+                         reinterpret_cast<float2_t*>(dst_buffer.get()));
+
+            THEN("All zeros except at the center") {
+                REQUIRE(imag(dst).is_zero());
+
+                for (auto t = 0; t < n_tiles; t++) {
+                    REQUIRE(abs(real(dst(0, 0, t)) - T * T) < 1e-3f);
+                    dst(0, 0, t) = 0.0f;
+                }
+                REQUIRE(real(dst).is_zero());
+            }
+
+            AND_THEN("Plans are reused for the same shape") {
+                REQUIRE(&FftwBatchFft2d::getInstance(n_tiles, T, T) == &fftpack);
+                REQUIRE(&FftwBatchFft2d::getInstance(1, T, T) != &fftpack);
+            }
+        }
+    }
+}
+
+SCENARIO("Backward FFT on CPU restores the image", "[fftw]") {
+    GIVEN("Random image") {
+        auto src_buffer = allocate(T * T);
+        auto freq_buffer = allocate(T * T);
+        auto dst_buffer = allocate(T * T);
+
+        cx_fmat src{src_buffer.get(), T, T, false, true};
+        src.randu();
+
+        WHEN("Compute forward, then backward FFT") {
+            const auto& fftpack = FftwBatchFft2d::getInstance(1, T, T);
+            fftpack.dft2(reinterpret_cast<float2_t*>(src_buffer.get()),
+                         reinterpret_cast<float2_t*>(freq_buffer.get()));
+            fftpack.idft2(reinterpret_cast<float2_t*>(freq_buffer.get()),
+                          reinterpret_cast<float2_t*>(dst_buffer.get()));
+
+            THEN("Same image up to the scaling factor N*N") {
+                const cx_fmat dst{dst_buffer.get(), T, T, false, true};
+                REQUIRE(approx_equal(cx_fmat(dst / float(T * T)), src, "absdiff", 1e-4f));
+            }
+        }
+    }
+}
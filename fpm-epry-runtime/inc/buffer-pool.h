@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+
+namespace reconstruction {
+
+/** Recycle the allocations of the Halide buffers across FPM-EPRY runners.
+ *
+ * Reconstructing a plate creates thousands of runners, each allocating the
+ * same set of buffers. The pool caches the freed allocations by size, and
+ * hands them out to the next runner:
+ *
+ * - host buffers, via the default allocator of Halide::Runtime::Buffer;
+ * - host scratch memory of the pipelines, via halide_malloc / halide_free;
+ * - device buffers and device scratch memory, via the allocation cache of the
+ *   Halide device runtime.
+ *
+ * The host cache holds at most setCapacity() bytes; the allocations freed
+ * beyond it return to the system. The device cache is not bounded by Halide:
+ * call trim() at the well or run boundaries to release both caches.
+ */
+class BufferPool {
+   public:
+    struct stats_t {
+        /** Number of allocations served by the system allocator. */
+        size_t n_allocated{};
+
+        /** Number of allocations served from the cache. */
+        size_t n_reused{};
+
+        /** Size of the cached host allocations. */
+        size_t bytes_cached{};
+    };
+
+    /** Default capacity of the host cache. */
+    static constexpr size_t default_capacity = size_t{1} << 30;
+
+    /** Register the pool as the Halide allocator. Idempotent and thread-safe.
+     *
+     * Call it once at the startup of the app, before the first Halide buffer
+     * is allocated: the pool cannot free the blocks of the system allocator.
+     */
+    static void install();
+
+    /** Set the maximum size of the cached host allocations, and return the
+     * excess to the system. */
+    static void setCapacity(size_t max_bytes);
+
+    /** Return the cached allocations to the system. */
+    static void trim();
+
+    static stats_t getStats();
+
+    /** Allocator hooks. Exposed for the unit tests. */
+    static void* allocate(size_t size);
+    static void deallocate(void* ptr);
+};
+
+}  // namespace reconstruction
@@ -2,12 +2,65 @@
 #include <HalideBuffer.h>
 
 #include <armadillo>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "fpm-mode.h"
+#include "kernel-registry.h"
+#include "work-stream.h"
 
 namespace reconstruction {
 
 using ComplexBuffer = Halide::Runtime::Buffer<float, 3>;
+using ComplexBatchBuffer = Halide::Runtime::Buffer<float, 4>;
 using Halide::Runtime::Buffer;
 
+/** Find the support of the pupil functions of a batch of tiles.
+ *
+ * The support is stored as a compact span list, dimensions (2, tile_size):
+ * row y of the aperture spans [support(0, y), support(1, y)). The span covers
+ * the non-zero values of all tiles in the batch. An empty row has start ==
+ * end.
+ *
+ * @param[in] pupil Pupil functions, dimensions (2, tile_size, tile_size, n_tiles)
+ */
+Buffer<int32_t, 2> findPupilSupport(const ComplexBatchBuffer& pupil);
+
+/** How the high-resolution spectrum is updated by each illumination. */
+enum class update_mode_t {
+    /** One pipeline invocation per iteration; every illumination produces a
+     * new full oversampled plane. */
+    FULL_PLANE,
+
+    /** One pipeline invocation per illumination; only the window at k_offset
+     * is read and written. */
+    IN_PLACE,
+};
+
+/** Same modes as the pipelines, see the fpm_mode generator param. */
+using algorithms::fpm_mode_t;
+
+/** Storage precision of the amplitudes, spectra and pupil functions. */
+enum class precision_t {
+    /** Store and compute in fp32. */
+    SINGLE,
+
+    /** Store in bfloat16, compute in fp32. Halves the memory footprint and
+     * bandwidth of the solver, at about 3 significant digits. */
+    MIXED,
+};
+
+/** Reconstruct a batch of tiles with the FPM-EPRY algorithm.
+ *
+ * All operations of a runner are enqueued to its own WorkStream, including
+ * the initialization in the constructor. They complete in the enqueued order.
+ * The worker threads of the streams are recycled across the runners, see
+ * WorkStream::acquire().
+ * The *Async() methods return immediately with a completion handle, so that a
+ * host thread can prepare the next runner while the previous one is still
+ * computing.
+ */
 class FPMEpryRunner {
    public:
     /** Initialize the high-resolution image by sinc interpolation.
@@ -15,30 +68,148 @@ class FPMEpryRunner {
      * @param[in] gamma Gamma intensity correction of the raw pixels, plus 0.5.
      * (0.5 is equivalent to square root, used for conversion from intensity
      * value to amplitude value.)
+     * @param[in] precision Storage precision of the solver buffers.
      */
     FPMEpryRunner(arma::Mat<int32_t> k_offset, ComplexBuffer pupil, Buffer<uint8_t, 3> raw,
-                  const float gamma = 0.6f);
+                  const float gamma = 0.6f, precision_t precision = precision_t::SINGLE);
+
+    /** Initialize a batch of tiles, to be reconstructed in one pipeline invocation.
+     *
+     * @param[in] k_offset Fourier-domain offsets, dimensions (2, n_illuminations, n_tiles)
+     * @param[in] pupil Initial pupil functions, dimensions (2, tile_size, tile_size, n_tiles)
+     * @param[in] raw Raw images, dimensions (tile_size, tile_size, n_illuminations, n_tiles)
+     */
+    FPMEpryRunner(arma::Cube<int32_t> k_offset, ComplexBatchBuffer pupil, Buffer<uint8_t, 4> raw,
+                  const float gamma = 0.6f, precision_t precision = precision_t::SINGLE);
 
     /** Parallax enhanced pupil recovery mode. */
     FPMEpryRunner(FPMEpryRunner&&, arma::Mat<int32_t> k_offset, Buffer<uint8_t, 3> raw,
                   const float gamma = 0.6f);
 
-    /** Apply FPM-EPRY reconstuction. */
-    void reconstruct(size_t max_iter = 20, bool blocking = true);
+    /** Parallax enhanced pupil recovery mode, for a batch of tiles. */
+    FPMEpryRunner(FPMEpryRunner&&, arma::Cube<int32_t> k_offset, Buffer<uint8_t, 4> raw,
+                  const float gamma = 0.6f);
+
+    /** The pending operations reference the buffers of this runner. */
+    FPMEpryRunner(const FPMEpryRunner&) = delete;
+    FPMEpryRunner& operator=(const FPMEpryRunner&) = delete;
 
-    /** Apply inverse Fourier transform and return the high-resolution image. */
-    arma::cx_fmat computeHighRes();
+    /** Complete the pending operations. */
+    ~FPMEpryRunner();
 
-    /** Download the pupil function. */
-    arma::cx_fmat downloadPupil();
+    /** Apply FPM-EPRY reconstuction.
+     *
+     * @param[in] blocking Wait for the reconstruction to complete.
+     * @param[in] tolerance Stop once the relative change of the residual
+     * between two iterations is below the tolerance, for all tiles. Zero to
+     * always run max_iter iterations.
+     * @param[in] fpm_mode Refine or lock the pupil function.
+     * @return the number of iterations used; zero in non-blocking mode.
+     */
+    size_t reconstruct(size_t max_iter = 20, bool blocking = true,
+                       update_mode_t mode = update_mode_t::FULL_PLANE, float tolerance = 0.0f,
+                       fpm_mode_t fpm_mode = fpm_mode_t::PUPIL_RECOVERY);
+
+    /** Enqueue the FPM-EPRY reconstruction.
+     * @return the completion handle, holding the number of iterations used.
+     */
+    std::future<size_t> reconstructAsync(size_t max_iter = 20,
+                                         update_mode_t mode = update_mode_t::FULL_PLANE,
+                                         float tolerance = 0.0f,
+                                         fpm_mode_t fpm_mode = fpm_mode_t::PUPIL_RECOVERY);
+
+    /** Mean absolute amplitude error of the most recent reconstruction,
+     * dimensions (n_tiles, iterations). Valid once the reconstruction
+     * completes. */
+    const arma::fmat& getResidual() const { return residual_history; }
+
+    /** Apply inverse Fourier transform and return the high-resolution image.
+     * @param[in] tile_id the tile of the batch
+     */
+    arma::cx_fmat computeHighRes(size_t tile_id = 0);
+
+    /** Enqueue the inverse Fourier transform and the download of the
+     * high-resolution image.
+     * @param[in] tile_id the tile of the batch
+     */
+    std::future<arma::cx_fmat> computeHighResAsync(size_t tile_id = 0);
+
+    /** Download the pupil function.
+     * @param[in] tile_id the tile of the batch
+     */
+    arma::cx_fmat downloadPupil(size_t tile_id = 0);
+
+    /** Enqueue the download of the pupil function.
+     * @param[in] tile_id the tile of the batch
+     */
+    std::future<arma::cx_fmat> downloadPupilAsync(size_t tile_id = 0);
+
+    /** Block until all enqueued operations complete. */
+    void synchronize();
+
+    /** Names of the pipeline specializations invoked by each iteration, in
+     * order. */
+    std::vector<std::string> listKernels(update_mode_t mode = update_mode_t::FULL_PLANE,
+                                         fpm_mode_t fpm_mode = fpm_mode_t::PUPIL_RECOVERY) const;
 
     const int32_t n_illuminations;
+    const int32_t n_tiles;
+
+    /** Width of the raw image tiles. Selects the pipeline specializations. */
+    const int32_t tile_size;
+    const precision_t precision;
 
    private:
-    const arma::Mat<int32_t> k_offset;
-    Buffer<float, 3> low_res;
+    /** In-order queue of the operations of this runner, from the pool. Taken
+     * over by the parallax enhanced pupil recovery mode. */
+    std::shared_ptr<WorkStream> stream;
+
+    /** Initialize the high-res and pupil buffers from the raw images. */
+    void init(Buffer<uint8_t, 4> raw, const float gamma);
+
+    /** Run the FPM-EPRY iterations. */
+    size_t iterate(size_t max_iter, update_mode_t mode, float tolerance, fpm_mode_t fpm_mode);
+
+    /** Convert the raw images to amplitudes, one tile at a time. */
+    void initLowRes(Buffer<uint8_t, 4>& raw, const float gamma);
+
+    /** Consecutive illuminations processed by one pipeline invocation. */
+    struct chunk_t {
+        int32_t first;
+        int32_t count;
+        Kernel kernel;
+
+        /** Update the high-res spectrum in place, one illumination only. */
+        bool in_place;
+    };
+
+    /** Split the illuminations into the fewest pipeline invocations.
+     *
+     * In the full-plane mode, the generated specializations are combined to
+     * cover the illuminations in the fewest invocations, e.g. 21 + 9 for 30
+     * illuminations. The in-place pipeline covers the leftovers one by one.
+     * EPRY applies the illuminations sequentially, so the chunks add up to
+     * one full pass, the largest first.
+     *
+     * @throw std::runtime_error if the tile size is not generated.
+     */
+    std::vector<chunk_t> planChunks(update_mode_t mode, fpm_mode_t fpm_mode) const;
+
+    void invoke(const chunk_t& chunk, Buffer<const int32_t, 3>& k_offset_buffer,
+                Buffer<float, 1>& residual);
+
+    bool hasConverged(float tolerance) const;
+
+    const arma::Cube<int32_t> k_offset;
+
+    /** Buffers in the storage type of the precision mode. */
+    Buffer<void, 4> low_res;
+    Buffer<void, 4> f_high_res;
+    Buffer<void, 4> pupil;
+
+    /** Support of the initial pupil functions. The updates are restricted to it. */
+    Buffer<int32_t, 2> pupil_support;
 
-    ComplexBuffer f_high_res;
-    ComplexBuffer pupil;
+    arma::fmat residual_history;
 };
-}  // namespace reconstruction
\ No newline at end of file
+}  // namespace reconstruction
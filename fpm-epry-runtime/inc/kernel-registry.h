@@ -0,0 +1,69 @@
+#pragma once
+
+#include <HalideRuntime.h>
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace reconstruction {
+
+/** A pipeline generated by Halide, invoked through its argv wrapper. */
+class Kernel {
+   public:
+    Kernel() = default;
+    Kernel(int (*argv_call)(void**), const halide_filter_metadata_t* metadata)
+        : argv_call{argv_call}, metadata{metadata} {}
+
+    /** Name of the generated function, e.g. "fpm_epry_w256_n49". */
+    std::string name() const { return metadata ? metadata->name : ""; }
+
+    explicit operator bool() const { return argv_call != nullptr; }
+
+    /** Invoke the pipeline. The arguments are in the order of the generated
+     * function: Halide::Runtime::Buffer objects for the buffers, and lvalues
+     * for the scalars.
+     *
+     * @return the Halide error code; zero on success.
+     */
+    template <typename... Args>
+    int operator()(Args&... args) const {
+        void* argv[] = {asArgv(args)...};
+        if (metadata == nullptr || metadata->num_arguments != int(sizeof...(Args))) {
+            return halide_error_code_generic_error;
+        }
+        return argv_call(argv);
+    }
+
+   private:
+    template <typename T>
+    static void* asArgv(T& arg) {
+        if constexpr (std::is_convertible_v<T&, halide_buffer_t*>) {
+            return static_cast<halide_buffer_t*>(arg);
+        } else {
+            return const_cast<void*>(static_cast<const void*>(&arg));
+        }
+    }
+
+    int (*argv_call)(void**){nullptr};
+    const halide_filter_metadata_t* metadata{nullptr};
+};
+
+/** Registry of the pipeline specializations linked into fpm-epry-runtime.
+ *
+ * The Halide generated registration stubs fill in the registry at static
+ * initialization. The specializations are named after the generator, suffixed
+ * with the tile size, e.g. "_w256", the number of illuminations, e.g. "_n49",
+ * and the modes, e.g. "_auto_brightness" and "_mixed".
+ */
+class KernelRegistry {
+   public:
+    /** @return the pipeline, or an empty kernel if not generated. */
+    static Kernel find(const std::string& name);
+
+    /** Names of all registered pipelines, sorted. */
+    static std::vector<std::string> list();
+};
+
+}  // namespace reconstruction
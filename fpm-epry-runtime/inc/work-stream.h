@@ -0,0 +1,72 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+namespace reconstruction {
+
+/** In-order queue of host operations, executed by a dedicated worker thread.
+ *
+ * On the CUDA target, each worker thread enqueues the GPU kernels to its own
+ * CUDA stream. So, the operations of one queue are ordered, while the
+ * operations of different queues overlap on the GPU.
+ */
+class WorkStream {
+    std::mutex mutex;
+    std::condition_variable has_work;
+    std::deque<std::function<void()>> queue;
+    bool is_closing{false};
+
+    std::thread worker;
+
+    void run();
+
+   public:
+    WorkStream();
+
+    /** Complete all enqueued operations, and then join the worker thread. */
+    ~WorkStream();
+
+    WorkStream(const WorkStream&) = delete;
+    WorkStream& operator=(const WorkStream&) = delete;
+
+    /** Enqueue an operation.
+     * @return the completion handle, holding the return value of the operation.
+     */
+    template <typename F>
+    auto enqueue(F&& f) -> std::future<std::invoke_result_t<F>> {
+        using result_t = std::invoke_result_t<F>;
+
+        // std::function requires a copyable callable.
+        auto task = std::make_shared<std::packaged_task<result_t()>>(std::forward<F>(f));
+        auto future = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            queue.emplace_back([task]() { (*task)(); });
+        }
+        has_work.notify_one();
+
+        return future;
+    }
+
+    /** Block until all enqueued operations complete. */
+    void synchronize() { enqueue([]() {}).wait(); }
+
+    /** Take an idle stream of the process-wide pool, or start a new one.
+     *
+     * The stream is exclusive to the caller until the last reference is
+     * dropped, so that it orders the operations of the caller only. Then,
+     * the stream returns to the pool with its worker thread, and hence the
+     * CUDA stream and the cuFFT plans cached by that thread. The pool grows
+     * to the peak number of concurrent callers, e.g. the runners in flight.
+     */
+    static std::shared_ptr<WorkStream> acquire();
+};
+
+}  // namespace reconstruction
@@ -0,0 +1,172 @@
+#include "buffer-pool.h"
+
+#include <HalideBuffer.h>
+#include <HalideRuntime.h>
+
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace reconstruction {
+
+namespace {
+
+/** Alignment of the user memory. Satisfies halide_malloc, and the SIMD
+ * instructions of the host. */
+constexpr size_t alignment = 128;
+
+/** Bookkeeping in front of the user memory. */
+struct alignas(alignment) header_t {
+    size_t size;
+};
+static_assert(sizeof(header_t) == alignment);
+
+/** Round the requested size to the page size, to recycle allocations of
+ * slightly different sizes. */
+constexpr size_t
+bucketSize(size_t size) {
+    constexpr size_t page_size = 4096;
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+struct pool_t {
+    std::mutex mutex;
+    std::map<size_t, std::vector<header_t*>> free_list;
+    size_t capacity{BufferPool::default_capacity};
+    BufferPool::stats_t stats;
+};
+
+/** Free the largest cached allocations, until the cache fits the capacity.
+ * The caller holds the lock. */
+void
+shrink(pool_t& pool) {
+    for (auto it = pool.free_list.rbegin();
+         it != pool.free_list.rend() && pool.stats.bytes_cached > pool.capacity; ++it) {
+        auto& [size, headers] = *it;
+        while (!headers.empty() && pool.stats.bytes_cached > pool.capacity) {
+            std::free(headers.back());
+            headers.pop_back();
+            pool.stats.bytes_cached -= size;
+        }
+    }
+}
+
+pool_t&
+getPool() {
+    static pool_t pool;
+    return pool;
+}
+
+void*
+halideMalloc(void* /* user_context */, size_t size) {
+    return BufferPool::allocate(size);
+}
+
+void
+halideFree(void* /* user_context */, void* ptr) {
+    BufferPool::deallocate(ptr);
+}
+
+}  // namespace
+
+void*
+BufferPool::allocate(size_t size) {
+    const auto bucket = bucketSize(size);
+    auto& pool = getPool();
+
+    {
+        std::lock_guard<std::mutex> lock{pool.mutex};
+        auto it = pool.free_list.find(bucket);
+        if (it != pool.free_list.end() && !it->second.empty()) {
+            header_t* header = it->second.back();
+            it->second.pop_back();
+
+            pool.stats.n_reused++;
+            pool.stats.bytes_cached -= bucket;
+            return header + 1;
+        }
+
+        pool.stats.n_allocated++;
+    }
+
+    auto* header = static_cast<header_t*>(std::aligned_alloc(alignment, sizeof(header_t) + bucket));
+    if (header == nullptr) {
+        return nullptr;
+    }
+
+    header->size = bucket;
+    return header + 1;
+}
+
+void
+BufferPool::deallocate(void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+
+    auto* header = static_cast<header_t*>(ptr) - 1;
+    auto& pool = getPool();
+
+    {
+        std::lock_guard<std::mutex> lock{pool.mutex};
+        if (pool.stats.bytes_cached + header->size <= pool.capacity) {
+            pool.free_list[header->size].push_back(header);
+            pool.stats.bytes_cached += header->size;
+            return;
+        }
+    }
+
+    // The cache is full.
+    std::free(header);
+}
+
+void
+BufferPool::setCapacity(size_t max_bytes) {
+    auto& pool = getPool();
+    std::lock_guard<std::mutex> lock{pool.mutex};
+    pool.capacity = max_bytes;
+    shrink(pool);
+}
+
+void
+BufferPool::install() {
+    static std::once_flag is_installed;
+    std::call_once(is_installed, []() {
+        Halide::Runtime::Buffer<>::set_default_allocate_fn(&BufferPool::allocate);
+        Halide::Runtime::Buffer<>::set_default_deallocate_fn(&BufferPool::deallocate);
+
+        halide_set_custom_malloc(&halideMalloc);
+        halide_set_custom_free(&halideFree);
+
+        // Keep the freed device allocations for the next runner.
+        halide_reuse_device_allocations(nullptr, true);
+    });
+}
+
+void
+BufferPool::trim() {
+    auto& pool = getPool();
+    {
+        std::lock_guard<std::mutex> lock{pool.mutex};
+        for (auto& [size, headers] : pool.free_list) {
+            for (auto* header : headers) {
+                std::free(header);
+            }
+        }
+        pool.free_list.clear();
+        pool.stats.bytes_cached = 0;
+    }
+
+    halide_release_unused_device_allocations(nullptr);
+}
+
+BufferPool::stats_t
+BufferPool::getStats() {
+    auto& pool = getPool();
+    std::lock_guard<std::mutex> lock{pool.mutex};
+    return pool.stats;
+}
+
+}  // namespace reconstruction
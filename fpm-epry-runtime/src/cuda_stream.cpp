@@ -0,0 +1,41 @@
+#include <cuda.h>
+
+namespace {
+
+/** CUDA stream of the calling thread, created on first use. */
+struct ThreadStream {
+    CUstream stream{nullptr};
+
+    ~ThreadStream() {
+        if (stream != nullptr) {
+            cuStreamDestroy(stream);
+        }
+    }
+};
+
+}  // namespace
+
+extern "C" {
+
+/** Override the weak symbol of the Halide runtime, which always returns the
+ * default stream.
+ *
+ * Every host thread, i.e. every WorkStream of the FPM-EPRY runners, enqueues
+ * the Halide kernels and the cuFFT calls to its own non-blocking stream. The
+ * threads are pooled, so that the streams are created once per thread.
+ */
+int
+halide_cuda_get_stream(void* /* user_context */, CUcontext /* ctx */, CUstream* stream) {
+    static thread_local ThreadStream thread_stream;
+
+    if (thread_stream.stream == nullptr) {
+        const auto error = cuStreamCreate(&thread_stream.stream, CU_STREAM_NON_BLOCKING);
+        if (error != CUDA_SUCCESS) {
+            return -1;
+        }
+    }
+
+    *stream = thread_stream.stream;
+    return 0;
+}
+}
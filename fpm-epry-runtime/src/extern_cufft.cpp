@@ -0,0 +1,116 @@
+#include <HalideRuntime.h>
+#include <HalideRuntimeCuda.h>
+#include <cuda.h>
+
+#include <cassert>
+#include <cstdint>
+#include <map>
+#include <tuple>
+
+#ifdef HALIDE_EXTERN_DEBUG
+#include <iostream>
+#endif
+
+#include "cuda-context.h"
+#include "cuda_batch_fft2d.h"
+
+extern "C" int halide_cuda_get_stream(void* user_context, CUcontext ctx, CUstream* stream);
+
+namespace {
+
+/** Obtain the cuFFT plan of the given shape.
+ *
+ * cuFFT plans are bound to the CUDA context of the calling thread, so the
+ * plans are cached per thread, and created only once per tile size and batch
+ * size.
+ */
+const CudaBatchFft2d&
+getPlan(unsigned batch, int width, int height) {
+    using key_t = std::tuple<unsigned, int, int>;
+    static thread_local std::map<key_t, CudaBatchFft2d> cache;
+
+    const key_t key{batch, width, height};
+    auto it = cache.find(key);
+    if (it == cache.end()) {
+        it = cache.emplace(std::piecewise_construct, std::forward_as_tuple(key),
+                           std::forward_as_tuple(batch, width, height))
+                 .first;
+    }
+    return it->second;
+}
+
+/** Compute the 2D FFT of interleaved complex planes with dimensions (i, x, y,
+ * ...) in the GPU memory. All dimensions after the 3rd one are flattened to a
+ * batch of planes.
+ */
+int
+fft2(halide_buffer_t* in, halide_buffer_t* out, bool is_fwd) {
+    if (in->is_bounds_query()) {
+        // The transform requires the full input planes of the same shape.
+        for (int d = 0; d < in->dimensions; d++) {
+            in->dim[d].min = out->dim[d].min;
+            in->dim[d].extent = out->dim[d].extent;
+        }
+        return 0;
+    }
+
+    // Execute cuFFT in the Halide-managed CUDA context.
+    halide_cuda::Context::getInstance();
+
+    const int width = out->dim[1].extent;
+    const int height = out->dim[2].extent;
+
+    unsigned batch = 1;
+    for (int d = 3; d < out->dimensions; d++) {
+        batch *= out->dim[d].extent;
+    }
+
+    // cuFFT plans assume dense, interleaved complex values.
+    for (const auto* b : {in, out}) {
+        assert(b->dim[0].extent == 2 && b->dim[0].stride == 1);
+        assert(b->dim[1].stride == 2);
+        assert(b->dim[2].stride == 2 * width);
+        assert(b->dimensions < 4 || b->dim[3].stride == 2 * width * height);
+    }
+
+#ifdef HALIDE_EXTERN_DEBUG
+    std::cerr << (is_fwd ? "externCufftFwd" : "externCufftInv") << ": " << batch << " x "
+              << width << " x " << height << '\n';
+#endif
+
+    const auto* src = reinterpret_cast<const float2_t*>(halide_cuda_get_device_ptr(nullptr, in));
+    auto* dst = reinterpret_cast<float2_t*>(halide_cuda_get_device_ptr(nullptr, out));
+
+    // Enqueue on the stream of the Halide-generated kernels.
+    CUcontext ctx{};
+    cuCtxGetCurrent(&ctx);
+    CUstream stream{};
+    if (halide_cuda_get_stream(nullptr, ctx, &stream) != 0) {
+        return -1;
+    }
+
+    const auto& fft = getPlan(batch, width, height);
+    if (is_fwd) {
+        fft.dft2(src, dst, stream);
+    } else {
+        fft.idft2(src, dst, stream);
+    }
+
+    out->set_device_dirty();
+    return 0;
+}
+
+}  // namespace
+
+extern "C" {
+
+int
+externCufftFwd(halide_buffer_t* in, halide_buffer_t* out) {
+    return fft2(in, out, true);
+}
+
+int
+externCufftInv(halide_buffer_t* in, halide_buffer_t* out) {
+    return fft2(in, out, false);
+}
+}
@@ -0,0 +1,67 @@
+#include <HalideRuntime.h>
+
+#include <cassert>
+#include <cstdint>
+
+#include "fftw_batch_fft2d.h"
+
+namespace {
+
+/** Compute the 2D FFT of interleaved complex planes with dimensions (i, x, y,
+ * ...). All dimensions after the 3rd one are flattened to a batch of planes.
+ */
+int
+fft2(halide_buffer_t* in, halide_buffer_t* out, bool is_fwd) {
+    if (in->is_bounds_query()) {
+        // The transform requires the full input planes of the same shape.
+        for (int d = 0; d < in->dimensions; d++) {
+            in->dim[d].min = out->dim[d].min;
+            in->dim[d].extent = out->dim[d].extent;
+        }
+        return 0;
+    }
+
+    const int width = out->dim[1].extent;
+    const int height = out->dim[2].extent;
+
+    unsigned batch = 1;
+    for (int d = 3; d < out->dimensions; d++) {
+        batch *= out->dim[d].extent;
+    }
+
+    // FFTW plans assume dense, interleaved complex values.
+    for (const auto* b : {in, out}) {
+        assert(b->dim[0].extent == 2 && b->dim[0].stride == 1);
+        assert(b->dim[1].stride == 2);
+        assert(b->dim[2].stride == 2 * width);
+        assert(b->dimensions < 4 || b->dim[3].stride == 2 * width * height);
+    }
+
+    const auto* src = reinterpret_cast<const float2_t*>(in->host);
+    auto* dst = reinterpret_cast<float2_t*>(out->host);
+
+    const auto& fft = FftwBatchFft2d::getInstance(batch, width, height);
+    if (is_fwd) {
+        fft.dft2(src, dst);
+    } else {
+        fft.idft2(src, dst);
+    }
+
+    out->set_host_dirty();
+    return 0;
+}
+
+}  // namespace
+
+extern "C" {
+
+int
+externFftwFwd(halide_buffer_t* in, halide_buffer_t* out) {
+    return fft2(in, out, true);
+}
+
+int
+externFftwInv(halide_buffer_t* in, halide_buffer_t* out) {
+    return fft2(in, out, false);
+}
+}
@@ -1,110 +1,490 @@
 #include "fpm-epry-runtime.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <stdexcept>
 
-#include "constants.hpp"
-#include "fpm_epry.h"
-#include "high_res_init.h"
-#include "high_res_restore.h"
-#include "low_res_init.h"
+#include "kernel-registry.h"
+#include "types.h"
 
 namespace reconstruction {
 
-using constants::tile_size;
+namespace {
+
+/** View a single tile as a batch of one tile. */
+arma::Cube<int32_t>
+asBatch(const arma::Mat<int32_t>& k_offset) {
+    return arma::Cube<int32_t>(k_offset.memptr(), k_offset.n_rows, k_offset.n_cols, 1);
+}
+
+halide_type_t
+storageType(precision_t precision) {
+    return (precision == precision_t::MIXED) ? halide_type_t{halide_type_bfloat, 16}
+                                             : halide_type_of<float>();
+}
+
+/** Name of the pipeline specialization, following algorithms/meson.build.
+ *
+ * @param[in] specialization e.g. "_n49_auto_brightness"; empty for the
+ *     pipelines specialized for the tile size only.
+ */
+std::string
+kernelName(const std::string& generator, int32_t tile_size, precision_t precision,
+           const std::string& specialization = "") {
+    const std::string storage = (precision == precision_t::MIXED) ? "_mixed" : "";
+    return generator + "_w" + std::to_string(tile_size) + specialization + storage;
+}
+
+/** @throw std::runtime_error if the pipeline is not generated, e.g. for the
+ * tile size. */
+Kernel
+findKernel(const std::string& name) {
+    const auto kernel = KernelRegistry::find(name);
+    if (!kernel) {
+        throw std::runtime_error("Pipeline not generated: " + name);
+    }
+    return kernel;
+}
+
+/** Round to the nearest bfloat16, ties to even. */
+uint16_t
+toBfloat16(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    bits += 0x7fffu + ((bits >> 16) & 1u);
+    return static_cast<uint16_t>(bits >> 16);
+}
+
+float
+fromBfloat16(uint16_t value) {
+    const uint32_t bits = uint32_t{value} << 16;
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+template <typename T, int D>
+std::vector<int>
+extentsOf(const Buffer<T, D>& in) {
+    std::vector<int> extents(in.dimensions());
+    for (int d = 0; d < in.dimensions(); d++) {
+        extents[d] = in.dim(d).extent();
+    }
+    return extents;
+}
+
+/** Convert the host data to the storage type. Shares the buffer in fp32. */
+template <int D>
+Buffer<void, D>
+toStorage(const Buffer<float, D>& in, precision_t precision) {
+    if (precision == precision_t::SINGLE) {
+        return in;
+    }
+
+    Buffer<void, D> out{storageType(precision), extentsOf(in)};
+    in.for_each_element([&](const int* pos) {
+        *reinterpret_cast<uint16_t*>(out.address_of(pos)) = toBfloat16(in(pos));
+    });
+    return out;
+}
+
+/** Convert the host data back to fp32. Shares the buffer in fp32. */
+template <int D>
+Buffer<float, D>
+toSingle(const Buffer<void, D>& in) {
+    if (in.type() == halide_type_of<float>()) {
+        return in.template as<float>();
+    }
+
+    Buffer<float, D> out{extentsOf(in)};
+    out.for_each_element([&](const int* pos) {
+        out(pos) = fromBfloat16(*reinterpret_cast<const uint16_t*>(in.address_of(pos)));
+    });
+    return out;
+}
+
+}  // namespace
+
+Buffer<int32_t, 2>
+findPupilSupport(const ComplexBatchBuffer& pupil) {
+    const int32_t width = pupil.dim(1).extent();
+    const int32_t height = pupil.dim(2).extent();
+
+    Buffer<int32_t, 2> support{2, height};
+    for (int32_t y = 0; y < height; y++) {
+        int32_t start = width;
+        int32_t end = 0;
+
+        for (int32_t tile_id = 0; tile_id < pupil.dim(3).extent(); tile_id++) {
+            for (int32_t x = 0; x < width; x++) {
+                if (pupil(0, x, y, tile_id) == 0.0f && pupil(1, x, y, tile_id) == 0.0f) {
+                    continue;
+                }
+
+                start = std::min(start, x);
+                end = std::max(end, x + 1);
+            }
+        }
+
+        if (start >= end) {
+            start = end = 0;
+        }
+
+        support(0, y) = start;
+        support(1, y) = end;
+    }
+
+    return support;
+}
 
 FPMEpryRunner::FPMEpryRunner(arma::Mat<int32_t> _k_offset, ComplexBuffer p, Buffer<uint8_t, 3> raw,
-                             const float gamma)
+                             const float gamma, precision_t precision)
+    : FPMEpryRunner(asBatch(_k_offset), p.embedded(3), raw.embedded(3), gamma, precision) {}
+
+FPMEpryRunner::FPMEpryRunner(arma::Cube<int32_t> _k_offset, ComplexBatchBuffer p,
+                             Buffer<uint8_t, 4> raw, const float gamma, precision_t _precision)
     : n_illuminations{static_cast<int32_t>(_k_offset.n_cols)},
+      n_tiles{static_cast<int32_t>(_k_offset.n_slices)},
+      tile_size{raw.width()},
+      precision{_precision},
+      stream{WorkStream::acquire()},
       k_offset{std::move(_k_offset)},
-      low_res{tile_size, tile_size, n_illuminations},
-      f_high_res{tile_size * 2, tile_size * 2, 2},
-      pupil{std::move(p)} {
+      low_res{storageType(precision), tile_size, tile_size, n_illuminations, n_tiles},
+      f_high_res{storageType(precision), tile_size * 2, tile_size * 2, 2, n_tiles},
+      pupil{toStorage(p, precision)},
+      pupil_support{findPupilSupport(p)} {
     assert(k_offset.n_rows == 2);
 
     assert(raw.width() == tile_size);
     assert(raw.height() == tile_size);
     assert(raw.dim(2).extent() == n_illuminations);
+    assert(raw.dim(3).extent() == n_tiles);
 
     assert(pupil.dim(0).extent() == 2);
     assert(pupil.dim(1).extent() == tile_size);
     assert(pupil.dim(2).extent() == tile_size);
+    assert(pupil.dim(3).extent() == n_tiles);
 
-    pupil.set_host_dirty();
-    raw.set_host_dirty();
-    {
-        const auto has_error = low_res_init(raw, gamma, low_res);
-        assert(!has_error);
-    }
-    {
-        const auto has_error = high_res_init(low_res, f_high_res);
-        assert(!has_error);
-    }
-    f_high_res.device_sync();
+    // Fail in the calling thread, instead of the stream, if the pipelines
+    // are not generated for the tile size.
+    findKernel(kernelName("high_res_init", tile_size, precision));
+
+    stream->enqueue([this, raw, gamma]() { init(raw, gamma); });
 }
 
 FPMEpryRunner::FPMEpryRunner(FPMEpryRunner&& prev, arma::Mat<int32_t> k_offset,
                              Buffer<uint8_t, 3> raw, const float gamma)
+    : FPMEpryRunner(std::move(prev), asBatch(k_offset), raw.embedded(3), gamma) {}
+
+FPMEpryRunner::FPMEpryRunner(FPMEpryRunner&& prev, arma::Cube<int32_t> k_offset,
+                             Buffer<uint8_t, 4> raw, const float gamma)
     : n_illuminations{prev.n_illuminations},
+      n_tiles{prev.n_tiles},
+      tile_size{prev.tile_size},
+      precision{prev.precision},
+      // The pending operations of the previous runner reference its buffers.
+      // Complete them before taking over the buffers.
+      stream{[&]() {
+          prev.synchronize();
+          return std::move(prev.stream);
+      }()},
       k_offset{std::move(k_offset)},
       low_res{std::move(prev.low_res)},
       f_high_res{std::move(prev.f_high_res)},
-      pupil{std::move(prev.pupil)} {
+      pupil{std::move(prev.pupil)},
+      pupil_support{std::move(prev.pupil_support)} {
     assert(raw.width() == tile_size);
     assert(raw.height() == tile_size);
     assert(raw.dim(2).extent() == n_illuminations);
+    assert(raw.dim(3).extent() == n_tiles);
 
-    raw.set_host_dirty();
+    stream->enqueue([this, raw, gamma]() mutable {
+        initLowRes(raw, gamma);
+        low_res.device_sync();
+    });
+}
+
+FPMEpryRunner::~FPMEpryRunner() {
+    // The stream is null if taken over by another runner.
+    if (stream) {
+        stream->synchronize();
+    }
+}
+
+void
+FPMEpryRunner::synchronize() {
+    stream->synchronize();
+}
+
+void
+FPMEpryRunner::init(Buffer<uint8_t, 4> raw, const float gamma) {
+    pupil.set_host_dirty();
+    pupil_support.set_host_dirty();
+    initLowRes(raw, gamma);
     {
-        const auto has_error = low_res_init(raw, gamma, low_res);
+        const auto high_res_init = findKernel(kernelName("high_res_init", tile_size, precision));
+        const auto has_error = high_res_init(low_res, f_high_res);
+        assert(!has_error);
+    }
+    f_high_res.device_sync();
+}
+
+void
+FPMEpryRunner::initLowRes(Buffer<uint8_t, 4>& raw, const float gamma) {
+    raw.set_host_dirty();
+
+    const auto low_res_init = findKernel(kernelName("low_res_init", tile_size, precision));
+
+    // The gamma correction normalizes the brightness of each tile
+    // independently.
+    for (int32_t tile_id = 0; tile_id < n_tiles; tile_id++) {
+        auto raw_tile = raw.sliced(3, tile_id);
+        auto low_res_tile = low_res.sliced(3, tile_id);
+
+        const auto has_error = low_res_init(raw_tile, gamma, low_res_tile);
         assert(!has_error);
     }
-    low_res.device_sync();
+
+    // The slices share the host memory with the batch.
+    low_res.set_host_dirty();
+}
+
+std::vector<FPMEpryRunner::chunk_t>
+FPMEpryRunner::planChunks(update_mode_t mode, fpm_mode_t fpm_mode) const {
+    const std::string fpm_suffix =
+        (fpm_mode == fpm_mode_t::AUTO_BRIGHTNESS) ? "_auto_brightness" : "";
+
+    // Pipelines by number of illuminations, the largest first. The in-place
+    // pipeline covers the single illumination.
+    std::map<int32_t, std::pair<Kernel, bool>, std::greater<int32_t>> kernels{
+        {1, {findKernel(kernelName("fpm_epry_in_place", tile_size, precision, fpm_suffix)), true}}};
+    for (int32_t count = 2; mode == update_mode_t::FULL_PLANE && count <= n_illuminations;
+         count++) {
+        const auto specialization = "_n" + std::to_string(count) + fpm_suffix;
+        const auto kernel =
+            KernelRegistry::find(kernelName("fpm_epry", tile_size, precision, specialization));
+        if (kernel) {
+            kernels[count] = {kernel, false};
+        }
+    }
+
+    // Coin change: the fewest invocations adding up to n illuminations, and
+    // the size of the last one. Ties go to the larger pipelines.
+    std::vector<int32_t> n_invocations(n_illuminations + 1, n_illuminations + 1);
+    std::vector<int32_t> last_count(n_illuminations + 1, 0);
+    n_invocations[0] = 0;
+    for (int32_t n = 1; n <= n_illuminations; n++) {
+        for (const auto& [count, kernel] : kernels) {
+            if (count <= n && n_invocations[n - count] + 1 < n_invocations[n]) {
+                n_invocations[n] = n_invocations[n - count] + 1;
+                last_count[n] = count;
+            }
+        }
+    }
+
+    std::vector<int32_t> counts;
+    for (int32_t n = n_illuminations; n > 0; n -= last_count[n]) {
+        counts.push_back(last_count[n]);
+    }
+    std::sort(counts.begin(), counts.end(), std::greater<int32_t>());
+
+    std::vector<chunk_t> chunks;
+    int32_t first = 0;
+    for (const auto count : counts) {
+        const auto& [kernel, in_place] = kernels.at(count);
+        chunks.push_back({first, count, kernel, in_place});
+        first += count;
+    }
+
+    return chunks;
+}
+
+std::vector<std::string>
+FPMEpryRunner::listKernels(update_mode_t mode, fpm_mode_t fpm_mode) const {
+    std::vector<std::string> names;
+    for (const auto& chunk : planChunks(mode, fpm_mode)) {
+        names.push_back(chunk.kernel.name());
+    }
+    return names;
 }
 
 void
-FPMEpryRunner::reconstruct(size_t max_iter, bool is_blocking) {
-    // Close the loop by setting the input and output buffers to be the same.
-    auto& f_high_res_new = f_high_res;
-    auto& pupil_new = pupil;
+FPMEpryRunner::invoke(const chunk_t& chunk, Buffer<const int32_t, 3>& k_offset_buffer,
+                      Buffer<float, 1>& residual) {
+    using arma::span;
+    using types::X;
+    using types::Y;
 
-    Buffer<const int32_t, 2> k_offset_buffer{k_offset.memptr(), 2, n_illuminations};
-    k_offset_buffer.set_host_dirty();
+    // Present the illuminations of the chunk as the only ones.
+    const int32_t first = chunk.first;
+    auto low_res_chunk = low_res.cropped(2, first, chunk.count).translated(2, -first);
+    auto k_offset_chunk = k_offset_buffer.cropped(1, first, chunk.count).translated(1, -first);
 
-    for (size_t iter = 0; iter < max_iter; iter++) {
-        const auto has_error =
-            fpm_epry(low_res, f_high_res, pupil, k_offset_buffer, f_high_res_new, pupil_new);
+    if (!chunk.in_place) {
+        // Close the loop by setting the input and output buffers to be the same.
+        auto& f_high_res_new = f_high_res;
+        auto& pupil_new = pupil;
+
+        const auto has_error = chunk.kernel(low_res_chunk, f_high_res, pupil, k_offset_chunk,
+                                            pupil_support, f_high_res_new, pupil_new, residual);
         assert(!has_error);
+        return;
+    }
+
+    // Window covering the ROIs of all tiles in the batch.
+    const arma::Mat<int32_t> offset = k_offset(span::all, span(first), span::all);
+    const int32_t left = std::clamp(offset.row(X).min(), 0, tile_size);
+    const int32_t top = std::clamp(offset.row(Y).min(), 0, tile_size);
+    const int32_t right = std::clamp(offset.row(X).max() + tile_size, tile_size, tile_size * 2);
+    const int32_t bottom = std::clamp(offset.row(Y).max() + tile_size, tile_size, tile_size * 2);
+
+    auto f_high_res_window =
+        f_high_res.cropped(0, left, right - left).cropped(1, top, bottom - top);
+
+    const auto has_error = chunk.kernel(low_res_chunk, f_high_res, pupil, k_offset_chunk,
+                                        pupil_support, f_high_res_window, pupil, residual);
+    assert(!has_error);
+}
+
+size_t
+FPMEpryRunner::reconstruct(size_t max_iter, bool is_blocking, update_mode_t mode,
+                           float tolerance, fpm_mode_t fpm_mode) {
+    auto n_iter = reconstructAsync(max_iter, mode, tolerance, fpm_mode);
+    if (!is_blocking) {
+        return 0;
+    }
+
+    return n_iter.get();
+}
+
+std::future<size_t>
+FPMEpryRunner::reconstructAsync(size_t max_iter, update_mode_t mode, float tolerance,
+                                fpm_mode_t fpm_mode) {
+    return stream->enqueue([=]() { return iterate(max_iter, mode, tolerance, fpm_mode); });
+}
+
+size_t
+FPMEpryRunner::iterate(size_t max_iter, update_mode_t mode, float tolerance,
+                       fpm_mode_t fpm_mode) {
+    Buffer<const int32_t, 3> k_offset_buffer{k_offset.memptr(), 2, n_illuminations, n_tiles};
+    k_offset_buffer.set_host_dirty();
+
+    // One pipeline invocation, and one residual, per chunk of illuminations.
+    // Without tolerance, nothing depends on the residuals until the end. Keep
+    // those of every iteration on the device, and read them back at once.
+    const auto chunks = planChunks(mode, fpm_mode);
+    const bool is_early_stop = tolerance > 0.0f;
+    const size_t n_sets = is_early_stop ? 1 : max_iter;
+    std::vector<Buffer<float, 1>> residual;
+    residual.reserve(n_sets * chunks.size());
+    for (size_t i = 0; i < n_sets * chunks.size(); i++) {
+        residual.emplace_back(n_tiles);
+    }
+
+    residual_history.reset();
+    const auto recordResidual = [&](size_t set) {
+        arma::fvec mean_residual(n_tiles, arma::fill::zeros);
+        for (size_t i = 0; i < chunks.size(); i++) {
+            // Weighted by the number of illuminations of the chunk.
+            auto& r = residual[set * chunks.size() + i];
+            r.copy_to_host();
+            mean_residual += arma::fvec(r.data(), n_tiles) * float(chunks[i].count) /
+                             float(n_illuminations);
+        }
+        residual_history.insert_cols(residual_history.n_cols, mean_residual);
+    };
+
+    size_t iter = 0;
+    while (iter < max_iter) {
+        const size_t set = is_early_stop ? 0 : iter;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            invoke(chunks[i], k_offset_buffer, residual[set * chunks.size() + i]);
+        }
+        iter++;
+
+        // Only the caller of reconstructAsync() waits for the round trip.
+        if (is_early_stop) {
+            recordResidual(set);
+            if (hasConverged(tolerance)) {
+                break;
+            }
+        }
     }
 
-    // Now, wait for the algorithm to finish, and then copy the data from GPU to
-    // CPU.
-    if (is_blocking) {
-        f_high_res.device_sync();
+    if (!is_early_stop) {
+        for (size_t set = 0; set < iter; set++) {
+            recordResidual(set);
+        }
     }
+
+    // Now, wait for the algorithm to finish.
+    f_high_res.device_sync();
+
+    return iter;
+}
+
+bool
+FPMEpryRunner::hasConverged(float tolerance) const {
+    const auto n_iter = residual_history.n_cols;
+    if (tolerance <= 0.0f || n_iter < 2) {
+        return false;
+    }
+
+    // Relative change of the residual of every tile in the batch.
+    const arma::fvec previous = residual_history.col(n_iter - 2);
+    const arma::fvec current = residual_history.col(n_iter - 1);
+    return arma::all(arma::abs(previous - current) <= tolerance * previous);
 }
 
 arma::cx_fmat
-FPMEpryRunner::computeHighRes() {
-    arma::cx_fmat high_res(tile_size, tile_size);
+FPMEpryRunner::computeHighRes(size_t tile_id) {
+    return computeHighResAsync(tile_id).get();
+}
 
-    Halide::Runtime::Buffer<float, 3> high_res_buffer{reinterpret_cast<float*>(high_res.memptr()),
-                                                      2, tile_size, tile_size};
+std::future<arma::cx_fmat>
+FPMEpryRunner::computeHighResAsync(size_t tile_id) {
+    assert(tile_id < size_t(n_tiles));
 
-    // Apply inverse 2D fourier transform.
-    const auto has_error = high_res_restore(f_high_res, high_res_buffer);
-    assert(!has_error);
+    return stream->enqueue([this, tile_id]() {
+        arma::cx_fmat high_res(tile_size, tile_size);
+
+        Halide::Runtime::Buffer<float, 3> high_res_buffer{
+            reinterpret_cast<float*>(high_res.memptr()), 2, tile_size, tile_size};
+
+        // Apply inverse 2D fourier transform.
+        auto f_high_res_tile = f_high_res.sliced(3, static_cast<int>(tile_id));
+        const auto high_res_restore =
+            findKernel(kernelName("high_res_restore", tile_size, precision));
+        const auto has_error = high_res_restore(f_high_res_tile, high_res_buffer);
+        assert(!has_error);
 
-    high_res_buffer.copy_to_host();
-    return high_res;
+        high_res_buffer.copy_to_host();
+        return high_res;
+    });
 }
 
 arma::cx_fmat
-FPMEpryRunner::downloadPupil() {
+FPMEpryRunner::downloadPupil(size_t tile_id) {
+    return downloadPupilAsync(tile_id).get();
+}
+
+std::future<arma::cx_fmat>
+FPMEpryRunner::downloadPupilAsync(size_t tile_id) {
     using arma::cx_float;
+    assert(tile_id < size_t(n_tiles));
+
+    return stream->enqueue([this, tile_id]() {
+        pupil.copy_to_host();
+        const auto pupil_tile = toSingle(pupil.sliced(3, static_cast<int>(tile_id)));
 
-    pupil.copy_to_host();
-    return arma::cx_fmat{reinterpret_cast<cx_float*>(pupil.data()), tile_size, tile_size, false,
-                         true};
+        // Copy out of the pupil buffer, which the subsequent operations
+        // overwrite.
+        return arma::cx_fmat{reinterpret_cast<const cx_float*>(pupil_tile.data()), tile_size,
+                             tile_size};
+    });
 }
 
-}  // namespace reconstruction
\ No newline at end of file
+}  // namespace reconstruction
@@ -0,0 +1,57 @@
+#include "kernel-registry.h"
+
+#include <map>
+#include <mutex>
+
+namespace {
+using reconstruction::Kernel;
+
+struct registry_t {
+    std::mutex mutex;
+    std::map<std::string, Kernel> kernels;
+};
+
+registry_t&
+registry() {
+    // Constructed on first use; the registration stubs run at static
+    // initialization, in unspecified order.
+    static registry_t instance;
+    return instance;
+}
+
+}  // namespace
+
+extern "C" void
+halide_register_argv_and_metadata(int (*filter_argv_call)(void**),
+                                  const halide_filter_metadata_t* filter_metadata,
+                                  const char* const* /* extra_key_value_pairs */) {
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock{r.mutex};
+    r.kernels.emplace(filter_metadata->name, Kernel{filter_argv_call, filter_metadata});
+}
+
+namespace reconstruction {
+
+Kernel
+KernelRegistry::find(const std::string& name) {
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock{r.mutex};
+
+    const auto it = r.kernels.find(name);
+    return (it == r.kernels.end()) ? Kernel{} : it->second;
+}
+
+std::vector<std::string>
+KernelRegistry::list() {
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock{r.mutex};
+
+    std::vector<std::string> names;
+    names.reserve(r.kernels.size());
+    for (const auto& [name, kernel] : r.kernels) {
+        names.push_back(name);
+    }
+    return names;
+}
+
+}  // namespace reconstruction
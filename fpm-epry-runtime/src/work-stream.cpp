@@ -0,0 +1,78 @@
+#include "work-stream.h"
+
+#include <vector>
+
+namespace reconstruction {
+
+namespace {
+
+/** Idle streams, waiting for the next caller. */
+struct pool_t {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<WorkStream>> idle;
+};
+
+pool_t&
+pool() {
+    static pool_t instance;
+    return instance;
+}
+
+}  // namespace
+
+WorkStream::WorkStream() : worker{&WorkStream::run, this} {}
+
+WorkStream::~WorkStream() {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        is_closing = true;
+    }
+    has_work.notify_one();
+    worker.join();
+}
+
+void
+WorkStream::run() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            has_work.wait(lock, [&]() { return is_closing || !queue.empty(); });
+
+            // Drain the queue before closing.
+            if (queue.empty()) {
+                return;
+            }
+
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        task();
+    }
+}
+
+std::shared_ptr<WorkStream>
+WorkStream::acquire() {
+    auto& p = pool();
+    std::unique_ptr<WorkStream> stream;
+    {
+        std::lock_guard<std::mutex> lock{p.mutex};
+        if (!p.idle.empty()) {
+            stream = std::move(p.idle.back());
+            p.idle.pop_back();
+        }
+    }
+    if (!stream) {
+        stream = std::make_unique<WorkStream>();
+    }
+
+    // Return the stream to the pool, instead of joining the worker thread.
+    return {stream.release(), [](WorkStream* released) {
+                auto& p = pool();
+                std::lock_guard<std::mutex> lock{p.mutex};
+                p.idle.emplace_back(released);
+            }};
+}
+
+}  // namespace reconstruction
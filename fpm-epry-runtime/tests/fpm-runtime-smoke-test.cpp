@@ -1,14 +1,39 @@
 #include <armadillo>
 #include <catch2/catch_test_macros.hpp>
+#include <catch2/reporters/catch_reporter_event_listener.hpp>
+#include <catch2/reporters/catch_reporter_registrars.hpp>
+#include <array>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <taskflow/taskflow.hpp>
 
+#include "buffer-pool.h"
 #include "constants.hpp"
 #include "fpm-epry-runtime.h"
 
 using namespace arma;
 using constants::tile_size;
 using Halide::Runtime::Buffer;
+using reconstruction::ComplexBatchBuffer;
 using reconstruction::ComplexBuffer;
 
+namespace {
+
+/** As in the apps: register the pool before the first Halide allocation. */
+class InstallBufferPool : public Catch::EventListenerBase {
+   public:
+    using Catch::EventListenerBase::EventListenerBase;
+
+    void testRunStarting(const Catch::TestRunInfo&) override {
+        reconstruction::BufferPool::install();
+    }
+};
+
+}  // namespace
+
+CATCH_REGISTER_LISTENER(InstallBufferPool)
+
 SCENARIO("Can run EPRY algorithm smoothly", "[runner]") {
     constexpr auto n_illuminations = 25;
     GIVEN("Raw data") {
@@ -38,3 +63,521 @@ SCENARIO("Can run EPRY algorithm smoothly", "[runner]") {
         }
     }
 }
+
+SCENARIO("Can run EPRY algorithm on a batch of tiles", "[runner]") {
+    constexpr auto n_illuminations = 25;
+    constexpr auto n_tiles = 4;
+    GIVEN("Raw data of multiple tiles") {
+        Cube<int32_t> k_offset(2, n_illuminations, n_tiles, fill::zeros);
+        ComplexBatchBuffer pupil{2, tile_size, tile_size, n_tiles};
+        Buffer<uint8_t, 4> raw{tile_size, tile_size, n_illuminations, n_tiles};
+
+        pupil.fill(0.0f);
+        raw.fill(128);
+
+        WHEN("Initialize FPMEpryRunner") {
+            reconstruction::FPMEpryRunner runner{std::move(k_offset), std::move(pupil),
+                                                 std::move(raw)};
+            REQUIRE(runner.n_illuminations == n_illuminations);
+            REQUIRE(runner.n_tiles == n_tiles);
+
+            THEN("Can reconstruct all tiles in one pass") {
+                runner.reconstruct(5);
+
+                AND_THEN("Can download every high res image") {
+                    for (size_t tile_id = 0; tile_id < n_tiles; tile_id++) {
+                        const auto high_res = runner.computeHighRes(tile_id);
+                        REQUIRE(high_res.is_finite());
+                    }
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Can update the high-res spectrum in place", "[runner]") {
+    using reconstruction::fpm_mode_t;
+    using reconstruction::update_mode_t;
+
+    constexpr auto n_illuminations = 9;
+    constexpr auto n_tiles = 2;
+    GIVEN("Textured raw data of two tiles, with a window not a multiple of the vector size") {
+        const auto makeRunner = [&]() {
+            // The k-offsets of the tiles differ by 3 pixels, so the window
+            // covering both is 3 pixels wider than the tile.
+            Cube<int32_t> k_offset(2, n_illuminations, n_tiles);
+            for (int32_t tile_id = 0; tile_id < n_tiles; tile_id++) {
+                for (int32_t k = 0; k < n_illuminations; k++) {
+                    k_offset(0, k, tile_id) = tile_size / 2 + (k % 3 - 1) * 8 + tile_id * 3;
+                    k_offset(1, k, tile_id) = tile_size / 2 + (k / 3 - 1) * 8 - tile_id * 3;
+                }
+            }
+
+            ComplexBatchBuffer pupil{2, tile_size, tile_size, n_tiles};
+            Buffer<uint8_t, 4> raw{tile_size, tile_size, n_illuminations, n_tiles};
+            pupil.fill(1.0f);
+            raw.for_each_element([&](int x, int y, int k, int tile_id) {
+                raw(x, y, k, tile_id) =
+                    static_cast<uint8_t>(64 + (x * 7 + y * 13 + k * 29 + tile_id * 5) % 128);
+            });
+
+            return std::make_unique<reconstruction::FPMEpryRunner>(
+                std::move(k_offset), std::move(pupil), std::move(raw));
+        };
+
+        // The pupil is locked, so that both modes apply the same sequence of
+        // updates.
+        auto full_plane = makeRunner();
+        auto in_place = makeRunner();
+
+        WHEN("Reconstruct one illumination at a time") {
+            full_plane->reconstruct(2, true, update_mode_t::FULL_PLANE, 0.0f,
+                                    fpm_mode_t::AUTO_BRIGHTNESS);
+            in_place->reconstruct(2, true, update_mode_t::IN_PLACE, 0.0f,
+                                  fpm_mode_t::AUTO_BRIGHTNESS);
+
+            THEN("The high res images agree with the full-plane update") {
+                for (size_t tile_id = 0; tile_id < n_tiles; tile_id++) {
+                    const cx_fmat expected = full_plane->computeHighRes(tile_id);
+                    const cx_fmat actual = in_place->computeHighRes(tile_id);
+                    REQUIRE(actual.is_finite());
+                    REQUIRE(norm(actual - expected, "fro") <= 1e-4f * norm(expected, "fro"));
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Can dispatch jobs to the pipeline specializations", "[runner]") {
+    using reconstruction::fpm_mode_t;
+    using reconstruction::update_mode_t;
+
+    GIVEN("128-pixel tiles, with an illumination count without specialization") {
+        constexpr int32_t width = 128;
+        constexpr auto n_illuminations = 30;
+
+        Mat<int32_t> k_offset(2, n_illuminations);
+        k_offset.fill(width / 2);
+
+        ComplexBuffer pupil{2, width, width};
+        Buffer<uint8_t, 3> raw{width, width, n_illuminations};
+        pupil.fill(1.0f);
+        raw.fill(128);
+
+        reconstruction::FPMEpryRunner runner{std::move(k_offset), std::move(pupil),
+                                             std::move(raw)};
+        REQUIRE(runner.tile_size == width);
+
+        WHEN("Plan the pipeline invocations") {
+            const auto full_plane = runner.listKernels();
+            const auto in_place = runner.listKernels(update_mode_t::IN_PLACE);
+            const auto locked =
+                runner.listKernels(update_mode_t::FULL_PLANE, fpm_mode_t::AUTO_BRIGHTNESS);
+
+            THEN("The fewest pipeline invocations cover the illuminations") {
+                REQUIRE(full_plane.size() == 2);
+                REQUIRE(full_plane.front() == "fpm_epry_w128_n21");
+                REQUIRE(full_plane.back() == "fpm_epry_w128_n9");
+
+                REQUIRE(in_place.size() == n_illuminations);
+                REQUIRE(locked.front() == "fpm_epry_w128_n21_auto_brightness");
+            }
+        }
+
+        WHEN("Reconstruct") {
+            const auto n_iter = runner.reconstruct(2);
+
+            THEN("The high res image is valid") {
+                REQUIRE(n_iter == 2);
+                REQUIRE(runner.getResidual().is_finite());
+
+                const auto high_res = runner.computeHighRes();
+                REQUIRE(high_res.n_rows == width);
+                REQUIRE(high_res.is_finite());
+            }
+        }
+    }
+
+    GIVEN("An illumination count leaving one illumination over") {
+        constexpr int32_t width = 128;
+        constexpr auto n_illuminations = 31;
+
+        Mat<int32_t> k_offset(2, n_illuminations);
+        k_offset.fill(width / 2);
+
+        ComplexBuffer pupil{2, width, width};
+        Buffer<uint8_t, 3> raw{width, width, n_illuminations};
+        pupil.fill(1.0f);
+        raw.fill(128);
+
+        reconstruction::FPMEpryRunner runner{std::move(k_offset), std::move(pupil),
+                                             std::move(raw)};
+
+        THEN("The leftover is visited in place, last") {
+            const auto full_plane = runner.listKernels();
+            REQUIRE(full_plane.size() == 3);
+            REQUIRE(full_plane.front() == "fpm_epry_w128_n21");
+            REQUIRE(full_plane.back() == "fpm_epry_in_place_w128");
+        }
+    }
+
+    GIVEN("A tile size without pipelines") {
+        constexpr int32_t width = 64;
+        constexpr auto n_illuminations = 9;
+
+        Mat<int32_t> k_offset(2, n_illuminations);
+        k_offset.fill(width / 2);
+
+        ComplexBuffer pupil{2, width, width};
+        Buffer<uint8_t, 3> raw{width, width, n_illuminations};
+        pupil.fill(1.0f);
+        raw.fill(128);
+
+        THEN("The runner fails to initialize") {
+            REQUIRE_THROWS_AS(reconstruction::FPMEpryRunner(std::move(k_offset), std::move(pupil),
+                                                            std::move(raw)),
+                              std::runtime_error);
+        }
+    }
+}
+
+SCENARIO("Can find the support of the pupil function", "[runner]") {
+    GIVEN("A disc-shaped pupil function") {
+        constexpr int32_t radius = tile_size / 4;
+        constexpr int32_t center = tile_size / 2;
+
+        ComplexBatchBuffer pupil{2, tile_size, tile_size, 1};
+        pupil.fill(0.0f);
+        for (int32_t y = 0; y < tile_size; y++) {
+            for (int32_t x = 0; x < tile_size; x++) {
+                const auto r2 = (x - center) * (x - center) + (y - center) * (y - center);
+                if (r2 < radius * radius) {
+                    pupil(0, x, y, 0) = 1.0f;
+                }
+            }
+        }
+
+        WHEN("Find the span of each row") {
+            const auto support = reconstruction::findPupilSupport(pupil);
+
+            THEN("The spans enclose the disc exactly") {
+                REQUIRE(support(0, 0) == support(1, 0));
+                REQUIRE(support(0, center) == center - radius + 1);
+                REQUIRE(support(1, center) == center + radius);
+
+                for (int32_t y = 0; y < tile_size; y++) {
+                    REQUIRE(support(0, y) <= support(1, y));
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Can stop the EPRY iterations early", "[runner]") {
+    constexpr auto n_illuminations = 9;
+    constexpr size_t max_iter = 10;
+    GIVEN("Raw data") {
+        Mat<int32_t> k_offset(2, n_illuminations);
+        k_offset.fill(tile_size / 2);
+
+        ComplexBuffer pupil{2, tile_size, tile_size};
+        Buffer<uint8_t, 3> raw{tile_size, tile_size, n_illuminations};
+
+        pupil.fill(1.0f);
+        raw.fill(128);
+
+        reconstruction::FPMEpryRunner runner{std::move(k_offset), std::move(pupil),
+                                             std::move(raw)};
+
+        WHEN("Reconstruct without tolerance") {
+            const auto n_iter = runner.reconstruct(max_iter);
+
+            THEN("All iterations are used, and the residual is recorded") {
+                REQUIRE(n_iter == max_iter);
+                REQUIRE(runner.getResidual().n_cols == max_iter);
+                REQUIRE(runner.getResidual().is_finite());
+            }
+        }
+
+        WHEN("Reconstruct with a loose tolerance") {
+            const auto n_iter =
+                runner.reconstruct(max_iter, true, reconstruction::update_mode_t::FULL_PLANE, 1.0f);
+
+            THEN("Stop at the second iteration") {
+                REQUIRE(n_iter == 2);
+                REQUIRE(runner.getResidual().n_cols == 2);
+            }
+        }
+    }
+}
+
+SCENARIO("Can reconstruct tiles asynchronously", "[runner]") {
+    constexpr auto n_illuminations = 9;
+    GIVEN("Raw data of two tiles") {
+        const auto makeRunner = [&]() {
+            Mat<int32_t> k_offset(2, n_illuminations);
+            k_offset.fill(tile_size / 2);
+
+            ComplexBuffer pupil{2, tile_size, tile_size};
+            Buffer<uint8_t, 3> raw{tile_size, tile_size, n_illuminations};
+            pupil.fill(1.0f);
+            raw.fill(128);
+
+            return std::make_unique<reconstruction::FPMEpryRunner>(
+                std::move(k_offset), std::move(pupil), std::move(raw));
+        };
+
+        WHEN("Enqueue the second tile while the first one is in flight") {
+            auto first = makeRunner();
+            auto first_iter = first->reconstructAsync(3);
+            auto first_high_res = first->computeHighResAsync();
+            auto first_pupil = first->downloadPupilAsync();
+
+            auto second = makeRunner();
+            auto second_iter = second->reconstructAsync(3);
+            auto second_high_res = second->computeHighResAsync();
+
+            THEN("The results are completed in order, per runner") {
+                REQUIRE(first_iter.get() == 3);
+                REQUIRE(second_iter.get() == 3);
+
+                const auto a = first_high_res.get();
+                const auto b = second_high_res.get();
+                REQUIRE(a.is_finite());
+                REQUIRE(b.is_finite());
+
+                // Identical input, identical output.
+                REQUIRE(arma::approx_equal(a, b, "absdiff", 1e-6f));
+                REQUIRE(first_pupil.get().is_finite());
+            }
+        }
+    }
+}
+
+SCENARIO("Can overlap the work streams of the runners", "[runner]") {
+    using reconstruction::WorkStream;
+    using namespace std::chrono_literals;
+
+    GIVEN("Two runners on different Taskflow workers") {
+        tf::Executor executor{2};
+        tf::Taskflow taskflow;
+
+        // Each stream waits for the other one: a rendezvous, only reached
+        // if the streams run concurrently.
+        std::array<std::promise<void>, 2> arrived;
+        std::array<std::shared_future<void>, 2> has_arrived{arrived[0].get_future().share(),
+                                                            arrived[1].get_future().share()};
+        std::array<bool, 2> met{false, false};
+        std::array<WorkStream*, 2> streams{};
+
+        taskflow.for_each_index(0, 2, 1, [&](int i) {
+            // As in the constructor of FPMEpryRunner.
+            auto stream = WorkStream::acquire();
+            streams[i] = stream.get();
+            stream
+                ->enqueue([&, i]() {
+                    arrived[i].set_value();
+                    met[i] = has_arrived[1 - i].wait_for(10s) == std::future_status::ready;
+                })
+                .wait();
+        });
+        executor.run(taskflow).wait();
+
+        THEN("The operations of the runners overlap") {
+            REQUIRE(streams[0] != streams[1]);
+            REQUIRE(met[0]);
+            REQUIRE(met[1]);
+        }
+
+        WHEN("The runners are done") {
+            const auto stream = WorkStream::acquire();
+
+            THEN("The next runner reuses a worker thread") {
+                REQUIRE((stream.get() == streams[0] || stream.get() == streams[1]));
+            }
+        }
+    }
+}
+
+SCENARIO("Can warm-start a tile from a recovered pupil", "[runner]") {
+    constexpr auto n_illuminations = 9;
+    GIVEN("A pupil function recovered on the seed tile") {
+        const auto makeRunner = [&](ComplexBuffer pupil) {
+            Mat<int32_t> k_offset(2, n_illuminations);
+            k_offset.fill(tile_size / 2);
+
+            Buffer<uint8_t, 3> raw{tile_size, tile_size, n_illuminations};
+            raw.fill(128);
+
+            return std::make_unique<reconstruction::FPMEpryRunner>(
+                std::move(k_offset), std::move(pupil), std::move(raw));
+        };
+
+        ComplexBuffer initial_pupil{2, tile_size, tile_size};
+        initial_pupil.fill(1.0f);
+
+        auto seed = makeRunner(initial_pupil.copy());
+        seed->reconstruct(3);
+        const cx_fmat recovered = seed->downloadPupil();
+        REQUIRE(recovered.is_finite());
+
+        WHEN("Reconstruct another tile with the pupil locked") {
+            ComplexBuffer pupil{2, tile_size, tile_size};
+            std::copy_n(reinterpret_cast<const float*>(recovered.memptr()), 2 * recovered.n_elem,
+                        pupil.data());
+
+            auto runner = makeRunner(std::move(pupil));
+            const auto n_iter =
+                runner->reconstruct(3, true, reconstruction::update_mode_t::FULL_PLANE, 0.0f,
+                                    reconstruction::fpm_mode_t::AUTO_BRIGHTNESS);
+
+            THEN("The high res image is updated, and the pupil is unchanged") {
+                REQUIRE(n_iter == 3);
+                REQUIRE(runner->computeHighRes().is_finite());
+                REQUIRE(arma::approx_equal(runner->downloadPupil(), recovered, "absdiff", 0.0f));
+            }
+        }
+    }
+}
+
+SCENARIO("Mixed precision agrees with single precision", "[runner]") {
+    constexpr auto n_illuminations = 9;
+    constexpr size_t max_iter = 5;
+    GIVEN("Raw data with texture, and a disc-shaped pupil function") {
+        const auto makeRunner = [&](reconstruction::precision_t precision) {
+            Mat<int32_t> k_offset(2, n_illuminations);
+            for (int32_t k = 0; k < n_illuminations; k++) {
+                k_offset(0, k) = tile_size / 2 + (k % 3 - 1) * 8;
+                k_offset(1, k) = tile_size / 2 + (k / 3 - 1) * 8;
+            }
+
+            ComplexBuffer pupil{2, tile_size, tile_size};
+            pupil.fill(0.0f);
+            constexpr int32_t radius = tile_size / 4;
+            constexpr int32_t center = tile_size / 2;
+            for (int32_t y = 0; y < tile_size; y++) {
+                for (int32_t x = 0; x < tile_size; x++) {
+                    const auto r2 = (x - center) * (x - center) + (y - center) * (y - center);
+                    if (r2 < radius * radius) {
+                        pupil(0, x, y) = 1.0f;
+                    }
+                }
+            }
+
+            Buffer<uint8_t, 3> raw{tile_size, tile_size, n_illuminations};
+            raw.for_each_element([&](int x, int y, int k) {
+                raw(x, y, k) = static_cast<uint8_t>(64 + (x * 7 + y * 13 + k * 29) % 128);
+            });
+
+            return std::make_unique<reconstruction::FPMEpryRunner>(
+                std::move(k_offset), std::move(pupil), std::move(raw), 0.6f, precision);
+        };
+
+        auto single = makeRunner(reconstruction::precision_t::SINGLE);
+        auto mixed = makeRunner(reconstruction::precision_t::MIXED);
+
+        WHEN("Reconstruct in both precisions") {
+            single->reconstruct(max_iter);
+            mixed->reconstruct(max_iter);
+
+            const cx_fmat expected = single->computeHighRes();
+            const cx_fmat actual = mixed->computeHighRes();
+
+            THEN("The high res images agree within the bfloat16 precision") {
+                REQUIRE(actual.is_finite());
+                REQUIRE(norm(actual - expected, "fro") <= 2e-2f * norm(expected, "fro"));
+
+                const cx_fmat expected_pupil = single->downloadPupil();
+                const cx_fmat actual_pupil = mixed->downloadPupil();
+                REQUIRE(norm(actual_pupil - expected_pupil, "fro") <=
+                        2e-2f * norm(expected_pupil, "fro"));
+            }
+
+            AND_THEN("The residuals agree") {
+                const fmat& expected_residual = single->getResidual();
+                const fmat& actual_residual = mixed->getResidual();
+                REQUIRE(arma::approx_equal(actual_residual, expected_residual, "reldiff", 2e-2f));
+            }
+        }
+    }
+}
+
+SCENARIO("Can recycle the buffers of the runners", "[runner]") {
+    using reconstruction::BufferPool;
+    constexpr size_t size = 1024 * 1024;
+
+    GIVEN("A freed allocation") {
+        void* ptr = BufferPool::allocate(size);
+        REQUIRE(ptr != nullptr);
+        REQUIRE(reinterpret_cast<uintptr_t>(ptr) % 128 == 0);
+        BufferPool::deallocate(ptr);
+
+        WHEN("Allocate the same size again") {
+            const auto before = BufferPool::getStats();
+            void* recycled = BufferPool::allocate(size);
+
+            THEN("The allocation is served from the cache") {
+                REQUIRE(recycled == ptr);
+                REQUIRE(BufferPool::getStats().n_reused == before.n_reused + 1);
+            }
+            BufferPool::deallocate(recycled);
+        }
+    }
+
+    GIVEN("A cache of one allocation") {
+        BufferPool::trim();
+        BufferPool::setCapacity(size);
+
+        void* first = BufferPool::allocate(size);
+        void* second = BufferPool::allocate(size);
+
+        WHEN("Free both allocations") {
+            BufferPool::deallocate(first);
+            BufferPool::deallocate(second);
+
+            THEN("Only the first one is cached") {
+                REQUIRE(BufferPool::getStats().bytes_cached == size);
+            }
+        }
+
+        WHEN("Trim the cache") {
+            BufferPool::deallocate(first);
+            BufferPool::deallocate(second);
+            BufferPool::trim();
+
+            THEN("All allocations return to the system") {
+                REQUIRE(BufferPool::getStats().bytes_cached == 0);
+            }
+        }
+
+        BufferPool::setCapacity(BufferPool::default_capacity);
+    }
+
+    GIVEN("Consecutive runners of the same shape") {
+        constexpr auto n_illuminations = 9;
+        const auto runOnce = [&]() {
+            Mat<int32_t> k_offset(2, n_illuminations);
+            k_offset.fill(tile_size / 2);
+
+            ComplexBuffer pupil{2, tile_size, tile_size};
+            Buffer<uint8_t, 3> raw{tile_size, tile_size, n_illuminations};
+            pupil.fill(1.0f);
+            raw.fill(128);
+
+            reconstruction::FPMEpryRunner runner{std::move(k_offset), std::move(pupil),
+                                                 std::move(raw)};
+            runner.reconstruct(1);
+        };
+
+        runOnce();
+
+        WHEN("Run the second runner") {
+            const auto before = BufferPool::getStats();
+            runOnce();
+
+            THEN("No new host allocation is made") {
+                REQUIRE(BufferPool::getStats().n_allocated == before.n_allocated);
+            }
+        }
+    }
+}
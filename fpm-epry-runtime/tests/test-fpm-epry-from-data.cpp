@@ -5,8 +5,10 @@
 // Patch to encode std::complex<float> in HDF5 file.
 #include "complex_float_support.hpp"
 #include "constants.hpp"
+#include "default-geometry.hpp"
 #include "fpm-epry-runtime.h"
 #include "read-slice.h"
+#include "wavevector_utility.hpp"
 
 using namespace arma;
 using namespace HighFive;
@@ -15,37 +17,22 @@ using Halide::Runtime::Buffer;
 using reconstruction::ComplexBuffer;
 
 namespace {
-constexpr auto n_illuminations = 49;
+constexpr auto n_illuminations = geometry::n_leds;
 constexpr char filename[]{HDF5_FILE_PATH};
 constexpr int well_id = 5;
 
-std::vector<size_t>
-getGenericFrameId() {
-    std::vector<size_t> frame_id(n_illuminations);
+/** Illuminations in the order of reconstruction, and their Fourier-domain
+ * offsets, at the center of the camera view. */
+std::pair<std::vector<size_t>, Mat<int32_t>>
+scheduleIlluminations() {
+    WavevectorOverMeniscus wavevector{geometry::n_leds};
+    geometry::setDefault(wavevector);
+    wavevector.solve({0.0, 0.0});
 
-    std::iota(frame_id.begin(), frame_id.end(), 0);
-    return frame_id;
+    const uvec schedule = wavevector.getSchedule();
+    return {conv_to<std::vector<size_t>>::from(schedule), wavevector.getOffsets(schedule)};
 }
 
-template <typename T>
-struct coord_t {
-    T kx{};
-    T ky{};
-};
-static_assert(sizeof(coord_t<int32_t>) == sizeof(int32_t) * 2);
-
-using C = coord_t<int32_t>;
-constexpr std::array k_offset{
-    C{128, 128}, C{128, 108}, C{147, 128}, C{128, 147}, C{108, 128}, C{108, 108}, C{147, 108},
-    C{147, 147}, C{108, 147}, C{128, 89},  C{166, 128}, C{128, 166}, C{89, 128},  C{89, 108},
-    C{108, 89},  C{147, 89},  C{166, 108}, C{166, 147}, C{147, 166}, C{108, 166}, C{89, 147},
-    C{90, 90},   C{165, 90},  C{165, 165}, C{90, 165},  C{128, 71},  C{184, 128}, C{128, 184},
-    C{71, 128},  C{71, 109},  C{109, 71},  C{146, 71},  C{184, 109}, C{184, 146}, C{146, 184},
-    C{109, 184}, C{71, 146},  C{72, 90},   C{90, 72},   C{165, 72},  C{183, 90},  C{183, 165},
-    C{165, 183}, C{90, 183},  C{72, 165},  C{73, 73},   C{182, 73},  C{182, 182}, C{73, 182}};
-
-static_assert(k_offset.size() == n_illuminations);
-
 Mat<uint8_t>
 stretchContrast(fmat input) {
     const float vmin = input.min();
@@ -59,7 +46,12 @@ stretchContrast(fmat input) {
 
 SCENARIO("Can run EPRY algorithm smoothly") {
     GIVEN("Raw data") {
-        auto [raw, pupil] = []() -> std::pair<storage::u8_cube_t, ComplexBuffer> {
+        // Structured bindings cannot be captured by lambdas in C++17.
+        std::vector<size_t> frame_id;
+        Mat<int32_t> k_offset_buffer;
+        std::tie(frame_id, k_offset_buffer) = scheduleIlluminations();
+
+        auto [raw, pupil] = [&]() -> std::pair<storage::u8_cube_t, ComplexBuffer> {
             // Mount HDF5 file
             auto file = File(filename, File::ReadOnly);
 
@@ -69,8 +61,8 @@ SCENARIO("Can run EPRY algorithm smoothly") {
             // Read raw low resolution images at the center of the camera view.
             const storage::roi_t center_roi{2592 / 2 - tile_size / 2, 1944 / 2 - tile_size / 2,
                                             tile_size};
-            auto raw = storage::readFPMRaw(file.getDataSet("imlow"), well_id, center_roi,
-                                           getGenericFrameId());
+            auto raw =
+                storage::readFPMRaw(file.getDataSet("imlow"), well_id, center_roi, frame_id);
 
             {
                 Cube<uint8_t> raw_buffer{raw.data(),      tile_size, tile_size,
@@ -94,8 +86,6 @@ SCENARIO("Can run EPRY algorithm smoothly") {
             return {raw, pupil};
         }();
 
-        Mat<int32_t> k_offset_buffer{&(k_offset.front().kx), 2, n_illuminations};
-
         WHEN("Initialize FPMEpryRunner") {
             reconstruction::FPMEpryRunner runner{std::move(k_offset_buffer), std::move(pupil),
                                                  std::move(raw)};
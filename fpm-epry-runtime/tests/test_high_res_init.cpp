@@ -5,7 +5,7 @@
 #include <catch2/matchers/catch_matchers_floating_point.hpp>
 
 #include "constants.hpp"
-#include "high_res_init.h"
+#include "high_res_init_w256.h"
 
 using namespace arma;
 using Halide::Runtime::Buffer;
@@ -22,14 +22,14 @@ SCENARIO("Zeropadded FFT is valid", "[high_res_init]") {
         fcube low_res(T, T, n_illuminations, fill::ones);
 
         WHEN("Compute forward FFT") {
-            Buffer<float, 3> low_res_buffer{low_res.memptr(), T, T, n_illuminations};
-            Buffer<float, 3> f_high_res{T2, T2, 2};
+            Buffer<float, 4> low_res_buffer{low_res.memptr(), T, T, n_illuminations, 1};
+            Buffer<float, 4> f_high_res{T2, T2, 2, 1};
 
             // Fill impossible values.
             f_high_res.fill(datum::nan);
 
             low_res_buffer.set_host_dirty();
-            const auto has_error = high_res_init(low_res_buffer, f_high_res);
+            const auto has_error = high_res_init_w256(low_res_buffer, f_high_res);
             REQUIRE(has_error == 0);
             f_high_res.copy_to_host();
 
@@ -3,9 +3,12 @@
 
 #include <mpi.h>
 
+#include <algorithm>
 #include <array>
+#include <cassert>
 #include <complex>
 #include <cstdint>
+#include <iostream>
 #include <memory>
 #include <string>
 #include <vector>
@@ -21,23 +24,155 @@ const int FPM_HDF5_NDIMS = 4;
 
 template <class Integer, class Float>
 class FPM_datafile final : private HighFive::File {
+   public:
+    /** Top-left corner (row, col) of a tile. */
+    using origin_t = std::array<size_t, 2>;
+
+   private:
     std::array<size_t, FPM_HDF5_NDIMS> block;
     std::array<size_t, FPM_HDF5_NDIMS> count;
 
-    std::vector<Integer> imseqlow_buffer;
-    std::vector<std::complex<Float>> himr_buffer;
+    /** Two slots of buffers: in streaming mode, one window is transferred
+     * while the other one is computed. Each slot holds max_batch tiles. */
+    std::array<std::vector<Integer>, 2> imseqlow_buffer;
+    std::array<std::vector<std::complex<Float>>, 2> himr_buffer;
+
+    /** Buffer slot of the following transfers, see set_window(). */
+    size_t slot{0};
+    size_t n_slots{1};
+
+    /** Capacity of the buffer slots in tiles, see read_images(). */
+    size_t max_batch{1};
 
     HighFive::DataSet imseqlow, himr;
 
+    /** Handles of the pupil datasets, opened once; negative if absent. */
+    hid_t initial_pupil, corrected_pupil;
+
+    const HighFive::AtomicType<Integer> integer_type;
+    const HighFive::AtomicType<std::complex<Float>> complex_type;
+
+    /** Index of the first well of the current window, see set_window(). */
+    size_t well_offset{0};
+
+    /** Wells of the rank, split into windows of window_wells each. */
+    size_t rank_first_well{0};
+    size_t rank_wells{0};
+    size_t window_wells{0};
+
+    MPI_Comm comm;
+
+    /** Dataset transfer property list for the collective MPI-IO calls. */
+    hid_t collective_xfer;
+
+    /** A reusable transfer of one block. The hyperslab is selected once, at
+     * the origin of the file dataspace, and moved with H5Soffset_simple(). */
+    struct selection_t {
+        hid_t file_space{-1};
+        hid_t mem_space{-1};
+    };
+
+    selection_t image_selection, phase_selection, layers_selection, pupil_selection;
+
+    /** One layer of "corrected_pupil", in the dataspace of that dataset. */
+    selection_t local_pupil_selection;
+
+    /** Scratch for the bounding box of the batch transfers, of the size of
+     * one buffer slot. Empty if max_batch is one. */
+    std::vector<Integer> batch_read_buffer;
+    std::vector<std::complex<Float>> batch_write_buffer;
+
+    /** Size the buffer slots, and the scratch, to max_batch tiles of the
+     * block. */
+    void allocate(size_t max_batch);
+
+    /** (Re)select the block at the origin of the dataset. */
+    void select(selection_t& selection, hid_t dataset, const std::vector<size_t>& _block);
+    void close(selection_t& selection);
+
+    /** Rebuild all the selections from the block dimensions. */
+    void selectBlock();
+
+    /** Collective read or write of the selected block at the offset. Every
+     * rank of the communicator must call it, even with empty blocks.
+     *
+     * @throw HighFive::DataSetException if the transfer fails, as do all
+     *     the read and write methods.
+     */
+    template <typename T, size_t N>
+    void transfer(const selection_t& selection, hid_t dataset, hid_t mem_type,
+                  const std::array<hssize_t, N>& offset, T* buffer, bool is_write);
+
+    /** @return the bounding box (top, left, height, width) of the tiles. */
+    std::array<size_t, 4> boundingBox(const origin_t* first, const origin_t* last) const;
+
+    /** Split the tiles into consecutive groups, each with a bounding box of
+     * at most max_batch tiles, i.e. within the scratch.
+     * @return the [first, last) index ranges of the groups
+     */
+    std::vector<std::pair<size_t, size_t>> splitBatch(const std::vector<origin_t>& origins) const;
+
+    /** Select the tiles in the file, and at the same relative positions in
+     * their bounding box in memory. HDF5 visits both selections in the same
+     * order.
+     * @return the file and the memory dataspaces, and the bounding box
+     *     (top, left, height, width).
+     */
+    std::pair<selection_t, std::array<size_t, 4>> selectBatch(hid_t dataset, size_t layer,
+                                                              size_t n_layers,
+                                                              const origin_t* first,
+                                                              const origin_t* last);
+
    public:
     FPM_datafile(const char filename[], MPI_Comm& comm, MPI_Info& info);
     ~FPM_datafile();
 
+    FPM_datafile(const FPM_datafile&) = delete;
+    FPM_datafile& operator=(const FPM_datafile&) = delete;
+
     std::vector<Integer>& get_read_buffer();
 
     std::vector<std::complex<Float>>& get_write_buffer();
 
-    void set_block_dims(size_t number_of_incidences, size_t height, size_t width, size_t wells);
+    /** Set the dimensions of the read and write buffers.
+     * @param[in] wells number of wells of the block, possibly zero
+     * @param[in] first_well index of the first well of the block, e.g. the
+     *     wells assigned to this MPI rank
+     * @param[in] max_batch number of tiles of the batch transfers, see
+     *     read_images(); the buffers hold max_batch blocks
+     */
+    void set_block_dims(size_t number_of_incidences, size_t height, size_t width, size_t wells,
+                        size_t first_well = 0, size_t max_batch = 1);
+
+    /** Streaming mode: split the wells into windows, such that two windows of
+     * read and write buffers fit in the memory budget. The transfers then
+     * apply to the window selected by set_window().
+     *
+     * Collective call.
+     *
+     * @param[in] max_bytes memory budget of the buffers, including the
+     *     scratch of the batch transfers; one window of all the wells if zero
+     * @param[in] max_batch number of tiles of the batch transfers
+     * @return the number of windows, the same on all ranks. The ranks with
+     *     fewer windows transfer empty blocks.
+     */
+    size_t set_stream_dims(size_t number_of_incidences, size_t height, size_t width, size_t wells,
+                           size_t first_well, size_t max_bytes, size_t max_batch = 1);
+
+    /** Select the window and the buffer slot of the following transfers.
+     *
+     * The slot is independent of the window: alternate the slot per job, e.g.
+     * job % 2, such that the caller computes on the buffers of one job while
+     * reading the next one, even across tiles or with a single window.
+     *
+     * @param[in] slot 0 or 1; only 0 after set_block_dims()
+     */
+    void set_window(size_t window, size_t slot);
+
+    /** @return the first well of the current window, relative to the first
+     *     well of the rank, and the number of wells of the window.
+     */
+    std::pair<size_t, size_t> get_window() const;
 
     void read_pupil();
     void write_pupil();
@@ -55,6 +190,25 @@ class FPM_datafile final : private HighFive::File {
     void read_phase_image(size_t row, size_t col, std::vector<std::complex<Float>>& buffer);
     void write_phase_image(size_t layer, size_t row, size_t col);
     void write_local_pupil(size_t layer, size_t row, size_t col);
+
+    /** Read up to max_batch tiles through their bounding box, in one HDF5
+     * call per group of tiles close to each other, e.g. a row of tiles.
+     *
+     * The bounding box of a group is at most max_batch tiles large, so that
+     * the transfers stay within the memory budget. Far apart tiles are split
+     * into several groups. Collective call: the ranks pass the same origins,
+     * and hence make the same number of HDF5 calls.
+     *
+     * The tiles are stored in the read buffer one after the other, each with
+     * the dimensions of set_block_dims(). The buffer is not resized.
+     */
+    void read_images(const std::vector<origin_t>& origins);
+
+    /** Write up to max_batch tiles from the write buffer, stored one after
+     * the other, as in read_images(). The tiles must not overlap, e.g. the
+     * tiles of the same layer.
+     */
+    void write_phase_images(size_t layer, const std::vector<origin_t>& origins);
 };
 
 #include "FPM_datafile_impl.hpp"
@@ -2,59 +2,251 @@
 
 using namespace HighFive;
 
+namespace fpm_datafile {
+
+/** Open the dataset if it exists. @return negative otherwise. */
+inline hid_t
+openIfExists(hid_t file, const char* name) {
+    if (H5Lexists(file, name, H5P_DEFAULT) <= 0) {
+        return -1;
+    }
+    return H5Dopen2(file, name, H5P_DEFAULT);
+}
+
+inline bool
+isEmpty(const std::vector<size_t>& block) {
+    return std::find(block.begin(), block.end(), 0) != block.end();
+}
+
+/** Throw with the HDF5 error stack, as HighFive does. The other ranks of the
+ * collective call may block; an uncaught exception aborts the MPI job. */
+inline void
+checkTransfer(herr_t status) {
+    if (status < 0) {
+        HDF5ErrMapper::ToException<DataSetException>("Collective HDF5 transfer failed: ");
+    }
+}
+
+}  // namespace fpm_datafile
+
 template <class Integer, class Float>
 FPM_datafile<Integer, Float>::FPM_datafile(const char filename[], MPI_Comm& comm, MPI_Info& info)
     : File(filename, File::ReadWrite, MPIOFileDriver(comm, info)),
       imseqlow(getDataSet("imlow")),
-      himr(getDataSet("himr")) {
-    // for (int i = 0; i < FPM_HDF5_NDIMS; i++)
-    //  {
-    //    count[i] = 1;
-    //    stride[i] = 1;
-    //  }
+      himr(getDataSet("himr")),
+      initial_pupil(fpm_datafile::openIfExists(getId(), "initial_pupil")),
+      corrected_pupil(fpm_datafile::openIfExists(getId(), "corrected_pupil")),
+      comm(comm),
+      collective_xfer(H5Pcreate(H5P_DATASET_XFER)) {
+    H5Pset_dxpl_mpio(collective_xfer, H5FD_MPIO_COLLECTIVE);
     count.fill(1);
 }
 
 template <class Integer, class Float>
-FPM_datafile<Integer, Float>::~FPM_datafile() {}
+FPM_datafile<Integer, Float>::~FPM_datafile() {
+    for (auto* selection : {&image_selection, &phase_selection, &layers_selection,
+                            &pupil_selection, &local_pupil_selection}) {
+        close(*selection);
+    }
+    for (const hid_t dataset : {initial_pupil, corrected_pupil}) {
+        if (dataset >= 0) {
+            H5Dclose(dataset);
+        }
+    }
+    H5Pclose(collective_xfer);
+}
+
+template <class Integer, class Float>
+void
+FPM_datafile<Integer, Float>::close(selection_t& selection) {
+    for (hid_t* space : {&selection.file_space, &selection.mem_space}) {
+        if (*space >= 0) {
+            H5Sclose(*space);
+            *space = -1;
+        }
+    }
+}
+
+template <class Integer, class Float>
+void
+FPM_datafile<Integer, Float>::select(selection_t& selection, hid_t dataset,
+                                     const std::vector<size_t>& _block) {
+    close(selection);
+    if (dataset < 0) {
+        return;
+    }
+
+    const std::vector<hsize_t> start(_block.size(), 0);
+    const std::vector<hsize_t> extent(_block.begin(), _block.end());
+
+    selection.file_space = H5Dget_space(dataset);
+    selection.mem_space = H5Screate_simple(extent.size(), extent.data(), nullptr);
+    if (fpm_datafile::isEmpty(_block)) {
+        // Ranks without wells still take part in the collective calls.
+        H5Sselect_none(selection.file_space);
+        H5Sselect_none(selection.mem_space);
+    } else {
+        H5Sselect_hyperslab(selection.file_space, H5S_SELECT_SET, start.data(), nullptr,
+                            extent.data(), nullptr);
+    }
+}
+
+template <class Integer, class Float>
+template <typename T, size_t N>
+void
+FPM_datafile<Integer, Float>::transfer(const selection_t& selection, hid_t dataset,
+                                       hid_t mem_type, const std::array<hssize_t, N>& offset,
+                                       T* buffer, bool is_write) {
+    assert(selection.file_space >= 0 && "Call set_block_dims() first");
+    assert(H5Sget_simple_extent_ndims(selection.file_space) == int(N));
+    H5Soffset_simple(selection.file_space, offset.data());
+
+    const herr_t status =
+        is_write ? H5Dwrite(dataset, mem_type, selection.mem_space, selection.file_space,
+                            collective_xfer, buffer)
+                 : H5Dread(dataset, mem_type, selection.mem_space, selection.file_space,
+                           collective_xfer, buffer);
+    fpm_datafile::checkTransfer(status);
+}
 
 template <class Integer, class Float>
 std::vector<Integer>&
 FPM_datafile<Integer, Float>::get_read_buffer() {
-    return imseqlow_buffer;
+    return imseqlow_buffer[slot];
 }
 
 template <class Integer, class Float>
 std::vector<std::complex<Float>>&
 FPM_datafile<Integer, Float>::get_write_buffer() {
-    return himr_buffer;
+    return himr_buffer[slot];
 }
 
 template <class Integer, class Float>
 void
 FPM_datafile<Integer, Float>::set_block_dims(size_t number_of_incidences, size_t height,
-                                             size_t width, size_t wells) {
+                                             size_t width, size_t wells, size_t first_well,
+                                             size_t _max_batch) {
     block = {number_of_incidences, wells, height, width};
+    well_offset = first_well;
+    rank_first_well = first_well;
+    rank_wells = wells;
+    window_wells = wells;
+    slot = 0;
+    n_slots = 1;
 
-    const size_t length = block[0] * block[1] * block[2] * block[3];
-    imseqlow_buffer.resize(length);
-    himr_buffer.resize(length / number_of_incidences);
+    // Single window: release the second slot.
+    imseqlow_buffer[1] = {};
+    himr_buffer[1] = {};
+    allocate(_max_batch);
+
+    selectBlock();
+}
+
+template <class Integer, class Float>
+void
+FPM_datafile<Integer, Float>::allocate(size_t _max_batch) {
+    assert(_max_batch > 0);
+    max_batch = _max_batch;
+
+    const size_t length = max_batch * block[0] * block[1] * block[2] * block[3];
+    for (size_t i = 0; i < n_slots; i++) {
+        imseqlow_buffer[i].resize(length);
+        himr_buffer[i].resize(length / block[0]);
+    }
+
+    // A single tile is transferred in place, without the scratch.
+    if (max_batch > 1) {
+        batch_read_buffer.resize(length);
+        batch_write_buffer.resize(length / block[0]);
+    } else {
+        batch_read_buffer = {};
+        batch_write_buffer = {};
+    }
+}
+
+template <class Integer, class Float>
+size_t
+FPM_datafile<Integer, Float>::set_stream_dims(size_t number_of_incidences, size_t height,
+                                              size_t width, size_t wells, size_t first_well,
+                                              size_t max_bytes, size_t _max_batch) {
+    // Two slots of max_batch tiles, and the scratch of the bounding boxes.
+    const size_t n_buffers = _max_batch > 1 ? 3 : 2;
+    const size_t well_bytes = n_buffers * _max_batch * height * width *
+                              (number_of_incidences * sizeof(Integer) + sizeof(std::complex<Float>));
+
+    window_wells = wells;
+    if (max_bytes > 0) {
+        window_wells = std::min(wells, max_bytes / well_bytes);
+        if (window_wells == 0 && wells > 0) {
+            std::cerr << "Warning: memory budget of " << max_bytes << " bytes is below "
+                      << well_bytes << " bytes for one well; streaming one well at a time\n";
+            window_wells = 1;
+        }
+    }
+
+    block = {number_of_incidences, window_wells, height, width};
+    rank_first_well = first_well;
+    rank_wells = wells;
+
+    n_slots = 2;
+    allocate(_max_batch);
+    selectBlock();
+    set_window(0, 0);
+
+    unsigned long n_windows = window_wells ? (wells + window_wells - 1) / window_wells : 0;
+    MPI_Allreduce(MPI_IN_PLACE, &n_windows, 1, MPI_UNSIGNED_LONG, MPI_MAX, comm);
+    return n_windows;
+}
+
+template <class Integer, class Float>
+void
+FPM_datafile<Integer, Float>::set_window(size_t window, size_t buffer_slot) {
+    assert(buffer_slot < n_slots && "Two buffer slots in streaming mode only");
+    slot = buffer_slot;
+
+    const size_t begin = std::min(window * window_wells, rank_wells);
+    const size_t n = std::min(window_wells, rank_wells - begin);
+    well_offset = rank_first_well + begin;
+
+    // Only the last window of the rank may be narrower.
+    if (n != block[1]) {
+        block[1] = n;
+        selectBlock();
+    }
+}
+
+template <class Integer, class Float>
+std::pair<size_t, size_t>
+FPM_datafile<Integer, Float>::get_window() const {
+    return {well_offset - rank_first_well, block[1]};
+}
+
+template <class Integer, class Float>
+void
+FPM_datafile<Integer, Float>::selectBlock() {
+    select(image_selection, imseqlow.getId(), {block[0], block[1], block[2], block[3]});
+    select(phase_selection, himr.getId(), {1, block[1], block[2], block[3]});
+    select(layers_selection, himr.getId(), {4, block[1], block[2], block[3]});
+    select(pupil_selection, initial_pupil, {block[1], block[2], block[3]});
+    select(local_pupil_selection, corrected_pupil, {1, block[1], block[2], block[3]});
 }
 
 template <class Integer, class Float>
 void
 FPM_datafile<Integer, Float>::read_pupil() {
-    getDataSet("initial_pupil")
-        .select({0, 0, 0}, {block[1], block[2], block[3]})
-        .read(himr_buffer.data());
+    assert(initial_pupil >= 0 && "No initial_pupil dataset");
+    const std::array<hssize_t, 3> offset{hssize_t(well_offset), 0, 0};
+    transfer(pupil_selection, initial_pupil, complex_type.getId(), offset, himr_buffer[slot].data(),
+             false);
 }
 
 template <class Integer, class Float>
 void
 FPM_datafile<Integer, Float>::write_pupil() {
-    getDataSet("initial_pupil")
-        .select({0, 0, 0}, {block[1], block[2], block[3]})
-        .write_raw(himr_buffer.data());
+    assert(initial_pupil >= 0 && "No initial_pupil dataset");
+    const std::array<hssize_t, 3> offset{hssize_t(well_offset), 0, 0};
+    transfer(pupil_selection, initial_pupil, complex_type.getId(), offset, himr_buffer[slot].data(),
+             true);
 }
 
 template <class Integer, class Float>
@@ -85,44 +277,195 @@ template <class Integer, class Float>
 void
 FPM_datafile<Integer, Float>::read_image(size_t row, size_t col) {
     ////TODO: Allow tile overlapping
-    const std::vector<size_t> offset{0, 0, row, col};
-    const std::vector<size_t> _block(block.begin(), block.end());
-    // offset[0] = 0;
-    // offset[1] = 0;
-
-    // offset[2] = block[2] * row_id;
-    // offset[3] = block[3] * col_id;
-
-    // imseqlow->access (imseqlow_buffer, offset, stride, count, block, 'r', imseqlow_memspace);
-    imseqlow.select(offset, _block).read(imseqlow_buffer.data());
+    const std::array<hssize_t, 4> offset{0, hssize_t(well_offset), hssize_t(row), hssize_t(col)};
+    transfer(image_selection, imseqlow.getId(), integer_type.getId(), offset,
+             imseqlow_buffer[slot].data(), false);
 }
 
 template <class Integer, class Float>
 void
 FPM_datafile<Integer, Float>::read_phase_image(size_t row, size_t col,
                                                std::vector<std::complex<Float>>& buffer) {
-    const std::vector<size_t> offset{0, 0, row, col};
-    const std::vector<size_t> _block{4, block[1], block[2], block[3]};
-
-    himr.select(offset, _block).read(buffer.data());
+    assert(buffer.size() >= 4 * block[1] * block[2] * block[3]);
+    const std::array<hssize_t, 4> offset{0, hssize_t(well_offset), hssize_t(row), hssize_t(col)};
+    transfer(layers_selection, himr.getId(), complex_type.getId(), offset, buffer.data(), false);
 }
 
 template <class Integer, class Float>
 void
 FPM_datafile<Integer, Float>::write_phase_image(size_t layer, size_t row, size_t col) {
-    const std::vector<size_t> offset{layer, 0, row, col};
-    const std::vector<size_t> _block{1, block[1], block[2], block[3]};
-
-    himr.select(offset, _block).write_raw(himr_buffer.data());
+    const std::array<hssize_t, 4> offset{hssize_t(layer), hssize_t(well_offset), hssize_t(row),
+                                         hssize_t(col)};
+    transfer(phase_selection, himr.getId(), complex_type.getId(), offset, himr_buffer[slot].data(),
+             true);
 }
 
 template <class Integer, class Float>
 void
 FPM_datafile<Integer, Float>::write_local_pupil(size_t layer, size_t row, size_t col) {
-    const std::vector<size_t> offset{layer, 0, row, col};
-    const std::vector<size_t> _block{1, block[1], block[2], block[3]};
+    assert(corrected_pupil >= 0 && "No corrected_pupil dataset");
+    const std::array<hssize_t, 4> offset{hssize_t(layer), hssize_t(well_offset), hssize_t(row),
+                                         hssize_t(col)};
+    transfer(local_pupil_selection, corrected_pupil, complex_type.getId(), offset,
+             himr_buffer[slot].data(), true);
+}
+
+template <class Integer, class Float>
+std::array<size_t, 4>
+FPM_datafile<Integer, Float>::boundingBox(const origin_t* first, const origin_t* last) const {
+    assert(first != last);
+    size_t top = (*first)[0];
+    size_t left = (*first)[1];
+    size_t bottom = 0;
+    size_t right = 0;
+    for (auto it = first; it != last; ++it) {
+        const auto& [row, col] = *it;
+        top = std::min(top, row);
+        left = std::min(left, col);
+        bottom = std::max(bottom, row + block[2]);
+        right = std::max(right, col + block[3]);
+    }
+    return {top, left, bottom - top, right - left};
+}
+
+template <class Integer, class Float>
+std::vector<std::pair<size_t, size_t>>
+FPM_datafile<Integer, Float>::splitBatch(const std::vector<origin_t>& origins) const {
+    assert(origins.size() <= max_batch && "Batch larger than the max_batch of set_block_dims()");
+    const size_t budget = max_batch * block[2] * block[3];
+
+    // Greedy: extend the group while its bounding box fits the scratch.
+    std::vector<std::pair<size_t, size_t>> groups;
+    size_t first = 0;
+    for (size_t next = 1; next < origins.size(); next++) {
+        const auto box = boundingBox(origins.data() + first, origins.data() + next + 1);
+        if (box[2] * box[3] > budget) {
+            groups.emplace_back(first, next);
+            first = next;
+        }
+    }
+    if (!origins.empty()) {
+        groups.emplace_back(first, origins.size());
+    }
+    return groups;
+}
+
+template <class Integer, class Float>
+std::pair<typename FPM_datafile<Integer, Float>::selection_t, std::array<size_t, 4>>
+FPM_datafile<Integer, Float>::selectBatch(hid_t dataset, size_t layer, size_t n_layers,
+                                          const origin_t* first, const origin_t* last) {
+    const size_t height = block[2];
+    const size_t width = block[3];
+    const auto box = boundingBox(first, last);
+    const size_t top = box[0];
+    const size_t left = box[1];
+
+    const std::array<hsize_t, 4> mem_dims{n_layers, block[1], box[2], box[3]};
+    const std::array<hsize_t, 4> extent{n_layers, block[1], height, width};
+
+    selection_t selection{H5Dget_space(dataset), H5Screate_simple(4, mem_dims.data(), nullptr)};
+    H5Sselect_none(selection.file_space);
+    H5Sselect_none(selection.mem_space);
+    if (block[1] > 0) {
+        for (auto it = first; it != last; ++it) {
+            const auto& [row, col] = *it;
+            const std::array<hsize_t, 4> file_start{layer, well_offset, row, col};
+            const std::array<hsize_t, 4> mem_start{0, 0, row - top, col - left};
+            H5Sselect_hyperslab(selection.file_space, H5S_SELECT_OR, file_start.data(), nullptr,
+                                extent.data(), nullptr);
+            H5Sselect_hyperslab(selection.mem_space, H5S_SELECT_OR, mem_start.data(), nullptr,
+                                extent.data(), nullptr);
+        }
+    }
+
+    return {selection, box};
+}
+
+template <class Integer, class Float>
+void
+FPM_datafile<Integer, Float>::read_images(const std::vector<origin_t>& origins) {
+    const size_t height = block[2];
+    const size_t width = block[3];
+    const size_t n_planes = block[0] * block[1];
+    const size_t tile_length = n_planes * height * width;
+    auto& packed = imseqlow_buffer[slot];
+
+    for (const auto& [first, last] : splitBatch(origins)) {
+        auto [selection, box] =
+            selectBatch(imseqlow.getId(), 0, block[0], origins.data() + first,
+                        origins.data() + last);
+
+        // A single tile is read in place.
+        const bool is_single = last - first == 1;
+        auto* buffer = is_single ? packed.data() + first * tile_length : batch_read_buffer.data();
+        const herr_t status = H5Dread(imseqlow.getId(), integer_type.getId(), selection.mem_space,
+                                      selection.file_space, collective_xfer, buffer);
+        close(selection);
+        fpm_datafile::checkTransfer(status);
+        if (is_single) {
+            continue;
+        }
+
+        // Unpack the tiles from the bounding box.
+        for (size_t i = first; i < last; i++) {
+            const auto& [row, col] = origins[i];
+            for (size_t p = 0; p < n_planes; p++) {
+                for (size_t y = 0; y < height; y++) {
+                    const auto* src = batch_read_buffer.data() +
+                                      (p * box[2] + row - box[0] + y) * box[3] + (col - box[1]);
+                    std::copy_n(src, width,
+                                packed.data() + i * tile_length + (p * height + y) * width);
+                }
+            }
+        }
+    }
+}
+
+template <class Integer, class Float>
+void
+FPM_datafile<Integer, Float>::write_phase_images(size_t layer,
+                                                 const std::vector<origin_t>& origins) {
+    const size_t height = block[2];
+    const size_t width = block[3];
+    for (size_t i = 0; i < origins.size(); i++) {
+        for (size_t j = 0; j < i; j++) {
+            const bool is_disjoint = origins[i][0] + height <= origins[j][0] ||
+                                     origins[j][0] + height <= origins[i][0] ||
+                                     origins[i][1] + width <= origins[j][1] ||
+                                     origins[j][1] + width <= origins[i][1];
+            assert(is_disjoint && "Overlapping tiles");
+        }
+    }
+
+    const size_t tile_length = block[1] * height * width;
+    const auto& packed = himr_buffer[slot];
+
+    for (const auto& [first, last] : splitBatch(origins)) {
+        auto [selection, box] =
+            selectBatch(himr.getId(), layer, 1, origins.data() + first, origins.data() + last);
+
+        // A single tile is written in place.
+        const bool is_single = last - first == 1;
+        const auto* buffer =
+            is_single ? packed.data() + first * tile_length : batch_write_buffer.data();
+
+        // Pack the tiles into the bounding box.
+        for (size_t i = first; i < last && !is_single; i++) {
+            const auto& [row, col] = origins[i];
+            for (size_t p = 0; p < block[1]; p++) {
+                for (size_t y = 0; y < height; y++) {
+                    std::copy_n(packed.data() + i * tile_length + (p * height + y) * width, width,
+                                batch_write_buffer.data() +
+                                    (p * box[2] + row - box[0] + y) * box[3] + (col - box[1]));
+                }
+            }
+        }
 
-    getDataSet("corrected_pupil").select(offset, _block).write_raw(himr_buffer.data());
+        const herr_t status = H5Dwrite(himr.getId(), complex_type.getId(), selection.mem_space,
+                                       selection.file_space, collective_xfer, buffer);
+        close(selection);
+        fpm_datafile::checkTransfer(status);
+    }
 }
 
 // template class FPM_datafile<uint16_t>;
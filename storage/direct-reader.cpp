@@ -0,0 +1,181 @@
+#include "direct-reader.h"
+
+#include <fcntl.h>
+#include <hdf5.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace {
+
+/** @return false if HDF5 has to convert or decode the data. */
+bool
+isRawLayout(hid_t dataset, hid_t dcpl) {
+    const hid_t type = H5Dget_type(dataset);
+    const hid_t native = H5Tget_native_type(type, H5T_DIR_ASCEND);
+    const bool is_native = H5Tequal(type, native) > 0;
+    H5Tclose(native);
+    H5Tclose(type);
+
+    return is_native && H5Pget_nfilters(dcpl) == 0;
+}
+
+}  // namespace
+
+namespace storage {
+
+DirectReader::DirectReader(const HighFive::File& file, const std::string& name) {
+    const hid_t dataset = H5Dopen2(file.getId(), name.c_str(), H5P_DEFAULT);
+    assert(dataset >= 0);
+    const hid_t dcpl = H5Dget_create_plist(dataset);
+    const hid_t space = H5Dget_space(dataset);
+    const hid_t type = H5Dget_type(dataset);
+    element_size = H5Tget_size(type);
+    H5Tclose(type);
+
+    assert(H5Sget_simple_extent_ndims(space) == 4);
+    std::array<hsize_t, 4> h5_dims{};
+    H5Sget_simple_extent_dims(space, h5_dims.data(), nullptr);
+    std::copy(h5_dims.begin(), h5_dims.end(), dims.begin());
+    H5Sclose(space);
+
+    const auto layout = H5Pget_layout(dcpl);
+    bool supported = isRawLayout(dataset, dcpl);
+    if (supported && layout == H5D_CONTIGUOUS) {
+        chunk = dims;
+        const haddr_t address = H5Dget_offset(dataset);
+        supported = address != HADDR_UNDEF;
+        offset.assign(1, address);
+    } else if (supported && layout == H5D_CHUNKED) {
+        std::array<hsize_t, 4> h5_chunk{};
+        H5Pget_chunk(dcpl, 4, h5_chunk.data());
+        std::copy(h5_chunk.begin(), h5_chunk.end(), chunk.begin());
+
+        dims_t grid{};
+        for (size_t d = 0; d < 4; d++) {
+            grid[d] = (dims[d] + chunk[d] - 1) / chunk[d];
+        }
+        offset.assign(grid[0] * grid[1] * grid[2] * grid[3], unallocated);
+
+        // Lookup by coordinates is logarithmic in the number of chunks, unlike
+        // H5Dget_chunk_info() by index.
+        size_t i = 0;
+        std::array<hsize_t, 4> coord{};
+        for (size_t c0 = 0; c0 < grid[0]; c0++) {
+            for (size_t c1 = 0; c1 < grid[1]; c1++) {
+                for (size_t c2 = 0; c2 < grid[2]; c2++) {
+                    for (size_t c3 = 0; c3 < grid[3]; c3++, i++) {
+                        coord = {c0 * chunk[0], c1 * chunk[1], c2 * chunk[2], c3 * chunk[3]};
+                        unsigned filter_mask{};
+                        haddr_t address{HADDR_UNDEF};
+                        hsize_t size{};
+                        H5Dget_chunk_info_by_coord(dataset, coord.data(), &filter_mask, &address,
+                                                   &size);
+                        if (address != HADDR_UNDEF) {
+                            offset[i] = address;
+                        }
+                    }
+                }
+            }
+        }
+    } else {
+        supported = false;
+    }
+
+    H5Pclose(dcpl);
+    H5Dclose(dataset);
+
+    if (!supported) {
+        return;
+    }
+
+    const int fd = ::open(file.getName().c_str(), O_RDONLY);
+    struct stat st {};
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return;
+    }
+
+    file_size = st.st_size;
+    void* ptr = ::mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (ptr != MAP_FAILED) {
+        base = static_cast<const uint8_t*>(ptr);
+    }
+}
+
+DirectReader::~DirectReader() {
+    if (base != nullptr) {
+        ::munmap(const_cast<uint8_t*>(base), file_size);
+    }
+}
+
+void
+DirectReader::read(const dims_t& start, const dims_t& count, void* out) const {
+    assert(base != nullptr);
+    for (size_t d = 0; d < 4; d++) {
+        assert(start[d] + count[d] <= dims[d]);
+    }
+
+    const size_t n_chunks_x = (dims[3] + chunk[3] - 1) / chunk[3];
+    const size_t n_chunks_y = (dims[2] + chunk[2] - 1) / chunk[2];
+    const size_t n_chunks_w = (dims[1] + chunk[1] - 1) / chunk[1];
+
+    auto* dst = static_cast<uint8_t*>(out);
+    for (size_t i0 = start[0]; i0 < start[0] + count[0]; i0++) {
+        for (size_t i1 = start[1]; i1 < start[1] + count[1]; i1++) {
+            for (size_t y = start[2]; y < start[2] + count[2]; y++) {
+                // Copy the row, one chunk at a time.
+                size_t x = start[3];
+                while (x < start[3] + count[3]) {
+                    const size_t chunk_id =
+                        ((i0 / chunk[0] * n_chunks_w + i1 / chunk[1]) * n_chunks_y +
+                         y / chunk[2]) *
+                            n_chunks_x +
+                        x / chunk[3];
+                    const size_t within =
+                        ((i0 % chunk[0] * chunk[1] + i1 % chunk[1]) * chunk[2] + y % chunk[2]) *
+                            chunk[3] +
+                        x % chunk[3];
+                    const size_t n =
+                        std::min(start[3] + count[3] - x, chunk[3] - x % chunk[3]) * element_size;
+
+                    const uint64_t address = offset[chunk_id];
+                    if (address == unallocated) {
+                        std::memset(dst, 0, n);
+                    } else {
+                        assert(address + (within * element_size) + n <= file_size);
+                        std::memcpy(dst, base + address + within * element_size, n);
+                    }
+
+                    dst += n;
+                    x += n / element_size;
+                }
+            }
+        }
+    }
+}
+
+void
+DirectReader::readFPMRaw(size_t well_id, roi_t roi, const std::vector<size_t>& frame_id,
+                         u8_cube_t& out) const {
+    const auto W = roi.width;
+    assert(element_size == sizeof(uint8_t));
+    assert(out.width() == int(W) && out.height() == int(W));
+    assert(out.dim(2).extent() >= int(frame_id.size()));
+    assert(out.is_contiguous());
+
+    auto* ptr = out.data();
+    for (const auto id : frame_id) {
+        read({id, well_id, roi.top, roi.left}, {1, 1, W, W}, ptr);
+        ptr += W * W;
+    }
+}
+
+}  // namespace storage
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <highfive/H5File.hpp>
+#include <string>
+#include <vector>
+
+#include "read-slice.h"
+
+namespace storage {
+
+/** Read a 4D dataset (frame, well, height, width) from the memory-mapped file,
+ * bypassing the HDF5 library.
+ *
+ * The file offsets of the contiguous storage, or of every chunk, are resolved
+ * once at construction. The reads are plain memory copies; they neither take
+ * the HDF5 global lock nor a file mutex, so that concurrent readers scale.
+ *
+ * Only the unfiltered (i.e. uncompressed) datasets, stored in the native byte
+ * order, are supported. The dataset must not be written to while mapped.
+ */
+class DirectReader {
+   public:
+    using dims_t = std::array<size_t, 4>;
+
+    DirectReader(const HighFive::File& file, const std::string& name);
+    ~DirectReader();
+
+    DirectReader(const DirectReader&) = delete;
+    DirectReader& operator=(const DirectReader&) = delete;
+
+    /** False if the dataset layout is unsupported; use the HDF5 reader instead. */
+    explicit operator bool() const { return base != nullptr; }
+
+    /** Read the hyperslab [start, start + count) in row-major order. */
+    void read(const dims_t& start, const dims_t& count, void* out) const;
+
+    /** Same as storage::readFPMRaw(), into a caller-owned buffer.
+     * @param[out] out destination, dimensions (roi.width, roi.width, >= frame_id.size())
+     */
+    void readFPMRaw(size_t well_id, roi_t roi, const std::vector<size_t>& frame_id,
+                    u8_cube_t& out) const;
+
+   private:
+    dims_t dims{};
+    dims_t chunk{};
+    size_t element_size{};
+
+    /** Read-only mapping of the whole file. */
+    const uint8_t* base{nullptr};
+    size_t file_size{};
+
+    /** Offset of the contiguous storage, or of each chunk in row-major order
+     * of the chunk grid. Unallocated chunks read as zeros. */
+    std::vector<uint64_t> offset;
+
+    static constexpr uint64_t unallocated = ~uint64_t{0};
+};
+
+}  // namespace storage
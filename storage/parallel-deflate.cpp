@@ -0,0 +1,142 @@
+#include "parallel-deflate.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using storage::span_t;
+
+/** Maximum distance of the deflate back-references. */
+constexpr size_t window_size = 32 << 10;
+
+/** zlib stream header (RFC 1950) for the 32 KiB window. */
+std::array<uint8_t, 2>
+zlibHeader(int level) {
+    constexpr uint8_t cmf = 0x78;
+    const int level_bits = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+
+    int flg = level_bits << 6;
+    flg += 31 - (cmf * 256 + flg) % 31;
+    return {cmf, uint8_t(flg)};
+}
+
+/** Raw deflate of one block. The block ends on a byte boundary, so that
+ * the compressed blocks concatenate into a single deflate stream. */
+class BlockCompressor {
+    z_stream stream{};
+
+   public:
+    std::vector<uint8_t> output;
+    size_t size{0};
+    size_t input_size{0};
+    uLong adler{0};
+
+    BlockCompressor(int level, size_t block_size) {
+        const int error = deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        assert(error == Z_OK && "Failed to initialize zlib");
+
+        // Margin for the empty stored block of Z_SYNC_FLUSH.
+        output.resize(deflateBound(&stream, block_size) + 16);
+    }
+
+    ~BlockCompressor() { deflateEnd(&stream); }
+
+    BlockCompressor(const BlockCompressor&) = delete;
+    BlockCompressor& operator=(const BlockCompressor&) = delete;
+
+    /** @param[in] dictionary input preceding the block, at most 32 KiB */
+    void compress(span_t<const uint8_t> dictionary, span_t<const uint8_t> block, bool is_last) {
+        deflateReset(&stream);
+        if (dictionary.size > 0) {
+            deflateSetDictionary(&stream, dictionary.data, dictionary.size);
+        }
+
+        stream.next_in = const_cast<Bytef*>(block.data);
+        stream.avail_in = block.size;
+        stream.next_out = output.data();
+        stream.avail_out = output.size();
+
+        const int status = deflate(&stream, is_last ? Z_FINISH : Z_SYNC_FLUSH);
+        assert(status == (is_last ? Z_STREAM_END : Z_OK) && "Failed to deflate");
+        assert(stream.avail_in == 0 && stream.avail_out > 0);
+
+        size = output.size() - stream.avail_out;
+        input_size = block.size;
+        adler = adler32(adler32(0, nullptr, 0), block.data, block.size);
+    }
+};
+
+}  // namespace
+
+namespace storage {
+
+void
+deflateParallel(span_t<const uint8_t> input, const deflate_options_t& options,
+                const deflate_sink_t& write) {
+    assert(options.block_size > 0);
+    assert(options.level >= 0 && options.level <= 9);
+
+    const size_t block_size = options.block_size;
+    const size_t n_blocks = std::max<size_t>(1, (input.size + block_size - 1) / block_size);
+    const size_t n_threads = options.n_threads > 0
+                                 ? options.n_threads
+                                 : std::max<size_t>(1, std::thread::hardware_concurrency());
+    const size_t n_workers = std::min(n_threads, n_blocks);
+
+    const auto header = zlibHeader(options.level);
+    write(header.data(), header.size());
+
+    std::vector<std::unique_ptr<BlockCompressor>> workers;
+    workers.reserve(n_workers);
+    for (size_t i = 0; i < n_workers; i++) {
+        workers.emplace_back(std::make_unique<BlockCompressor>(options.level, block_size));
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(n_workers);
+
+    uLong adler = adler32(0, nullptr, 0);
+    for (size_t first = 0; first < n_blocks; first += n_workers) {
+        const size_t n = std::min(n_workers, n_blocks - first);
+
+        const auto compressBlock = [&](size_t i) {
+            const size_t block_id = first + i;
+            const size_t begin = block_id * block_size;
+            const size_t end = std::min(input.size, begin + block_size);
+            const size_t dictionary_begin = begin - std::min(begin, window_size);
+
+            workers[i]->compress({input.data + dictionary_begin, begin - dictionary_begin},
+                                 {input.data + begin, end - begin}, block_id + 1 == n_blocks);
+        };
+
+        // The calling thread takes the first block of the round.
+        for (size_t i = 1; i < n; i++) {
+            threads.emplace_back(compressBlock, i);
+        }
+        compressBlock(0);
+        for (auto& t : threads) {
+            t.join();
+        }
+        threads.clear();
+
+        // In order; the workers reuse their buffers in the next round.
+        for (size_t i = 0; i < n; i++) {
+            const auto& worker = *workers[i];
+            write(worker.output.data(), worker.size);
+            adler = adler32_combine(adler, worker.adler, worker.input_size);
+        }
+    }
+
+    const std::array<uint8_t, 4> trailer{uint8_t(adler >> 24), uint8_t(adler >> 16),
+                                         uint8_t(adler >> 8), uint8_t(adler)};
+    write(trailer.data(), trailer.size());
+}
+
+}  // namespace storage
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+
+#include "span.h"
+
+namespace storage {
+
+struct deflate_options_t {
+    /** Input bytes per deflate block. Each block is compressed independently,
+     * primed with the 32 KiB of input preceding it. */
+    size_t block_size{128 << 10};
+
+    /** Blocks compressed at once; all hardware threads if zero. The memory
+     * footprint is about n_threads * block_size. */
+    size_t n_threads{0};
+
+    /** zlib compression level, 0--9. */
+    int level{6};
+};
+
+/** Receives the compressed stream in order, piece by piece. */
+using deflate_sink_t = std::function<void(const uint8_t* data, size_t size)>;
+
+/** Compress to a single zlib stream (RFC 1950), similar to pigz.
+ *
+ * The blocks are compressed in parallel, byte-aligned with Z_SYNC_FLUSH, and
+ * concatenated. The Adler-32 checksums of the blocks are joined with
+ * adler32_combine().
+ */
+void deflateParallel(span_t<const uint8_t> input, const deflate_options_t& options,
+                     const deflate_sink_t& write);
+
+}  // namespace storage
@@ -1,21 +1,54 @@
 #include "read-slice.h"
 
-#include <highfive/H5File.hpp>
+#include <hdf5.h>
 
-// Patch to encode std::complex<float> in HDF5 file.
-#include "complex_float_support.hpp"
+#include <array>
+#include <cassert>
+#include <highfive/H5File.hpp>
 
 using Halide::Runtime::Buffer;
 
+namespace {
+
+/** Read the layers [first, first + n) of the well, without type conversion
+ * if mem_type matches the file datatype.
+ * @throw HighFive::DataSetException if the read fails */
+void
+readPlanes(const HighFive::DataSet& dataset, hid_t mem_type, size_t first, size_t n,
+           size_t well_id, size_t width, size_t height, void* out) {
+    const hid_t file_space = H5Dget_space(dataset.getId());
+    const std::array<hsize_t, 4> start{first, well_id, 0, 0};
+    const std::array<hsize_t, 4> count{n, 1, height, width};
+    H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start.data(), nullptr, count.data(), nullptr);
+
+    const hid_t mem_space = H5Screate_simple(4, count.data(), nullptr);
+    const herr_t status =
+        H5Dread(dataset.getId(), mem_type, mem_space, file_space, H5P_DEFAULT, out);
+
+    H5Sclose(mem_space);
+    H5Sclose(file_space);
+    if (status < 0) {
+        HighFive::HDF5ErrMapper::ToException<HighFive::DataSetException>("HDF5 read error: ");
+    }
+}
+
+}  // namespace
+
 namespace storage {
 
 slice_t
 readSlice(const HighFive::DataSet& dataset, size_t well_id, size_t z, size_t width, size_t height) {
     Buffer<uint16_t, 2> image(width, height);
-    dataset.select({z, well_id, 0, 0}, {1, 1, height, width}).read(image.data());
+    readSlice(dataset, well_id, z, image);
     return image;
 }
 
+void
+readSlice(const HighFive::DataSet& dataset, size_t well_id, size_t z, Buffer<uint16_t, 2>& out) {
+    assert(out.dim(0).stride() == 1 && out.dim(1).stride() == out.width());
+    readPlanes(dataset, H5T_NATIVE_UINT16, z, 1, well_id, out.width(), out.height(), out.data());
+}
+
 u8_cube_t
 readFPMRaw(const HighFive::DataSet& dataset, size_t well_id, roi_t roi,
            const std::vector<size_t>& frame_id) {
@@ -38,11 +71,44 @@ cx_fcube_t
 readQPILayers(const HighFive::DataSet& dataset, size_t well_id, size_t width, size_t height,
               size_t n_layers) {
     Halide::Runtime::Buffer<float, 4> raw(2, width, height, n_layers);
+    readQPILayers(dataset, well_id, raw);
+    return raw;
+}
 
-    dataset.select({0, well_id, 0, 0}, {n_layers, 1, height, width})
-        .read(reinterpret_cast<std::complex<float>*>(raw.data()));
+void
+readQPILayers(const HighFive::DataSet& dataset, size_t well_id, Buffer<float, 4>& out) {
+    assert(out.dim(0).extent() == 2);
+    assert(out.is_contiguous() && out.dim(0).stride() == 1);
 
-    return raw;
+    const hid_t file_type = H5Dget_type(dataset.getId());
+    const bool is_complex =
+        H5Tget_class(file_type) == H5T_COMPOUND && H5Tget_nmembers(file_type) == 2;
+    if (!is_complex) {
+        H5Tclose(file_type);
+        throw HighFive::DataTypeException("Expect complex numbers {r, i}");
+    }
+
+    // {float r, float i}, named after the members of the file datatype. If the
+    // file stores anything else, e.g. {double r, double i}, HDF5 converts it.
+    const hid_t mem_type = H5Tcreate(H5T_COMPOUND, 2 * sizeof(float));
+    for (unsigned i = 0; i < 2; i++) {
+        char* name = H5Tget_member_name(file_type, i);
+        H5Tinsert(mem_type, name, i * sizeof(float), H5T_NATIVE_FLOAT);
+        H5free_memory(name);
+    }
+
+    const auto closeTypes = [&]() {
+        H5Tclose(mem_type);
+        H5Tclose(file_type);
+    };
+    try {
+        readPlanes(dataset, mem_type, 0, out.dim(3).extent(), well_id, out.dim(1).extent(),
+                   out.dim(2).extent(), out.data());
+    } catch (...) {
+        closeTypes();
+        throw;
+    }
+    closeTypes();
 }
 
-}  // namespace storage
\ No newline at end of file
+}  // namespace storage
@@ -22,6 +22,12 @@ struct roi_t {
 slice_t readSlice(const HighFive::DataSet& dataset, size_t well_id, size_t z, size_t width,
                   size_t height);
 
+/** Read a plane from Z-stack fluorescence image into a caller-owned buffer.
+ * @param[out] out destination, dimensions (width, height). Reused across calls.
+ */
+void readSlice(const HighFive::DataSet& dataset, size_t well_id, size_t z,
+               Halide::Runtime::Buffer<uint16_t, 2>& out);
+
 /** Helper function to read a small region of interest (ROI) the FPM raw images
  * from HDF5 dataset. */
 u8_cube_t readFPMRaw(const HighFive::DataSet& dataset, size_t well_id, roi_t,
@@ -32,4 +38,17 @@ u8_cube_t readFPMRaw(const HighFive::DataSet& dataset, size_t well_id, roi_t,
 cx_fcube_t readQPILayers(const HighFive::DataSet& dataset, size_t well_id, size_t width,
                          size_t height, size_t n_layers = 4);
 
+/** Read the FPM-QPI into a caller-owned buffer.
+ *
+ * HDF5 copies the {float r, float i} pairs without type conversion, and
+ * converts any other precision of the pairs to float.
+ *
+ * @throw HighFive::DataTypeException if the dataset is not of complex numbers
+ *
+ * @param[out] out destination, dimensions (2, width, height, n_layers). Reused
+ * across calls.
+ */
+void readQPILayers(const HighFive::DataSet& dataset, size_t well_id,
+                   Halide::Runtime::Buffer<float, 4>& out);
+
 }  // namespace storage
\ No newline at end of file
@@ -0,0 +1,340 @@
+#include "save-image.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include "parallel-deflate.h"
+
+namespace {
+
+using storage::image_options_t;
+using storage::plane_t;
+
+size_t
+nThreads(const image_options_t& options) {
+    return options.n_threads > 0 ? options.n_threads
+                                 : std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+/** Call f(begin, end) on contiguous ranges of [0, n), one per thread. */
+template <typename F>
+void
+parallelFor(size_t n, size_t n_threads, const F& f) {
+    const size_t n_ranges = std::min(n, n_threads);
+    if (n_ranges == 0) {
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(n_ranges - 1);
+    for (size_t i = 1; i < n_ranges; i++) {
+        threads.emplace_back(f, i * n / n_ranges, (i + 1) * n / n_ranges);
+    }
+    f(0, n / n_ranges);
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+void
+putBigEndian(uint8_t* out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+void
+putLittleEndian(std::vector<uint8_t>& out, uint32_t value, size_t n_bytes) {
+    for (size_t i = 0; i < n_bytes; i++) {
+        out.push_back(value >> (8 * i));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// PNG
+
+enum filter_t : uint8_t { NONE, SUB, UP, AVERAGE, PAETH };
+
+/** Prediction of the filter from the left (a), up (b), and up-left (c)
+ * pixels. */
+template <filter_t filter>
+uint8_t
+predict(int a, int b, int c) {
+    switch (filter) {
+        case NONE:
+            return 0;
+        case SUB:
+            return a;
+        case UP:
+            return b;
+        case AVERAGE:
+            return (a + b) / 2;
+        case PAETH: {
+            const int p = a + b - c;
+            const int pa = std::abs(p - a);
+            const int pb = std::abs(p - b);
+            const int pc = std::abs(p - c);
+            return (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+        }
+    }
+    return 0;
+}
+
+/** Apply the filter to one row. If out is null, only estimate the size of
+ * the compressed row, as the sum of the absolute residuals. */
+template <filter_t filter>
+uint32_t
+filterRow(const uint8_t* row, const uint8_t* up, size_t width, uint8_t* out) {
+    uint32_t cost = 0;
+    for (size_t x = 0; x < width; x++) {
+        const int a = x > 0 ? row[x - 1] : 0;
+        const int c = x > 0 ? up[x - 1] : 0;
+        const uint8_t residual = row[x] - predict<filter>(a, up[x], c);
+        if (out != nullptr) {
+            out[x] = residual;
+        }
+        cost += std::abs(int8_t(residual));
+    }
+    return cost;
+}
+
+using filter_fn = uint32_t (*)(const uint8_t*, const uint8_t*, size_t, uint8_t*);
+constexpr std::array<filter_fn, 5> filters{filterRow<NONE>, filterRow<SUB>, filterRow<UP>,
+                                           filterRow<AVERAGE>, filterRow<PAETH>};
+
+/** Filter the rows in parallel, prefixed with the filter type. */
+std::vector<uint8_t>
+filterImage(const plane_t& image, bool is_adaptive, size_t n_threads) {
+    const size_t width = image.width;
+    std::vector<uint8_t> filtered(image.height * (width + 1));
+    const std::vector<uint8_t> zeros(width, 0);
+
+    // The filters refer to the unfiltered rows only, so the rows are
+    // independent.
+    parallelFor(image.height, n_threads, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; y++) {
+            const uint8_t* row = image.data + y * image.stride;
+            const uint8_t* up = y > 0 ? row - image.stride : zeros.data();
+            uint8_t* out = filtered.data() + y * (width + 1);
+
+            size_t best = NONE;
+            if (is_adaptive) {
+                uint32_t min_cost = UINT32_MAX;
+                for (size_t f = 0; f < filters.size(); f++) {
+                    const uint32_t cost = filters[f](row, up, width, nullptr);
+                    if (cost < min_cost) {
+                        min_cost = cost;
+                        best = f;
+                    }
+                }
+            }
+
+            out[0] = best;
+            filters[best](row, up, width, out + 1);
+        }
+    });
+
+    return filtered;
+}
+
+/** Buffer the chunk data, and emit full chunks with their CRC. */
+class ChunkWriter {
+    std::ofstream& out;
+    std::array<uint8_t, 4> type;
+    std::vector<uint8_t> data;
+    size_t max_size;
+
+   public:
+    ChunkWriter(std::ofstream& o, const char* t, size_t max_chunk_size = 256 << 10)
+        : out{o}, type{uint8_t(t[0]), uint8_t(t[1]), uint8_t(t[2]), uint8_t(t[3])},
+          max_size{max_chunk_size} {
+        data.reserve(max_size);
+    }
+
+    void write(const uint8_t* bytes, size_t size) {
+        while (size > 0) {
+            const size_t n = std::min(size, max_size - data.size());
+            data.insert(data.end(), bytes, bytes + n);
+            bytes += n;
+            size -= n;
+            if (data.size() == max_size) {
+                flush();
+            }
+        }
+    }
+
+    void flush() {
+        std::array<uint8_t, 8> header;
+        putBigEndian(header.data(), data.size());
+        std::copy(type.begin(), type.end(), header.begin() + 4);
+
+        uLong crc = crc32(0, type.data(), type.size());
+        crc = crc32(crc, data.data(), data.size());
+        std::array<uint8_t, 4> trailer;
+        putBigEndian(trailer.data(), crc);
+
+        out.write(reinterpret_cast<const char*>(header.data()), header.size());
+        out.write(reinterpret_cast<const char*>(data.data()), data.size());
+        out.write(reinterpret_cast<const char*>(trailer.data()), trailer.size());
+        data.clear();
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// TIFF
+
+enum tiff_type_t : uint16_t { SHORT = 3, LONG = 4 };
+
+void
+putEntry(std::vector<uint8_t>& ifd, uint16_t tag, tiff_type_t type, uint32_t count,
+         uint32_t value) {
+    putLittleEndian(ifd, tag, 2);
+    putLittleEndian(ifd, type, 2);
+    putLittleEndian(ifd, count, 4);
+    putLittleEndian(ifd, value, 4);
+}
+
+}  // namespace
+
+namespace storage {
+
+void
+savePNG(const plane_t& image, const std::string& filename, const image_options_t& options) {
+    assert(image.stride >= image.width);
+    const size_t n_threads = nThreads(options);
+
+    // Not worth filtering the rows if they are stored uncompressed.
+    const auto filtered = filterImage(image, options.png_level > 0, n_threads);
+
+    std::ofstream png_file{filename, std::ios::binary};
+    constexpr std::array<uint8_t, 8> signature{0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    png_file.write(reinterpret_cast<const char*>(signature.data()), signature.size());
+
+    // 8-bit grayscale, no interlace.
+    std::array<uint8_t, 13> header{0, 0, 0, 0, 0, 0, 0, 0, 8, 0, 0, 0, 0};
+    putBigEndian(header.data(), image.width);
+    putBigEndian(header.data() + 4, image.height);
+    ChunkWriter ihdr{png_file, "IHDR"};
+    ihdr.write(header.data(), header.size());
+    ihdr.flush();
+
+    ChunkWriter idat{png_file, "IDAT"};
+    deflate_options_t deflate_options;
+    deflate_options.n_threads = n_threads;
+    deflate_options.level = options.png_level;
+    deflateParallel({filtered.data(), filtered.size()}, deflate_options,
+                    [&](const uint8_t* data, size_t size) { idat.write(data, size); });
+    idat.flush();
+
+    ChunkWriter{png_file, "IEND"}.flush();
+}
+
+void
+saveTIFF(const plane_t& image, const std::string& filename, const image_options_t& options) {
+    assert(image.stride >= image.width);
+    assert(options.rows_per_strip > 0);
+
+    const size_t rows_per_strip = std::min(options.rows_per_strip, image.height);
+    const size_t n_strips = (image.height + rows_per_strip - 1) / rows_per_strip;
+    const auto stripRows = [&](size_t s) {
+        return std::min(rows_per_strip, image.height - s * rows_per_strip);
+    };
+
+    std::vector<std::vector<uint8_t>> compressed;
+    std::vector<uint32_t> strip_size(n_strips);
+    if (options.tiff_deflate) {
+        compressed.resize(n_strips);
+        parallelFor(n_strips, nThreads(options), [&](size_t begin, size_t end) {
+            std::vector<uint8_t> strip(rows_per_strip * image.width);
+            for (size_t s = begin; s < end; s++) {
+                const size_t n_rows = stripRows(s);
+                for (size_t y = 0; y < n_rows; y++) {
+                    std::copy_n(image.data + (s * rows_per_strip + y) * image.stride,
+                                image.width, strip.data() + y * image.width);
+                }
+
+                const size_t length = n_rows * image.width;
+                compressed[s].resize(compressBound(length));
+                uLongf size = compressed[s].size();
+                const int error = compress2(compressed[s].data(), &size, strip.data(), length, 1);
+                assert(error == Z_OK && "Failed to deflate");
+                strip_size[s] = size;
+            }
+        });
+    } else {
+        for (size_t s = 0; s < n_strips; s++) {
+            strip_size[s] = stripRows(s) * image.width;
+        }
+    }
+
+    // Little-endian header, then the IFD, the strip arrays, and the strips.
+    constexpr uint16_t n_entries = 10;
+    constexpr uint32_t ifd_offset = 8;
+    constexpr uint32_t ifd_size = 2 + n_entries * 12 + 4;
+    const uint32_t array_size = n_strips > 1 ? 4 * n_strips : 0;
+    const uint32_t offsets_offset = ifd_offset + ifd_size;
+    const uint32_t sizes_offset = offsets_offset + array_size;
+    const uint32_t data_offset = sizes_offset + array_size;
+
+    std::vector<uint32_t> strip_offset(n_strips, data_offset);
+    for (size_t s = 1; s < n_strips; s++) {
+        strip_offset[s] = strip_offset[s - 1] + strip_size[s - 1];
+    }
+
+    std::vector<uint8_t> header{'I', 'I', 42, 0};
+    header.reserve(data_offset);
+    putLittleEndian(header, ifd_offset, 4);
+
+    // Sorted by tag. The arrays of a single strip fit in the entry.
+    putLittleEndian(header, n_entries, 2);
+    putEntry(header, 256, LONG, 1, image.width);
+    putEntry(header, 257, LONG, 1, image.height);
+    putEntry(header, 258, SHORT, 1, 8);
+    putEntry(header, 259, SHORT, 1, options.tiff_deflate ? 8 : 1);
+    putEntry(header, 262, SHORT, 1, 1);  // BlackIsZero
+    putEntry(header, 273, LONG, n_strips, n_strips > 1 ? offsets_offset : strip_offset[0]);
+    putEntry(header, 277, SHORT, 1, 1);
+    putEntry(header, 278, LONG, 1, rows_per_strip);
+    putEntry(header, 279, LONG, n_strips, n_strips > 1 ? sizes_offset : strip_size[0]);
+    putEntry(header, 284, SHORT, 1, 1);  // Chunky
+    putLittleEndian(header, 0, 4);
+
+    if (n_strips > 1) {
+        for (const auto offset : strip_offset) {
+            putLittleEndian(header, offset, 4);
+        }
+        for (const auto size : strip_size) {
+            putLittleEndian(header, size, 4);
+        }
+    }
+    assert(header.size() == data_offset);
+
+    std::ofstream tiff_file{filename, std::ios::binary};
+    tiff_file.write(reinterpret_cast<const char*>(header.data()), header.size());
+
+    for (size_t s = 0; s < n_strips; s++) {
+        if (options.tiff_deflate) {
+            tiff_file.write(reinterpret_cast<const char*>(compressed[s].data()), strip_size[s]);
+        } else if (image.stride == image.width) {
+            tiff_file.write(reinterpret_cast<const char*>(image.data +
+                                                          s * rows_per_strip * image.stride),
+                            strip_size[s]);
+        } else {
+            for (size_t y = 0; y < stripRows(s); y++) {
+                tiff_file.write(reinterpret_cast<const char*>(
+                                    image.data + (s * rows_per_strip + y) * image.stride),
+                                image.width);
+            }
+        }
+    }
+}
+
+}  // namespace storage
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace storage {
+
+/** 8-bit grayscale image, x fastest, e.g. a plane of a Halide buffer. */
+struct plane_t {
+    const uint8_t* data{nullptr};
+    size_t width{};
+    size_t height{};
+
+    /** Distance between the rows, in bytes. */
+    size_t stride{};
+};
+
+struct image_options_t {
+    /** zlib compression level of the PNG stream, 0--9. Level 0 stores the
+     * rows unfiltered. */
+    int png_level{1};
+
+    /** Compress the TIFF strips with deflate (level 1), otherwise store them
+     * uncompressed. */
+    bool tiff_deflate{false};
+
+    size_t rows_per_strip{64};
+
+    /** Worker threads of the PNG filters and the compression; all hardware
+     * threads if zero. */
+    size_t n_threads{0};
+};
+
+/** Write a grayscale PNG. The rows are filtered in parallel, with the
+ * filter minimizing the sum of absolute differences, then compressed in
+ * parallel blocks, see deflateParallel().
+ */
+void savePNG(const plane_t& image, const std::string& filename,
+             const image_options_t& options = {});
+
+/** Write a grayscale baseline TIFF, in strips of rows_per_strip rows. */
+void saveTIFF(const plane_t& image, const std::string& filename,
+              const image_options_t& options = {});
+
+}  // namespace storage
@@ -1,40 +1,111 @@
 #include "save_xml_raw.h"
 
-#include <base64.h>
-#include <zlib.h>
-
 #include <algorithm>
+#include <array>
+#include <cstdio>
 #include <fstream>
+#include <vector>
 
 namespace {
 
-std::pair<std::vector<uint8_t>, size_t>
-compressZlib(storage::span_t<uint8_t> src) {
-    std::vector<uint8_t> dest(src.size);
+/** Digits reserved for the Length attribute, filled in once known. */
+constexpr int length_digits = 12;
 
-    size_t compressed_size = dest.size();
-    compress(dest.data(), &compressed_size, src.data, src.size);
+/** Incremental base64 encoder, flushed to the stream in fixed-size chunks. */
+class Base64Writer {
+    static constexpr char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-    return {dest, compressed_size};
-}
+    std::ostream& out;
+    std::vector<char> buffer;
+    size_t used{0};
+    size_t length{0};
+
+    /** Trailing bytes of the last write, short of a triplet. */
+    std::array<uint8_t, 3> pending{};
+    size_t n_pending{0};
+
+    void encode(const uint8_t* triplet) {
+        if (used == buffer.size()) {
+            flush();
+        }
+
+        const uint32_t bits = (triplet[0] << 16) | (triplet[1] << 8) | triplet[2];
+        char* quad = buffer.data() + used;
+        quad[0] = alphabet[(bits >> 18) & 0x3f];
+        quad[1] = alphabet[(bits >> 12) & 0x3f];
+        quad[2] = alphabet[(bits >> 6) & 0x3f];
+        quad[3] = alphabet[bits & 0x3f];
+
+        used += 4;
+    }
+
+    void flush() {
+        out.write(buffer.data(), used);
+        length += used;
+        used = 0;
+    }
+
+   public:
+    explicit Base64Writer(std::ostream& o, size_t chunk_size = 64 << 10)
+        : out{o}, buffer(chunk_size / 4 * 4) {}
+
+    void write(const uint8_t* data, size_t size) {
+        for (; n_pending > 0 && n_pending < 3 && size > 0; size--) {
+            pending[n_pending++] = *data++;
+        }
+        if (n_pending == 3) {
+            encode(pending.data());
+            n_pending = 0;
+        }
+
+        for (; size >= 3; data += 3, size -= 3) {
+            encode(data);
+        }
+
+        std::copy_n(data, size, pending.begin() + n_pending);
+        n_pending += size;
+    }
+
+    /** Pad the last triplet, and flush.
+     * @return the number of characters written.
+     */
+    size_t finish() {
+        if (n_pending > 0) {
+            std::fill(pending.begin() + n_pending, pending.end(), 0);
+            encode(pending.data());
+            std::fill(buffer.begin() + used - (3 - n_pending), buffer.begin() + used, '=');
+            n_pending = 0;
+        }
+        flush();
+        return length;
+    }
+};
 
-std::string
-encodeBase64(const std::vector<uint8_t> raw_bytes, size_t count) {
-    return base64_encode(raw_bytes.data(), count, false);
-}
 }  // namespace
 
 namespace storage {
 
 void
-saveXML(const span_t<uint8_t> buffer, const std::string& filename) {
-    std::ofstream xml_file{filename};
+saveXML(const span_t<uint8_t> buffer, const std::string& filename, const xml_options_t& options) {
+    std::ofstream xml_file{filename, std::ios::binary};
+
+    xml_file << R"(<BinData Compression="zlib" BigEndian="false" Length=")";
+    const auto length_position = xml_file.tellp();
+    xml_file << std::string(length_digits, '0') << "\">";
 
-    xml_file << R"(<BinData Compression="zlib" BigEndian="false" )";
+    Base64Writer base64{xml_file};
+    deflateParallel({buffer.data, buffer.size}, options,
+                    [&](const uint8_t* data, size_t size) { base64.write(data, size); });
+    const size_t length = base64.finish();
+    xml_file << "</BinData>\n";
 
-    auto [compressed, count] = compressZlib(buffer);
-    const auto encoded = encodeBase64(std::move(compressed), count);
-    xml_file << "Length=\"" << encoded.size() << "\">" << encoded << "</BinData>\n";
+    // The compressed size is known only now. Zero-padded, to fit the
+    // reserved digits.
+    std::array<char, length_digits + 1> digits;
+    std::snprintf(digits.data(), digits.size(), "%0*zu", length_digits, length);
+    xml_file.seekp(length_position);
+    xml_file.write(digits.data(), length_digits);
 }
 
 }  // namespace storage
@@ -2,18 +2,19 @@
 #include <cstdint>
 #include <string>
 
-namespace storage {
+#include "parallel-deflate.h"
+#include "span.h"
 
-template <typename T>
-struct span_t {
-    T* data{nullptr};
-    size_t size{};
+namespace storage {
 
-    span_t<const char> as_bytes() const {
-        return {reinterpret_cast<const char*>(data), size * sizeof(T)};
-    }
-};
+using xml_options_t = deflate_options_t;
 
-void saveXML(const span_t<uint8_t> buffer, const std::string& filename);
+/** Write the image as zlib-compressed, base64-encoded OME BinData.
+ *
+ * The base64 text is streamed to the file as the blocks are compressed, see
+ * deflateParallel(), without holding the compressed image in memory.
+ */
+void saveXML(const span_t<uint8_t> buffer, const std::string& filename,
+             const xml_options_t& options = {});
 
 }  // namespace storage
@@ -0,0 +1,16 @@
+#pragma once
+#include <cstddef>
+
+namespace storage {
+
+template <typename T>
+struct span_t {
+    T* data{nullptr};
+    size_t size{};
+
+    span_t<const char> as_bytes() const {
+        return {reinterpret_cast<const char*>(data), size * sizeof(T)};
+    }
+};
+
+}  // namespace storage
@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <catch2/catch_test_macros.hpp>
+#include <complex>
+#include <highfive/H5File.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "FPM_datafile.h"
+
+namespace {
+constexpr char filename[]{"test-fpm-datafile.h5"};
+
+constexpr size_t n_incidences = 3;
+constexpr size_t n_wells = 3;
+constexpr size_t height = 40;
+constexpr size_t width = 48;
+constexpr size_t tile_size = 8;
+
+using datafile_t = FPM_datafile<uint8_t, float>;
+
+/** The tests run on a single rank, with the MPI-IO driver. */
+struct MPIEnvironment {
+    MPIEnvironment() { MPI_Init(nullptr, nullptr); }
+    ~MPIEnvironment() { MPI_Finalize(); }
+};
+const MPIEnvironment mpi_environment;
+
+uint8_t
+rawPixel(size_t i, size_t well, size_t y, size_t x) {
+    return (i * 7 + well * 13 + y * 3 + x) % 251;
+}
+
+/** Plate of the same layout as the 96-well files, much smaller. */
+void
+createPlate() {
+    HighFive::File file{filename, HighFive::File::Overwrite};
+
+    std::vector<uint8_t> imlow(n_incidences * n_wells * height * width);
+    for (size_t i = 0; i < n_incidences; i++) {
+        for (size_t w = 0; w < n_wells; w++) {
+            for (size_t y = 0; y < height; y++) {
+                for (size_t x = 0; x < width; x++) {
+                    imlow[((i * n_wells + w) * height + y) * width + x] = rawPixel(i, w, y, x);
+                }
+            }
+        }
+    }
+    file.createDataSet<uint8_t>("imlow",
+                                HighFive::DataSpace({n_incidences, n_wells, height, width}))
+        .write_raw(imlow.data());
+
+    using complex_t = std::complex<float>;
+    file.createDataSet<complex_t>("himr", HighFive::DataSpace({4, n_wells, height, width}));
+    file.createDataSet<complex_t>("initial_pupil",
+                                  HighFive::DataSpace({n_wells, tile_size, tile_size}));
+    file.createDataSet<complex_t>("corrected_pupil",
+                                  HighFive::DataSpace({4, n_wells, height, width}));
+}
+
+/** Check the read buffer against the tile of the window. */
+bool
+isTile(const std::vector<uint8_t>& buffer, size_t first_well, size_t n, size_t row, size_t col) {
+    for (size_t i = 0; i < n_incidences; i++) {
+        for (size_t w = 0; w < n; w++) {
+            for (size_t y = 0; y < tile_size; y++) {
+                for (size_t x = 0; x < tile_size; x++) {
+                    const auto value = buffer[((i * n + w) * tile_size + y) * tile_size + x];
+                    if (value != rawPixel(i, first_well + w, row + y, col + x)) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+}  // namespace
+
+SCENARIO("Can stream the tiles through two buffer slots") {
+    createPlate();
+    MPI_Comm comm = MPI_COMM_WORLD;
+    MPI_Info info = MPI_INFO_NULL;
+
+    const std::vector<datafile_t::origin_t> origins{{0, 0}, {8, 16}, {32, 40}};
+    const size_t well_bytes =
+        tile_size * tile_size * (n_incidences * sizeof(uint8_t) + sizeof(std::complex<float>));
+
+    // One window reuses the window across the jobs, three windows wrap
+    // around at the tile boundaries.
+    for (const auto& [max_bytes, expected_windows] :
+         {std::pair<size_t, size_t>{0, 1}, {2 * well_bytes, 3}}) {
+        GIVEN("A memory budget of " + std::to_string(max_bytes) + " bytes") {
+            datafile_t file{filename, comm, info};
+            const size_t n_windows = file.set_stream_dims(n_incidences, tile_size, tile_size,
+                                                          n_wells, 0, max_bytes);
+            REQUIRE(n_windows == expected_windows);
+
+            const size_t n_jobs = origins.size() * n_windows;
+            const auto readJob = [&](size_t job) {
+                const auto& [row, col] = origins[job / n_windows];
+                file.set_window(job % n_windows, job % 2);
+                file.read_image(row, col);
+            };
+
+            THEN("Reading the next job leaves the current one untouched") {
+                readJob(0);
+                for (size_t job = 0; job < n_jobs; job++) {
+                    file.set_window(job % n_windows, job % 2);
+                    const auto [begin, n] = file.get_window();
+                    const auto& current = file.get_read_buffer();
+
+                    if (job + 1 < n_jobs) {
+                        readJob(job + 1);
+                    }
+
+                    const auto& [row, col] = origins[job / n_windows];
+                    REQUIRE(isTile(current, begin, n, row, col));
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Can budget the buffers of the batch transfers") {
+    createPlate();
+    MPI_Comm comm = MPI_COMM_WORLD;
+    MPI_Info info = MPI_INFO_NULL;
+
+    constexpr size_t max_batch = 2;
+    const size_t well_bytes =
+        tile_size * tile_size * (n_incidences * sizeof(uint8_t) + sizeof(std::complex<float>));
+
+    GIVEN("A budget of two slots and the scratch, for one well") {
+        datafile_t file{filename, comm, info};
+        const size_t n_windows = file.set_stream_dims(n_incidences, tile_size, tile_size, n_wells,
+                                                      0, 3 * max_batch * well_bytes, max_batch);
+
+        THEN("The wells are streamed one at a time, with a batch per slot") {
+            REQUIRE(n_windows == n_wells);
+            REQUIRE(file.get_read_buffer().size() ==
+                    max_batch * n_incidences * tile_size * tile_size);
+            REQUIRE(file.get_write_buffer().size() == max_batch * tile_size * tile_size);
+        }
+    }
+}
+
+SCENARIO("Can transfer a batch of tiles through their bounding box") {
+    createPlate();
+    MPI_Comm comm = MPI_COMM_WORLD;
+    MPI_Info info = MPI_INFO_NULL;
+
+    // Adjacent, and far apart tiles: the adjacent ones share a bounding box,
+    // the others exceed the budget of four tiles and are split.
+    const std::vector<datafile_t::origin_t> origins{{8, 16}, {8, 24}, {0, 0}, {32, 40}};
+    const size_t tile_length = n_wells * tile_size * tile_size;
+
+    datafile_t file{filename, comm, info};
+    file.set_block_dims(n_incidences, tile_size, tile_size, n_wells, 0, origins.size());
+
+    GIVEN("The tiles read one by one") {
+        std::vector<std::vector<uint8_t>> tiles;
+        for (const auto& [row, col] : origins) {
+            file.read_image(row, col);
+            const auto& buffer = file.get_read_buffer();
+            tiles.emplace_back(buffer.begin(), buffer.begin() + n_incidences * tile_length);
+        }
+
+        WHEN("Read the tiles in one call") {
+            file.read_images(origins);
+            const auto& batch = file.get_read_buffer();
+
+            THEN("The tiles are unpacked one after the other") {
+                REQUIRE(batch.size() == origins.size() * n_incidences * tile_length);
+                for (size_t i = 0; i < origins.size(); i++) {
+                    const std::vector<uint8_t> tile(
+                        batch.begin() + i * n_incidences * tile_length,
+                        batch.begin() + (i + 1) * n_incidences * tile_length);
+                    REQUIRE(tile == tiles[i]);
+                }
+            }
+        }
+    }
+
+    GIVEN("Distinct phase values per tile") {
+        constexpr size_t layer = 2;
+        auto& batch = file.get_write_buffer();
+        REQUIRE(batch.size() == origins.size() * tile_length);
+        for (size_t i = 0; i < batch.size(); i++) {
+            batch[i] = {float(i), -float(i)};
+        }
+
+        WHEN("Write the tiles in one call") {
+            file.write_phase_images(layer, origins);
+
+            THEN("Each tile reads back in its layer") {
+                std::vector<std::complex<float>> layers(4 * tile_length);
+                for (size_t i = 0; i < origins.size(); i++) {
+                    const auto& [row, col] = origins[i];
+                    file.read_phase_image(row, col, layers);
+
+                    const auto first = layers.begin() + layer * tile_length;
+                    REQUIRE(std::equal(first, first + tile_length,
+                                       batch.begin() + i * tile_length));
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Can write the local pupil functions") {
+    createPlate();
+    MPI_Comm comm = MPI_COMM_WORLD;
+    MPI_Info info = MPI_INFO_NULL;
+
+    constexpr size_t layer = 1;
+    constexpr size_t row = 8;
+    constexpr size_t col = 16;
+    const size_t tile_length = n_wells * tile_size * tile_size;
+
+    GIVEN("A pupil function per well") {
+        std::vector<std::complex<float>> expected(tile_length);
+        for (size_t i = 0; i < tile_length; i++) {
+            expected[i] = {float(i), 1.0f};
+        }
+
+        {
+            datafile_t file{filename, comm, info};
+            file.set_block_dims(n_incidences, tile_size, tile_size, n_wells);
+            file.get_write_buffer() = expected;
+            file.write_local_pupil(layer, row, col);
+        }
+
+        THEN("The pupils are stored at the tile of corrected_pupil") {
+            HighFive::File file{filename, HighFive::File::ReadOnly};
+            std::vector<std::complex<float>> actual(tile_length);
+            file.getDataSet("corrected_pupil")
+                .select({layer, 0, row, col}, {1, n_wells, tile_size, tile_size})
+                .read(actual.data());
+            REQUIRE(actual == expected);
+        }
+    }
+}
+
+SCENARIO("Can report the failed transfers") {
+    createPlate();
+    MPI_Comm comm = MPI_COMM_WORLD;
+    MPI_Info info = MPI_INFO_NULL;
+
+    GIVEN("A tile past the edge of the plate") {
+        datafile_t file{filename, comm, info};
+        file.set_block_dims(n_incidences, tile_size, tile_size, n_wells, 0, 2);
+
+        THEN("The transfers throw") {
+            REQUIRE_THROWS_AS(file.read_image(height, 0), HighFive::DataSetException);
+            REQUIRE_THROWS_AS(file.write_phase_image(0, 0, width), HighFive::DataSetException);
+            REQUIRE_THROWS_AS(file.read_images({{0, 0}, {height - 4, 0}}),
+                              HighFive::DataSetException);
+        }
+    }
+}
@@ -0,0 +1,230 @@
+#include <zlib.h>
+
+#include <catch2/catch_test_macros.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "save-image.h"
+
+namespace {
+constexpr char png_filename[]{"test-save-image.png"};
+constexpr char tiff_filename[]{"test-save-image.tif"};
+
+using bytes_t = std::vector<uint8_t>;
+
+/** Smooth gradient with sparse noise, padded to the stride. */
+bytes_t
+syntheticImage(size_t width, size_t height, size_t stride) {
+    std::mt19937 rng{42};
+    bytes_t image(stride * height, 0);
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            image[y * stride + x] = uint8_t(y / 4 + x / 16) ^ ((rng() % 8 == 0) ? rng() % 4 : 0);
+        }
+    }
+    return image;
+}
+
+/** Pixels only, without the padding. */
+bytes_t
+packed(const storage::plane_t& image) {
+    bytes_t pixels;
+    for (size_t y = 0; y < image.height; y++) {
+        const auto* row = image.data + y * image.stride;
+        pixels.insert(pixels.end(), row, row + image.width);
+    }
+    return pixels;
+}
+
+bytes_t
+loadFile(const char* filename) {
+    std::ifstream file{filename, std::ios::binary};
+    return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+uint32_t
+bigEndian(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+uint32_t
+littleEndian(const uint8_t* p, size_t n_bytes) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < n_bytes; i++) {
+        value |= uint32_t(p[i]) << (8 * i);
+    }
+    return value;
+}
+
+bytes_t
+inflate(const uint8_t* data, size_t size, size_t expected_size) {
+    bytes_t decoded(expected_size + 1);
+    uLongf decoded_size = decoded.size();
+    REQUIRE(uncompress(decoded.data(), &decoded_size, data, size) == Z_OK);
+    decoded.resize(decoded_size);
+    return decoded;
+}
+
+/** Decode the grayscale PNG, checking the CRC of the chunks. */
+bytes_t
+loadPNG(size_t width, size_t height) {
+    const auto png = loadFile(png_filename);
+    const uint8_t signature[]{0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    REQUIRE(std::memcmp(png.data(), signature, sizeof(signature)) == 0);
+
+    bytes_t idat;
+    std::vector<std::string> chunks;
+    for (size_t pos = sizeof(signature); pos < png.size();) {
+        const uint32_t size = bigEndian(&png[pos]);
+        const uint8_t* type = &png[pos + 4];
+        const uint8_t* data = type + 4;
+        REQUIRE(crc32(0, type, size + 4) == bigEndian(data + size));
+
+        chunks.emplace_back(type, type + 4);
+        if (chunks.back() == "IHDR") {
+            REQUIRE(bigEndian(data) == width);
+            REQUIRE(bigEndian(data + 4) == height);
+            REQUIRE(data[8] == 8);  // bit depth
+            REQUIRE(data[9] == 0);  // grayscale
+        } else if (chunks.back() == "IDAT") {
+            idat.insert(idat.end(), data, data + size);
+        }
+        pos += size + 12;
+    }
+    REQUIRE(chunks.front() == "IHDR");
+    REQUIRE(chunks.back() == "IEND");
+
+    const auto filtered = inflate(idat.data(), idat.size(), height * (width + 1));
+    REQUIRE(filtered.size() == height * (width + 1));
+
+    bytes_t pixels(width * height);
+    const bytes_t zeros(width, 0);
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t filter = filtered[y * (width + 1)];
+        const uint8_t* in = &filtered[y * (width + 1) + 1];
+        uint8_t* row = &pixels[y * width];
+        const uint8_t* up = y > 0 ? row - width : zeros.data();
+
+        for (size_t x = 0; x < width; x++) {
+            const int a = x > 0 ? row[x - 1] : 0;
+            const int b = up[x];
+            const int c = x > 0 ? up[x - 1] : 0;
+            const int p = a + b - c;
+            const int pa = std::abs(p - a);
+            const int pb = std::abs(p - b);
+            const int pc = std::abs(p - c);
+            const int paeth = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+
+            const int prediction[]{0, a, b, (a + b) / 2, paeth};
+            REQUIRE(filter < 5);
+            row[x] = in[x] + prediction[filter];
+        }
+    }
+    return pixels;
+}
+
+/** Decode the strips of the little-endian baseline TIFF. */
+bytes_t
+loadTIFF(size_t width, size_t height) {
+    const auto tiff = loadFile(tiff_filename);
+    REQUIRE(std::memcmp(tiff.data(), "II*\0", 4) == 0);
+
+    const uint32_t ifd = littleEndian(&tiff[4], 4);
+    const size_t n_entries = littleEndian(&tiff[ifd], 2);
+
+    // Tag -> values
+    std::map<uint16_t, std::vector<uint32_t>> tags;
+    for (size_t i = 0; i < n_entries; i++) {
+        const uint8_t* entry = &tiff[ifd + 2 + 12 * i];
+        const uint16_t tag = littleEndian(entry, 2);
+        const size_t type_size = littleEndian(entry + 2, 2) == 3 ? 2 : 4;
+        const uint32_t count = littleEndian(entry + 4, 4);
+
+        const uint8_t* values =
+            count * type_size <= 4 ? entry + 8 : &tiff[littleEndian(entry + 8, 4)];
+        for (size_t j = 0; j < count; j++) {
+            tags[tag].push_back(littleEndian(values + j * type_size, type_size));
+        }
+    }
+    REQUIRE(tags[256].at(0) == width);
+    REQUIRE(tags[257].at(0) == height);
+    REQUIRE(tags[258].at(0) == 8);
+
+    const bool is_deflate = tags[259].at(0) == 8;
+    const auto& offsets = tags[273];
+    const auto& sizes = tags[279];
+    REQUIRE(offsets.size() == sizes.size());
+
+    bytes_t pixels;
+    for (size_t s = 0; s < offsets.size(); s++) {
+        const uint8_t* strip = &tiff[offsets[s]];
+        if (is_deflate) {
+            const auto decoded = inflate(strip, sizes[s], width * tags[278].at(0));
+            pixels.insert(pixels.end(), decoded.begin(), decoded.end());
+        } else {
+            pixels.insert(pixels.end(), strip, strip + sizes[s]);
+        }
+    }
+    return pixels;
+}
+}  // namespace
+
+SCENARIO("Can write 8-bit PNG and TIFF images") {
+    GIVEN("A full-sensor plane") {
+        constexpr size_t width = 2592;
+        constexpr size_t height = 1944;
+        const auto buffer = syntheticImage(width, height, width);
+        const storage::plane_t image{buffer.data(), width, height, width};
+
+        storage::image_options_t options;
+        options.n_threads = 4;
+
+        for (const int level : {0, 1, 9}) {
+            options.png_level = level;
+            storage::savePNG(image, png_filename, options);
+            REQUIRE(loadPNG(width, height) == buffer);
+        }
+
+        for (const bool is_deflate : {false, true}) {
+            options.tiff_deflate = is_deflate;
+            storage::saveTIFF(image, tiff_filename, options);
+            REQUIRE(loadTIFF(width, height) == buffer);
+        }
+    }
+
+    GIVEN("Padded rows, not a multiple of the strips") {
+        constexpr size_t width = 37;
+        constexpr size_t height = 11;
+        const auto buffer = syntheticImage(width, height, 40);
+        const storage::plane_t image{buffer.data(), width, height, 40};
+
+        storage::image_options_t options;
+        options.rows_per_strip = 4;
+        options.n_threads = 3;
+
+        storage::savePNG(image, png_filename, options);
+        REQUIRE(loadPNG(width, height) == packed(image));
+
+        for (const bool is_deflate : {false, true}) {
+            options.tiff_deflate = is_deflate;
+            storage::saveTIFF(image, tiff_filename, options);
+            REQUIRE(loadTIFF(width, height) == packed(image));
+        }
+    }
+
+    GIVEN("A single pixel") {
+        const bytes_t buffer{42};
+        const storage::plane_t image{buffer.data(), 1, 1, 1};
+
+        storage::savePNG(image, png_filename);
+        REQUIRE(loadPNG(1, 1) == buffer);
+
+        storage::saveTIFF(image, tiff_filename);
+        REQUIRE(loadTIFF(1, 1) == buffer);
+    }
+}
@@ -0,0 +1,114 @@
+#include <base64.h>
+#include <zlib.h>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "save_xml_raw.h"
+
+namespace {
+constexpr char filename[]{"test-save-xml.xml"};
+constexpr size_t width = 2592;
+constexpr size_t height = 1944;
+
+/** Smooth gradient with sparse noise, compressible like a phase image. */
+std::vector<uint8_t>
+syntheticImage(size_t size) {
+    std::mt19937 rng{42};
+    std::vector<uint8_t> image(size);
+    for (size_t i = 0; i < size; i++) {
+        image[i] = uint8_t(i / width + i % width / 16) ^ ((rng() % 8 == 0) ? rng() % 4 : 0);
+    }
+    return image;
+}
+
+/** Decode the BinData element, and check the Length attribute. */
+std::vector<uint8_t>
+loadXML(size_t expected_size) {
+    std::ifstream xml_file{filename};
+    std::stringstream text;
+    text << xml_file.rdbuf();
+
+    const auto xml = text.str();
+    const std::string prefix{R"(<BinData Compression="zlib" BigEndian="false" Length=")"};
+    const std::string suffix{"</BinData>\n"};
+    REQUIRE(xml.compare(0, prefix.size(), prefix) == 0);
+    REQUIRE(xml.size() > suffix.size());
+    REQUIRE(xml.compare(xml.size() - suffix.size(), suffix.size(), suffix) == 0);
+
+    const size_t length_end = xml.find('"', prefix.size());
+    REQUIRE(xml.compare(length_end, 2, "\">") == 0);
+    const auto length = std::stoul(xml.substr(prefix.size(), length_end - prefix.size()));
+
+    const auto encoded = xml.substr(length_end + 2, xml.size() - suffix.size() - length_end - 2);
+    REQUIRE(length == encoded.size());
+
+    const auto compressed = base64_decode(encoded);
+    std::vector<uint8_t> decoded(expected_size + 1);
+    uLongf decoded_size = decoded.size();
+    REQUIRE(uncompress(decoded.data(), &decoded_size,
+                       reinterpret_cast<const Bytef*>(compressed.data()),
+                       compressed.size()) == Z_OK);
+    decoded.resize(decoded_size);
+    return decoded;
+}
+}  // namespace
+
+SCENARIO("Can stream images to OME BinData") {
+    GIVEN("A 5-Mpixel image") {
+        auto image = syntheticImage(width * height);
+
+        WHEN("Compressed in parallel blocks") {
+            storage::xml_options_t options;
+            options.n_threads = 4;
+            storage::saveXML({image.data(), image.size()}, filename, options);
+
+            THEN("The blocks join into a valid zlib stream") {
+                REQUIRE(loadXML(image.size()) == image);
+            }
+        }
+
+        WHEN("The blocks are not aligned to the base64 triplets") {
+            storage::xml_options_t options;
+            options.block_size = 40000;
+            options.n_threads = 3;
+            options.level = 1;
+            storage::saveXML({image.data(), image.size()}, filename, options);
+
+            THEN("The image is recovered") { REQUIRE(loadXML(image.size()) == image); }
+        }
+    }
+
+    GIVEN("Images shorter than one block") {
+        for (const size_t size : {0, 1, 2, 3, 1000}) {
+            auto image = syntheticImage(size);
+            storage::saveXML({image.data(), image.size()}, filename);
+            REQUIRE(loadXML(size) == image);
+        }
+    }
+}
+
+SCENARIO("Benchmark the BinData encoders", "[.][benchmark]") {
+    auto image = syntheticImage(width * height);
+
+    // Previous implementation: three full-size copies, one thread.
+    BENCHMARK("Single zlib call") {
+        std::vector<uint8_t> compressed(compressBound(image.size()));
+        uLongf compressed_size = compressed.size();
+        compress(compressed.data(), &compressed_size, image.data(), image.size());
+        const auto encoded = base64_encode(compressed.data(), compressed_size, false);
+
+        std::ofstream xml_file{filename};
+        xml_file << R"(<BinData Compression="zlib" BigEndian="false" )"
+                 << "Length=\"" << encoded.size() << "\">" << encoded << "</BinData>\n";
+        return encoded.size();
+    };
+
+    BENCHMARK("Parallel blocks, streamed") {
+        storage::saveXML({image.data(), image.size()}, filename);
+    };
+}
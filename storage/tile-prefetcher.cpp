@@ -0,0 +1,206 @@
+#include "tile-prefetcher.h"
+
+#include <hdf5.h>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <numeric>
+
+namespace {
+
+/** Upper bound of the chunk cache, e.g. for datasets chunked by full frames. */
+constexpr size_t max_cache_bytes = size_t{256} << 20;
+
+/** Number of hash slots of the chunk cache. A prime number, about 100 times
+ * the number of chunks in the cache, as recommended by the HDF5 manual. */
+constexpr size_t n_cache_slots = 12421;
+
+/** Open the dataset with the chunk cache holding one row of tiles.
+ * @param[in] n_frames number of illuminations of the tiles
+ * @param[in] tile_size width of the tiles
+ */
+hid_t
+openDataSet(hid_t file, const char* name, size_t n_frames, size_t tile_size) {
+    const hid_t probe = H5Dopen2(file, name, H5P_DEFAULT);
+    assert(probe >= 0);
+
+    const hid_t dcpl = H5Dget_create_plist(probe);
+    const hid_t space = H5Dget_space(probe);
+    std::array<hsize_t, 4> dims{};
+    std::array<hsize_t, 4> chunk{};
+    const bool is_chunked = H5Pget_layout(dcpl) == H5D_CHUNKED;
+    H5Sget_simple_extent_dims(space, dims.data(), nullptr);
+    if (is_chunked) {
+        H5Pget_chunk(dcpl, 4, chunk.data());
+    }
+    H5Sclose(space);
+    H5Pclose(dcpl);
+    H5Dclose(probe);
+
+    const hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+    if (is_chunked) {
+        // The chunks overlapping a row of tiles, for all the illuminations.
+        const hsize_t frame_chunks = (n_frames + chunk[0] - 1) / chunk[0] + 1;
+        const hsize_t row_chunks = (tile_size + chunk[2] - 1) / chunk[2] + 1;
+        const hsize_t col_chunks = (dims[3] + chunk[3] - 1) / chunk[3];
+        const size_t chunk_bytes = chunk[0] * chunk[1] * chunk[2] * chunk[3];
+
+        const size_t cache_bytes =
+            std::min(max_cache_bytes, frame_chunks * row_chunks * col_chunks * chunk_bytes);
+        H5Pset_chunk_cache(dapl, n_cache_slots, cache_bytes, 1.0);
+    }
+
+    const hid_t dataset = H5Dopen2(file, name, dapl);
+    H5Pclose(dapl);
+    assert(dataset >= 0);
+    return dataset;
+}
+
+}  // namespace
+
+namespace storage {
+
+TilePrefetcher::TilePrefetcher(const HighFive::File& file, std::mutex& m,
+                               std::vector<request_t> r, size_t depth, const DirectReader* d)
+    : hdf5_mutex{m}, requests{std::move(r)}, direct{(d != nullptr && *d) ? d : nullptr} {
+    assert(depth > 0);
+
+    assert(!requests.empty());
+    const size_t tile_size = requests.front().roi.width;
+    size_t n_frames = 0;
+    for (const auto& request : requests) {
+        assert(request.roi.width == tile_size);
+        n_frames = std::max(n_frames, request.frame_id.size());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{hdf5_mutex};
+        dataset = openDataSet(file.getId(), "imlow", n_frames, tile_size);
+    }
+
+    ring.reserve(depth);
+    for (size_t i = 0; i < depth; i++) {
+        ring.emplace_back(tile_size, tile_size, n_frames);
+        free_slots.push_back(i);
+    }
+    staging.resize(tile_size * tile_size * n_frames);
+
+    worker = std::thread{&TilePrefetcher::run, this};
+}
+
+TilePrefetcher::~TilePrefetcher() {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        quit = true;
+    }
+    cv.notify_all();
+    worker.join();
+
+    std::lock_guard<std::mutex> lock{hdf5_mutex};
+    H5Dclose(dataset);
+}
+
+void
+TilePrefetcher::run() {
+    for (const auto& request : requests) {
+        size_t slot;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            cv.wait(lock, [&] { return quit || !free_slots.empty(); });
+            if (quit) {
+                return;
+            }
+            slot = free_slots.front();
+            free_slots.pop_front();
+        }
+
+        readTile(request, ring[slot]);
+
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            ready_slots.push_back(slot);
+        }
+        cv.notify_all();
+    }
+}
+
+void
+TilePrefetcher::readTile(const request_t& request, u8_cube_t& out) {
+    if (direct != nullptr) {
+        direct->readFPMRaw(request.well_id, request.roi, request.frame_id, out);
+        return;
+    }
+
+    const auto& frame_id = request.frame_id;
+    const hsize_t W = request.roi.width;
+    assert(!frame_id.empty());
+    assert(std::all_of(frame_id.begin(), frame_id.end(), [](const auto& id) { return id < 49; }));
+
+    // HDF5 visits the selected blocks in the order of the file, i.e. by
+    // increasing illumination index.
+    std::vector<size_t> sorted_id = frame_id;
+    std::sort(sorted_id.begin(), sorted_id.end());
+    const bool is_sorted = sorted_id == frame_id;
+
+    std::lock_guard<std::mutex> lock{hdf5_mutex};
+
+    const hid_t file_space = H5Dget_space(dataset);
+    H5Sselect_none(file_space);
+    for (const auto id : sorted_id) {
+        const std::array<hsize_t, 4> start{id, request.well_id, request.roi.top, request.roi.left};
+        const std::array<hsize_t, 4> count{1, 1, W, W};
+        H5Sselect_hyperslab(file_space, H5S_SELECT_OR, start.data(), nullptr, count.data(),
+                            nullptr);
+    }
+
+    const std::array<hsize_t, 3> mem_dims{sorted_id.size(), W, W};
+    const hid_t mem_space = H5Screate_simple(3, mem_dims.data(), nullptr);
+
+    uint8_t* dst = is_sorted ? out.data() : staging.data();
+    const herr_t status = H5Dread(dataset, H5T_NATIVE_UINT8, mem_space, file_space, H5P_DEFAULT,
+                                  dst);
+    assert(status >= 0);
+    H5Sclose(mem_space);
+    H5Sclose(file_space);
+
+    if (!is_sorted) {
+        const size_t plane = W * W;
+        for (size_t i = 0; i < frame_id.size(); i++) {
+            const auto j = std::distance(
+                sorted_id.begin(),
+                std::lower_bound(sorted_id.begin(), sorted_id.end(), frame_id[i]));
+            std::memcpy(out.data() + i * plane, staging.data() + j * plane, plane);
+        }
+    }
+}
+
+u8_cube_t
+TilePrefetcher::next() {
+    std::unique_lock<std::mutex> lock{mutex};
+    assert(n_consumed < requests.size());
+    cv.wait(lock, [&] { return !ready_slots.empty(); });
+
+    const size_t slot = ready_slots.front();
+    ready_slots.pop_front();
+
+    const auto n_frames = requests[n_consumed++].frame_id.size();
+    return ring[slot].cropped(2, 0, n_frames);
+}
+
+void
+TilePrefetcher::recycle(const u8_cube_t& buffer) {
+    const auto slot = std::find_if(ring.begin(), ring.end(), [&](const u8_cube_t& b) {
+        return b.data() == buffer.data();
+    });
+    assert(slot != ring.end());
+
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        free_slots.push_back(std::distance(ring.begin(), slot));
+    }
+    cv.notify_all();
+}
+
+}  // namespace storage
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <H5Ipublic.h>
+
+#include <condition_variable>
+#include <deque>
+#include <highfive/H5File.hpp>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "direct-reader.h"
+#include "read-slice.h"
+
+namespace storage {
+
+/** Read the FPM raw images of the tiles ahead of time, on a background thread.
+ *
+ * Each tile is read in one HDF5 selection spanning all its illuminations,
+ * instead of one selection per illumination. The chunk cache of the dataset is
+ * sized to hold the chunks overlapping one row of tiles, such that the
+ * adjacent tiles decompress the shared chunks once.
+ *
+ * The tiles are read into a ring of preallocated buffers. The consumer returns
+ * each buffer with recycle() once done with it; the reader stalls when the
+ * ring is full.
+ */
+class TilePrefetcher {
+   public:
+    struct request_t {
+        size_t well_id{};
+        roi_t roi{};
+
+        /** Illuminations to read, in the order of the output. */
+        std::vector<size_t> frame_id{};
+    };
+
+    /**
+     * @param[in] file HDF5 file with the "imlow" dataset
+     * @param[in] hdf5_mutex serializes the HDF5 calls with the other threads.
+     *     The HDF5 library is not thread-safe.
+     * @param[in] requests tiles to read, in order. Same tile size for all.
+     * @param[in] depth number of buffers in the ring. At least the number of
+     *     tiles held by the consumer, plus one.
+     * @param[in] direct reader of the "imlow" dataset bypassing HDF5, if
+     *     supported; see DirectReader. Optional.
+     */
+    TilePrefetcher(const HighFive::File& file, std::mutex& hdf5_mutex,
+                   std::vector<request_t> requests, size_t depth,
+                   const DirectReader* direct = nullptr);
+    ~TilePrefetcher();
+
+    TilePrefetcher(const TilePrefetcher&) = delete;
+    TilePrefetcher& operator=(const TilePrefetcher&) = delete;
+
+    /** Block until the next tile is read.
+     * @return raw images, dimensions (width, width, frame_id.size())
+     */
+    u8_cube_t next();
+
+    /** Return a buffer obtained from next() to the ring. */
+    void recycle(const u8_cube_t& buffer);
+
+   private:
+    std::mutex& hdf5_mutex;
+    const std::vector<request_t> requests;
+
+    /** Dataset handle with the enlarged chunk cache. */
+    hid_t dataset{-1};
+
+    const DirectReader* direct;
+
+    std::vector<u8_cube_t> ring;
+
+    /** Scratch to reorder the illuminations, see readTile(). */
+    std::vector<uint8_t> staging;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<size_t> free_slots;
+    std::deque<size_t> ready_slots;
+    size_t n_consumed{0};
+    bool quit{false};
+
+    std::thread worker;
+
+    void run();
+    void readTile(const request_t& request, u8_cube_t& out);
+};
+
+}  // namespace storage
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <armadillo>
+#include <highfive/H5DataSet.hpp>
+#include <highfive/H5File.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <taskflow/taskflow.hpp>
+#include <utility>
+#include <vector>
+
+#include "fpm-epry-runtime.h"
+#include "direct-reader.h"
+#include "read-slice.h"
+#include "tile-prefetcher.h"
+
+class WavevectorOverMeniscus;
+
+namespace reconstruction {
+
+/** A square tile of the camera sensor. */
+struct tile_t {
+    storage::roi_t roi{};
+
+    /** Destination layer in the "himr" dataset. Adjacent tiles are written to
+     * different layers, so that the overlapping pixels are preserved for the
+     * blending step. */
+    size_t layer{};
+
+    /** Feathering weights along the x- and y-axis. The weights of the
+     * overlapping tiles add up to one. */
+    arma::fvec weight_x;
+    arma::fvec weight_y;
+};
+
+/** Split the camera sensor into a grid of overlapping tiles.
+ *
+ * The tiles are evenly distributed, such that the first and the last tiles
+ * are aligned to the sensor edges.
+ *
+ * @param[in] width width of the camera sensor
+ * @param[in] height height of the camera sensor
+ * @param[in] tile_size width of the square tiles
+ * @param[in] min_overlap minimum number of overlapping pixels of adjacent tiles
+ */
+std::vector<tile_t> splitSensor(size_t width, size_t height, size_t tile_size,
+                                size_t min_overlap);
+
+/** Centers of the tiles, relative to the center of the camera sensor.
+ * @param[in] pixel_size pixel pitch at the sample plane
+ * @return xy coordinates, the input of the wavevector estimation
+ */
+arma::cx_vec tileCenters(const std::vector<tile_t>& tiles, double pixel_size);
+
+/** Reconstruct the tiles of a well, independently of the storage.
+ *
+ * Holds the tiling of the sensor, and the illuminations and Fourier-domain
+ * offsets of each tile. The caller reads the raw images, e.g. from a local
+ * file or with collective MPI-IO, and writes the results.
+ */
+class TileSolver {
+   public:
+    struct params_t {
+        /** Minimum number of overlapping pixels of adjacent tiles. */
+        size_t overlap{32};
+
+        /** Maximum number of FPM-EPRY iterations. */
+        size_t max_iter{20};
+
+        /** Stop early once the relative change of the residual falls below
+         * the tolerance. Zero to always run max_iter iterations. */
+        float tolerance{0.0f};
+
+        /** Gamma intensity correction of the raw pixels. */
+        float gamma{0.6f};
+
+        /** Update the high-res spectrum in place, one illumination at a time. */
+        update_mode_t update_mode{update_mode_t::FULL_PLANE};
+
+        /** Storage precision of the solver buffers. */
+        precision_t precision{precision_t::SINGLE};
+
+        /** Recover the pupil function once per well, on the seed tile. The
+         * other tiles are warm-started from it, with the pupil locked. */
+        bool seed_pupil{false};
+
+        /** Illuminations to read; all 49 if empty. Visited in the order of
+         * increasing illumination angle, see WavevectorOverMeniscus::imseq. */
+        std::vector<size_t> frame_id{};
+
+        /** Drop the darkfield illuminations, e.g. for a fast preview. */
+        bool brightfield_only{false};
+
+        /** Directory of the cached k-offset tables, see KOffsetTable. Empty
+         * to estimate the illumination angles on every run. */
+        std::string lut_dir{};
+    };
+
+    /**
+     * @param[in] wavevector Illumination angle estimator. The geometry
+     *     parameters must be set.
+     */
+    TileSolver(const WavevectorOverMeniscus& wavevector, params_t params);
+
+    /** The tile closest to the optical axis, where the pupil function is best
+     * estimated. */
+    size_t seedTile() const;
+
+    /** Refine the pupil function of a well on the raw images of the seed tile.
+     * @return the recovered pupil function, to warm-start the other tiles
+     */
+    ComplexBuffer seedPupil(storage::u8_cube_t raw, const ComplexBuffer& pupil) const;
+
+    /** Reconstruct one tile, and apply the feathering weights. */
+    arma::cx_fmat reconstructTile(size_t tile_id, storage::u8_cube_t raw,
+                                  const ComplexBuffer& pupil) const;
+
+    /** Convert the raw images of one tile to the initial guess. The first half
+     * of reconstructTile(). */
+    std::unique_ptr<FPMEpryRunner> initTile(size_t tile_id, storage::u8_cube_t raw,
+                                            const ComplexBuffer& pupil) const;
+
+    /** Run the FPM-EPRY iterations, and apply the feathering weights. The
+     * second half of reconstructTile(). */
+    arma::cx_fmat solveTile(size_t tile_id, FPMEpryRunner& runner) const;
+
+    const params_t& getParams() const { return params; }
+
+    const std::vector<tile_t>& getTiles() const { return tiles; }
+
+    /** Illuminations of the tile, in the order of reconstruction. */
+    const std::vector<size_t>& getFrameId(size_t tile_id) const { return frame_id[tile_id]; }
+
+   protected:
+    const params_t params;
+
+    std::vector<tile_t> tiles;
+
+    /** Illuminations to read, one list per tile. The order depends on the
+     * tile position. */
+    std::vector<std::vector<size_t>> frame_id;
+
+    /** Fourier-domain offsets of the illuminations, one matrix per tile. */
+    std::vector<arma::Mat<int32_t>> k_offset;
+};
+
+/** Reconstruct the full field of view of the wells, tile by tile.
+ *
+ * Only the tiles in flight are held in memory. The raw images are read from
+ * the "imlow" dataset, and the high resolution images are written to the
+ * "himr" dataset.
+ */
+class TiledReconstruction : public TileSolver {
+   public:
+    /**
+     * @param[in] file HDF5 file opened in read-write mode
+     * @param[in] wavevector Illumination angle estimator. The geometry
+     *     parameters must be set.
+     */
+    TiledReconstruction(HighFive::File& file, WavevectorOverMeniscus& wavevector,
+                        params_t params);
+
+    /** Reconstruct all tiles of a well on the thread pool. */
+    void reconstructWell(size_t well_id, tf::Executor& executor);
+
+    /** Read the initial guess of the pupil function of the well. */
+    ComplexBuffer readPupil(size_t well_id);
+
+    /** Pupil function to reconstruct the tiles of the well with.
+     *
+     * Equal to readPupil() by default. With params_t::seed_pupil, refined on
+     * the seed tile.
+     */
+    ComplexBuffer initPupil(size_t well_id);
+
+    /** Read the raw images of one tile. */
+    storage::u8_cube_t readTile(size_t well_id, size_t tile_id);
+
+    /** Read the raw images of the tiles ahead of time, on a background thread.
+     * @param[in] jobs (well_id, tile_id) pairs, in the order of next() calls
+     * @param[in] depth number of preallocated tile buffers
+     */
+    std::unique_ptr<storage::TilePrefetcher> prefetchTiles(
+        const std::vector<std::pair<size_t, size_t>>& jobs, size_t depth);
+
+    /** Write the reconstructed tile to its layer of the "himr" dataset. */
+    void writeTile(size_t well_id, size_t tile_id, const arma::cx_fmat& high_res);
+
+   private:
+    HighFive::File& file;
+    HighFive::DataSet imlow;
+    HighFive::DataSet himr;
+
+    /** The HDF5 library is not thread-safe. */
+    std::mutex file_mutex;
+
+    /** Lock-free reader of the "imlow" dataset, if uncompressed. */
+    const storage::DirectReader direct_imlow;
+};
+
+}  // namespace reconstruction
@@ -0,0 +1,271 @@
+#include "tiled-reconstruction.h"
+
+#include <algorithm>
+#include <cassert>
+#include <complex>
+#include <numeric>
+
+// Patch to encode std::complex<float> in HDF5 file.
+#include "complex_float_support.hpp"
+#include "constants.hpp"
+#include "k-offset-table.hpp"
+#include "wavevector_utility.hpp"
+
+namespace {
+
+constexpr size_t n_illuminations = 49;
+
+/** Evenly distribute the tiles along one axis of the sensor. */
+std::vector<size_t>
+tilePositions(size_t length, size_t tile_size, size_t min_overlap) {
+    assert(length >= tile_size);
+    assert(min_overlap < tile_size);
+
+    const size_t stride = tile_size - min_overlap;
+    const size_t n_tiles = (length - tile_size + stride - 1) / stride + 1;
+
+    std::vector<size_t> position(n_tiles, 0);
+    if (n_tiles == 1) {
+        return position;
+    }
+
+    for (size_t i = 0; i < n_tiles; i++) {
+        position[i] = (i * (length - tile_size) + (n_tiles - 1) / 2) / (n_tiles - 1);
+    }
+
+    return position;
+}
+
+/** Linear ramp over the pixels shared with the neighboring tiles. */
+arma::fvec
+featherWeights(const std::vector<size_t>& position, size_t i, size_t tile_size) {
+    arma::fvec weight(tile_size, arma::fill::ones);
+
+    if (i > 0) {
+        const size_t overlap = position[i - 1] + tile_size - position[i];
+        assert(overlap <= tile_size / 2 && "Tiles of the same layer must not overlap");
+        for (size_t j = 0; j < overlap; j++) {
+            weight(j) = (j + 0.5f) / overlap;
+        }
+    }
+
+    if (i + 1 < position.size()) {
+        const size_t overlap = position[i] + tile_size - position[i + 1];
+        assert(overlap <= tile_size / 2 && "Tiles of the same layer must not overlap");
+        for (size_t j = 0; j < overlap; j++) {
+            weight(tile_size - 1 - j) = (j + 0.5f) / overlap;
+        }
+    }
+
+    return weight;
+}
+
+}  // namespace
+
+namespace reconstruction {
+
+using constants::tile_size;
+
+std::vector<tile_t>
+splitSensor(size_t width, size_t height, size_t tile_size, size_t min_overlap) {
+    const auto left = tilePositions(width, tile_size, min_overlap);
+    const auto top = tilePositions(height, tile_size, min_overlap);
+
+    std::vector<tile_t> tiles;
+    tiles.reserve(left.size() * top.size());
+
+    for (size_t row = 0; row < top.size(); row++) {
+        for (size_t col = 0; col < left.size(); col++) {
+            tiles.emplace_back(tile_t{
+                {left[col], top[row], tile_size},
+                (row % 2) * 2 + (col % 2),
+                featherWeights(left, col, tile_size),
+                featherWeights(top, row, tile_size),
+            });
+        }
+    }
+
+    return tiles;
+}
+
+arma::cx_vec
+tileCenters(const std::vector<tile_t>& tiles, double pixel_size) {
+    arma::cx_vec center(tiles.size());
+    for (size_t t = 0; t < tiles.size(); t++) {
+        const auto& roi = tiles[t].roi;
+        const double x = roi.left + roi.width / 2.0 - constants::width / 2.0;
+        const double y = roi.top + roi.width / 2.0 - constants::height / 2.0;
+        center(t) = arma::cx_double{x, y} * pixel_size;
+    }
+    return center;
+}
+
+TileSolver::TileSolver(const WavevectorOverMeniscus& wavevector, params_t p)
+    : params{[&]() {
+          if (p.frame_id.empty()) {
+              p.frame_id.resize(n_illuminations);
+              std::iota(p.frame_id.begin(), p.frame_id.end(), 0);
+          }
+          return std::move(p);
+      }()},
+      tiles{splitSensor(constants::width, constants::height, tile_size, params.overlap)} {
+    // The illumination angles depend on the tile position only. Estimate them
+    // once for all wells, or load them from the cache.
+    const auto table =
+        KOffsetTable::load(params.lut_dir, wavevector, tileCenters(tiles, wavevector.pixel_size));
+
+    arma::uvec is_selected(wavevector.led_position.n_elem, arma::fill::zeros);
+    is_selected.elem(arma::conv_to<arma::uvec>::from(params.frame_id)).ones();
+
+    frame_id.reserve(tiles.size());
+    k_offset.reserve(tiles.size());
+    for (size_t t = 0; t < tiles.size(); t++) {
+        // Brightfield first, then by increasing illumination angle.
+        const arma::uvec schedule = table.getSchedule(t, params.brightfield_only);
+        const arma::uvec tile_frame_id = schedule.elem(arma::find(is_selected.elem(schedule)));
+
+        frame_id.emplace_back(arma::conv_to<std::vector<size_t>>::from(tile_frame_id));
+        k_offset.emplace_back(table.getOffsets(t, tile_frame_id));
+    }
+}
+
+TiledReconstruction::TiledReconstruction(HighFive::File& f, WavevectorOverMeniscus& wavevector,
+                                         params_t p)
+    : TileSolver{wavevector, std::move(p)},
+      file{f},
+      imlow{f.getDataSet("imlow")},
+      himr{f.getDataSet("himr")},
+      direct_imlow{f, "imlow"} {}
+
+ComplexBuffer
+TiledReconstruction::readPupil(size_t well_id) {
+    ComplexBuffer pupil{2, tile_size, tile_size};
+
+    std::lock_guard<std::mutex> lock{file_mutex};
+    file.getDataSet("initial_pupil")
+        .select({well_id, 0, 0}, {1, tile_size, tile_size})
+        .read(reinterpret_cast<std::complex<float>*>(pupil.data()));
+
+    return pupil;
+}
+
+size_t
+TileSolver::seedTile() const {
+    const auto distance = [](const tile_t& tile) {
+        const double dx = tile.roi.left + tile_size / 2.0 - constants::width / 2.0;
+        const double dy = tile.roi.top + tile_size / 2.0 - constants::height / 2.0;
+        return dx * dx + dy * dy;
+    };
+
+    const auto nearest = std::min_element(
+        tiles.begin(), tiles.end(),
+        [&](const tile_t& a, const tile_t& b) { return distance(a) < distance(b); });
+    return std::distance(tiles.begin(), nearest);
+}
+
+ComplexBuffer
+TileSolver::seedPupil(storage::u8_cube_t raw, const ComplexBuffer& pupil) const {
+    auto runner = initTile(seedTile(), std::move(raw), pupil);
+    runner->reconstruct(params.max_iter, true, params.update_mode, params.tolerance,
+                        fpm_mode_t::PUPIL_RECOVERY);
+
+    ComplexBuffer recovered_pupil{2, tile_size, tile_size};
+    const arma::cx_fmat recovered = runner->downloadPupil();
+    std::copy_n(reinterpret_cast<const float*>(recovered.memptr()), 2 * recovered.n_elem,
+                recovered_pupil.data());
+    return recovered_pupil;
+}
+
+ComplexBuffer
+TiledReconstruction::initPupil(size_t well_id) {
+    auto pupil = readPupil(well_id);
+    if (!params.seed_pupil) {
+        return pupil;
+    }
+
+    return seedPupil(readTile(well_id, seedTile()), pupil);
+}
+
+storage::u8_cube_t
+TiledReconstruction::readTile(size_t well_id, size_t tile_id) {
+    if (direct_imlow) {
+        const auto W = tiles[tile_id].roi.width;
+        storage::u8_cube_t raw(W, W, frame_id[tile_id].size());
+        direct_imlow.readFPMRaw(well_id, tiles[tile_id].roi, frame_id[tile_id], raw);
+        return raw;
+    }
+
+    std::lock_guard<std::mutex> lock{file_mutex};
+    return storage::readFPMRaw(imlow, well_id, tiles[tile_id].roi, frame_id[tile_id]);
+}
+
+std::unique_ptr<storage::TilePrefetcher>
+TiledReconstruction::prefetchTiles(const std::vector<std::pair<size_t, size_t>>& jobs,
+                                   size_t depth) {
+    std::vector<storage::TilePrefetcher::request_t> requests;
+    requests.reserve(jobs.size());
+    for (const auto& [well_id, tile_id] : jobs) {
+        requests.push_back({well_id, tiles[tile_id].roi, frame_id[tile_id]});
+    }
+
+    return std::make_unique<storage::TilePrefetcher>(file, file_mutex, std::move(requests),
+                                                     depth, &direct_imlow);
+}
+
+arma::cx_fmat
+TileSolver::reconstructTile(size_t tile_id, storage::u8_cube_t raw,
+                            const ComplexBuffer& pupil) const {
+    auto runner = initTile(tile_id, std::move(raw), pupil);
+    return solveTile(tile_id, *runner);
+}
+
+std::unique_ptr<FPMEpryRunner>
+TileSolver::initTile(size_t tile_id, storage::u8_cube_t raw, const ComplexBuffer& pupil) const {
+    // The runner updates the pupil function in place.
+    return std::make_unique<FPMEpryRunner>(k_offset[tile_id], pupil.copy(), std::move(raw),
+                                           params.gamma, params.precision);
+}
+
+arma::cx_fmat
+TileSolver::solveTile(size_t tile_id, FPMEpryRunner& runner) const {
+    // The pupil function is already recovered on the seed tile.
+    const auto fpm_mode =
+        params.seed_pupil ? fpm_mode_t::AUTO_BRIGHTNESS : fpm_mode_t::PUPIL_RECOVERY;
+    runner.reconstruct(params.max_iter, true, params.update_mode, params.tolerance, fpm_mode);
+
+    auto high_res = runner.computeHighRes();
+
+    // Row id of the Armadillo matrix is the x-coordinate of the image.
+    const auto& tile = tiles[tile_id];
+    const arma::fmat weight = tile.weight_x * tile.weight_y.t();
+    high_res %= arma::conv_to<arma::cx_fmat>::from(weight);
+
+    return high_res;
+}
+
+void
+TiledReconstruction::writeTile(size_t well_id, size_t tile_id, const arma::cx_fmat& high_res) {
+    const auto& tile = tiles[tile_id];
+    const auto W = tile.roi.width;
+
+    std::lock_guard<std::mutex> lock{file_mutex};
+    himr.select({tile.layer, well_id, tile.roi.top, tile.roi.left}, {1, 1, W, W})
+        .write_raw(high_res.memptr());
+}
+
+void
+TiledReconstruction::reconstructWell(size_t well_id, tf::Executor& executor) {
+    const auto pupil = initPupil(well_id);
+
+    // Each worker streams one tile at a time, from disk to disk.
+    tf::Taskflow taskflow;
+    taskflow.for_each_index(size_t{0}, tiles.size(), size_t{1}, [&](size_t tile_id) {
+        auto raw = readTile(well_id, tile_id);
+        const auto high_res = reconstructTile(tile_id, std::move(raw), pupil);
+        writeTile(well_id, tile_id, high_res);
+    });
+
+    executor.run(taskflow).wait();
+}
+
+}  // namespace reconstruction
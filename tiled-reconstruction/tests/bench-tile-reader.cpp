@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <cstring>
+#include <highfive/H5File.hpp>
+#include <mutex>
+#include <numeric>
+
+#include "constants.hpp"
+#include "direct-reader.h"
+#include "read-slice.h"
+#include "tile-prefetcher.h"
+#include "tiled-reconstruction.h"
+
+using constants::tile_size;
+using storage::TilePrefetcher;
+
+namespace {
+constexpr char filename[]{HDF5_FILE_PATH};
+constexpr size_t well_id = 5;
+constexpr size_t n_illuminations = 49;
+
+/** All illuminations of all tiles of the well, in the given order. */
+std::vector<TilePrefetcher::request_t>
+requestWell(const std::vector<size_t>& frame_id) {
+    const auto tiles =
+        reconstruction::splitSensor(constants::width, constants::height, tile_size, 32);
+
+    std::vector<TilePrefetcher::request_t> requests;
+    for (const auto& tile : tiles) {
+        requests.push_back({well_id, tile.roi, frame_id});
+    }
+    return requests;
+}
+}  // namespace
+
+SCENARIO("Can prefetch the raw images tile by tile") {
+    auto file = HighFive::File(filename, HighFive::File::ReadOnly);
+    std::mutex hdf5_mutex;
+
+    GIVEN("Illuminations out of the file order") {
+        std::vector<size_t> frame_id(n_illuminations);
+        std::iota(frame_id.rbegin(), frame_id.rend(), 0);
+        const auto requests = requestWell(frame_id);
+
+        WHEN("Prefetch the tiles of a well") {
+            TilePrefetcher prefetcher{file, hdf5_mutex, requests, 3};
+
+            THEN("The tiles match the per-illumination reader") {
+                const auto dataset = file.getDataSet("imlow");
+                for (const auto& request : requests) {
+                    const auto raw = prefetcher.next();
+                    REQUIRE(raw.dim(2).extent() == int(n_illuminations));
+
+                    const auto expected =
+                        storage::readFPMRaw(dataset, well_id, request.roi, request.frame_id);
+                    REQUIRE(std::memcmp(raw.data(), expected.data(), expected.size_in_bytes()) ==
+                            0);
+                    prefetcher.recycle(raw);
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Can read the raw images bypassing HDF5") {
+    auto file = HighFive::File(filename, HighFive::File::ReadOnly);
+    const storage::DirectReader direct{file, "imlow"};
+
+    GIVEN("An uncompressed dataset") {
+        if (!direct) {
+            SUCCEED("Compressed dataset; the HDF5 reader is used instead.");
+            return;
+        }
+
+        std::vector<size_t> frame_id(n_illuminations);
+        std::iota(frame_id.rbegin(), frame_id.rend(), 0);
+
+        THEN("The tiles match the HDF5 reader") {
+            const auto dataset = file.getDataSet("imlow");
+            storage::u8_cube_t raw(tile_size, tile_size, n_illuminations);
+            for (const auto& request : requestWell(frame_id)) {
+                direct.readFPMRaw(well_id, request.roi, frame_id, raw);
+
+                const auto expected = storage::readFPMRaw(dataset, well_id, request.roi, frame_id);
+                REQUIRE(std::memcmp(raw.data(), expected.data(), expected.size_in_bytes()) == 0);
+            }
+        }
+    }
+}
+
+SCENARIO("Benchmark the raw image readers", "[.][benchmark]") {
+    auto file = HighFive::File(filename, HighFive::File::ReadOnly);
+    const auto dataset = file.getDataSet("imlow");
+    std::mutex hdf5_mutex;
+
+    std::vector<size_t> frame_id(n_illuminations);
+    std::iota(frame_id.begin(), frame_id.end(), 0);
+    const auto requests = requestWell(frame_id);
+
+    // Throughput: requests.size() * 49 * 256 * 256 bytes per run.
+    BENCHMARK("One selection per illumination") {
+        size_t checksum = 0;
+        for (const auto& request : requests) {
+            checksum += storage::readFPMRaw(dataset, well_id, request.roi, frame_id).data()[0];
+        }
+        return checksum;
+    };
+
+    BENCHMARK("One selection per tile, prefetched") {
+        TilePrefetcher prefetcher{file, hdf5_mutex, requests, 3};
+        size_t checksum = 0;
+        for (size_t i = 0; i < requests.size(); i++) {
+            const auto raw = prefetcher.next();
+            checksum += raw.data()[0];
+            prefetcher.recycle(raw);
+        }
+        return checksum;
+    };
+
+    const storage::DirectReader direct{file, "imlow"};
+    if (direct) {
+        BENCHMARK("Memory-mapped, bypassing HDF5") {
+            storage::u8_cube_t raw(tile_size, tile_size, n_illuminations);
+            size_t checksum = 0;
+            for (const auto& request : requests) {
+                direct.readFPMRaw(well_id, request.roi, frame_id, raw);
+                checksum += raw.data()[0];
+            }
+            return checksum;
+        };
+    }
+}
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <armadillo>
+#include <catch2/catch_test_macros.hpp>
+
+#include "constants.hpp"
+#include "default-geometry.hpp"
+#include "tiled-reconstruction.h"
+
+using namespace arma;
+using constants::tile_size;
+
+SCENARIO("Can split the camera sensor into overlapping tiles", "[tiles]") {
+    GIVEN("Full sensor dimensions") {
+        constexpr size_t width = constants::width;
+        constexpr size_t height = constants::height;
+        constexpr size_t min_overlap = 32;
+
+        WHEN("Split into tiles") {
+            const auto tiles = reconstruction::splitSensor(width, height, tile_size, min_overlap);
+            REQUIRE(!tiles.empty());
+
+            THEN("Tiles are within the sensor") {
+                for (const auto& tile : tiles) {
+                    REQUIRE(tile.roi.width == tile_size);
+                    REQUIRE(tile.roi.left + tile_size <= width);
+                    REQUIRE(tile.roi.top + tile_size <= height);
+                    REQUIRE(tile.layer < 4);
+                }
+            }
+
+            THEN("Feathering weights add up to one over the full sensor") {
+                fmat total(width, height, fill::zeros);
+                std::array<umat, 4> coverage;
+                coverage.fill(umat(width, height, fill::zeros));
+
+                for (const auto& tile : tiles) {
+                    const auto& [left, top, w] = tile.roi;
+                    total.submat(left, top, size(w, w)) += tile.weight_x * tile.weight_y.t();
+                    coverage[tile.layer].submat(left, top, size(w, w)) += 1;
+                }
+
+                REQUIRE(approx_equal(total, fmat(width, height, fill::ones), "absdiff", 1e-5f));
+
+                AND_THEN("Tiles of the same layer do not overlap") {
+                    for (const auto& c : coverage) {
+                        REQUIRE(c.max() == 1);
+                    }
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Can plan the tiles without a data file", "[tiles]") {
+    GIVEN("The default illumination geometry") {
+        WavevectorOverMeniscus wavevector{geometry::n_leds};
+        geometry::setDefault(wavevector);
+
+        WHEN("Plan the reconstruction of all illuminations") {
+            const reconstruction::TileSolver solver{wavevector, {}};
+            const auto& tiles = solver.getTiles();
+
+            THEN("Every tile visits all illuminations once") {
+                for (size_t t = 0; t < tiles.size(); t++) {
+                    auto frame_id = solver.getFrameId(t);
+                    std::sort(frame_id.begin(), frame_id.end());
+                    REQUIRE(frame_id.size() == geometry::n_leds);
+                    REQUIRE(std::adjacent_find(frame_id.begin(), frame_id.end()) ==
+                            frame_id.end());
+                }
+            }
+
+            THEN("The seed tile covers the center of the sensor") {
+                const auto& roi = tiles[solver.seedTile()].roi;
+                REQUIRE(roi.left <= constants::width / 2);
+                REQUIRE(roi.left + roi.width >= constants::width / 2);
+                REQUIRE(roi.top <= constants::height / 2);
+                REQUIRE(roi.top + roi.width >= constants::height / 2);
+            }
+        }
+
+        WHEN("Plan a fast preview") {
+            reconstruction::TileSolver::params_t params{};
+            params.brightfield_only = true;
+            const reconstruction::TileSolver solver{wavevector, params};
+
+            THEN("Only the brightfield illuminations are visited") {
+                for (size_t t = 0; t < solver.getTiles().size(); t++) {
+                    const auto n_frames = solver.getFrameId(t).size();
+                    REQUIRE(n_frames > 0);
+                    REQUIRE(n_frames < geometry::n_leds);
+                }
+            }
+        }
+    }
+}
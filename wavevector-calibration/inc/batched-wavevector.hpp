@@ -0,0 +1,54 @@
+#pragma once
+
+#include <armadillo>
+#include <vector>
+
+#include "wavevector_utility.hpp"
+
+/** Estimate the Fourier-domain offsets of all LEDs for many tile positions at
+ * once.
+ *
+ * Same model as WavevectorOverMeniscus::solve(), restructured for throughput:
+ * the (tile, LED) pairs are laid out in structure-of-arrays form, and the
+ * fixed-point iterations sweep over the contiguous arrays. The loops are free
+ * of branches and allocations, so that the compiler vectorizes them. The
+ * scratch arrays are allocated once, and reused for batches of the same size.
+ */
+class BatchedWavevector {
+   public:
+    /** Copy the geometry parameters and the LED positions from the engine. */
+    explicit BatchedWavevector(const WavevectorOverMeniscus& geometry);
+
+    /** Estimate the Fourier-domain offsets of all LEDs.
+     * @param[in] tile_position xy coordinates of the tiles from the center of
+     * field-of-view
+     * @param[out] k_offset pixel offsets, dimensions (2, n_leds, n_tiles), in
+     * the capture order of the LEDs. Same as WavevectorOverMeniscus::getOffset().
+     * @return true if the solution converges for all tiles.
+     */
+    bool solve(const arma::cx_vec& tile_position, arma::Cube<int32_t>& k_offset);
+
+    /** Order the LEDs of each tile of the last solve(). Same as
+     * WavevectorOverMeniscus::getSchedule().
+     * @param[out] schedule LED indices, dimensions (n_leds, n_tiles),
+     * brightfield first
+     * @param[out] n_brightfield number of brightfield LEDs of each tile
+     */
+    void getSchedules(arma::umat& schedule, arma::uvec& n_brightfield) const;
+
+    const arma::uword n_leds;
+
+   private:
+    const double meniscus_factor, led_height, medium_height, medium_refractive_index;
+    const double numerical_aperture;
+    const double tile_width, pixel_size, wavelength, zeropad_factor;
+
+    /** LED positions, split into the real and imaginary components. */
+    std::vector<double> led_x, led_y;
+
+    /** Scratch arrays, one element per (LED, tile) pair. LED index is the
+     * fastest varying. */
+    std::vector<double> rel_x, rel_y, radius, delta, next_delta;
+
+    void resize(size_t n);
+};
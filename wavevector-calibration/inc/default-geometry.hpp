@@ -0,0 +1,42 @@
+#pragma once
+
+#include "wavevector_utility.hpp"
+
+namespace geometry {
+
+constexpr unsigned n_leds = 49;
+
+/** Illumination geometry of the 96-Eyes instrument.
+ *
+ * The LED positions are listed in the capture order of the "imlow" dataset,
+ * i.e. spiral outwards from the center LED.
+ */
+inline void
+setDefault(WavevectorOverMeniscus& engine) {
+    engine.led_position = {
+        {0., 0.},        {0., -0.003},     {0.003, 0.},      {0., 0.003},
+        {-0.003, 0.},    {-0.003, -0.003}, {0.003, -0.003},  {0.003, 0.003},
+        {-0.003, 0.003}, {0., -0.006},     {0.006, 0.},      {0., 0.006},
+        {-0.006, 0.},    {-0.006, -0.003}, {-0.003, -0.006}, {0.003, -0.006},
+        {0.006, -0.003}, {0.006, 0.003},   {0.003, 0.006},   {-0.003, 0.006},
+        {-0.006, 0.003}, {-0.006, -0.006}, {0.006, -0.006},  {0.006, 0.006},
+        {-0.006, 0.006}, {0., -0.009},     {0.009, 0.},      {0., 0.009},
+        {-0.009, 0.},    {-0.009, -0.003}, {-0.003, -0.009}, {0.003, -0.009},
+        {0.009, -0.003}, {0.009, 0.003},   {0.003, 0.009},   {-0.003, 0.009},
+        {-0.009, 0.003}, {-0.009, -0.006}, {-0.006, -0.009}, {0.006, -0.009},
+        {0.009, -0.006}, {0.009, 0.006},   {0.006, 0.009},   {-0.006, 0.009},
+        {-0.009, 0.006}, {-0.009, -0.009}, {0.009, -0.009},  {0.009, 0.009},
+        {-0.009, 0.009}};
+
+    engine.led_height = 33e-3;
+    engine.medium_height = 3e-3;
+    engine.medium_refractive_index = 1.33;
+    engine.numerical_aperture = 0.23;
+
+    engine.tile_width = 256;
+    engine.pixel_size = 0.4375e-6;
+    engine.wavelength = 533e-9;
+    engine.zeropad_factor = 2;
+}
+
+}  // namespace geometry
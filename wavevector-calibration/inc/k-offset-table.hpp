@@ -0,0 +1,67 @@
+#pragma once
+
+#include <armadillo>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "wavevector_utility.hpp"
+
+/** Precomputed illumination schedules and Fourier-domain offsets of all the
+ * tiles of the sensor.
+ *
+ * The table depends on the geometry parameters and the tile positions only,
+ * which change with the plate type or the protocol. It is cached in a sidecar
+ * file named after the hash of the inputs, and memory-mapped by the later
+ * reconstruction jobs, such that they skip the calibration entirely.
+ */
+class KOffsetTable {
+   public:
+    /** Load the table from the cache, or solve and cache it on a miss.
+     * @param[in] cache_dir directory of the sidecar files. Empty to solve
+     * without caching.
+     * @param[in] wavevector the engine, with the geometry parameters set
+     * @param[in] tile_position xy coordinates of the tiles from the center of
+     * field-of-view
+     */
+    static KOffsetTable load(const std::string& cache_dir,
+                             const WavevectorOverMeniscus& wavevector,
+                             const arma::cx_vec& tile_position);
+
+    /** Solve the wavevectors of all tiles in one batch, see BatchedWavevector,
+     * without caching. */
+    static KOffsetTable solve(const WavevectorOverMeniscus& wavevector,
+                              const arma::cx_vec& tile_position);
+
+    /** Hash of the inputs of the table, i.e. the geometry parameters, the LED
+     * positions and the tile positions, and of the solver version. */
+    static uint64_t key(const WavevectorOverMeniscus& wavevector,
+                        const arma::cx_vec& tile_position);
+
+    /** Same as WavevectorOverMeniscus::getSchedule(), for the tile_id-th tile. */
+    arma::uvec getSchedule(size_t tile_id, bool brightfield_only = false) const;
+
+    /** Same as WavevectorOverMeniscus::getOffsets(), for the tile_id-th tile. */
+    arma::Mat<int32_t> getOffsets(size_t tile_id, const arma::uvec& frame_id) const;
+
+    size_t nTiles() const;
+    size_t nLeds() const;
+
+    /** True if memory-mapped from a sidecar file. */
+    bool isMapped() const { return mapped; }
+
+   private:
+    struct header_t;
+
+    KOffsetTable(std::shared_ptr<const uint8_t> data, bool mapped);
+
+    const header_t& header() const;
+    const int32_t* offsets(size_t tile_id) const;
+    const uint32_t* schedule(size_t tile_id) const;
+
+    /** The sidecar file layout: the header, the offsets (2, n_leds, n_tiles),
+     * the schedules (n_leds, n_tiles) and the number of brightfield images per
+     * tile. Either heap-allocated or memory-mapped. */
+    std::shared_ptr<const uint8_t> data;
+    bool mapped{false};
+};
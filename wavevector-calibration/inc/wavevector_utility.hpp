@@ -1,3 +1,5 @@
+#pragma once
+
 #include <armadillo>
 
 /** Compute the Fourier-domain offsets of each low-resolution images due to
@@ -42,6 +44,22 @@ class WavevectorOverMeniscus {
      */
     arma::uvec::fixed<2> getOffset(unsigned short i) const;
 
+    /** Obtain the illuminations to reconstruct, brightfield first. Each group
+     * follows the order of imseq, i.e. by increasing radius, then by angle.
+     * The brightfield images carry the low-frequency content, so that EPRY
+     * converges in fewer iterations.
+     * @param[in] brightfield_only drop the darkfield images, e.g. for a fast
+     * preview
+     * @return the low resolution image indices
+     */
+    arma::uvec getSchedule(bool brightfield_only = false) const;
+
+    /** Obtain the pixel offsets of the low resolution images
+     * @param[in] frame_id the low resolution image indices, e.g. from getSchedule()
+     * @return the pixel offsets, dimensions (2, frame_id.n_elem)
+     */
+    arma::Mat<int32_t> getOffsets(const arma::uvec& frame_id) const;
+
     /** Obtain the mask for the pupil function
      * @param[out] out the pixel offset
      */
@@ -0,0 +1,162 @@
+#include "batched-wavevector.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+BatchedWavevector::BatchedWavevector(const WavevectorOverMeniscus& geometry)
+    : n_leds{geometry.led_position.n_elem},
+      meniscus_factor{geometry.meniscus_factor},
+      led_height{geometry.led_height},
+      medium_height{geometry.medium_height},
+      medium_refractive_index{geometry.medium_refractive_index},
+      numerical_aperture{geometry.numerical_aperture},
+      tile_width{geometry.tile_width},
+      pixel_size{geometry.pixel_size},
+      wavelength{geometry.wavelength},
+      zeropad_factor{geometry.zeropad_factor},
+      led_x(n_leds),
+      led_y(n_leds) {
+    for (arma::uword i = 0; i < n_leds; i++) {
+        led_x[i] = geometry.led_position(i).real();
+        led_y[i] = geometry.led_position(i).imag();
+    }
+}
+
+void
+BatchedWavevector::resize(size_t n) {
+    // No-op when the batch size is unchanged, e.g. same tiling for every well.
+    rel_x.resize(n);
+    rel_y.resize(n);
+    radius.resize(n);
+    delta.resize(n);
+    next_delta.resize(n);
+}
+
+bool
+BatchedWavevector::solve(const arma::cx_vec& tile_position, arma::Cube<int32_t>& k_offset) {
+    const size_t n_tiles = tile_position.n_elem;
+    const size_t n = n_tiles * n_leds;
+    resize(n);
+
+    // Relative position of the LEDs, as seen through the meniscus.
+    for (size_t t = 0; t < n_tiles; t++) {
+        const double tile_x = tile_position(t).real() * meniscus_factor;
+        const double tile_y = tile_position(t).imag() * meniscus_factor;
+        double* __restrict x = rel_x.data() + t * n_leds;
+        double* __restrict y = rel_y.data() + t * n_leds;
+        for (size_t i = 0; i < n_leds; i++) {
+            x[i] = led_x[i] - tile_x;
+            y[i] = led_y[i] - tile_y;
+        }
+    }
+
+    {
+        const double* __restrict x = rel_x.data();
+        const double* __restrict y = rel_y.data();
+        double* __restrict r = radius.data();
+        double* __restrict d = delta.data();
+        const double t_over_h = medium_height / led_height;
+        for (size_t j = 0; j < n; j++) {
+            r[j] = std::sqrt(x[j] * x[j] + y[j] * y[j]);
+            d[j] = r[j] * t_over_h;
+        }
+    }
+
+    // Fixed-point iterations, see find_k() in wavevector_utility.cpp. The
+    // whole batch is iterated until every (tile, LED) pair converges.
+    const double hmt2 = (led_height - medium_height) * (led_height - medium_height);
+    const double t2 = medium_height * medium_height;
+    const double inv_n = 1.0 / medium_refractive_index;
+    constexpr double tolerance = 5e-6;
+    constexpr int max_iter = 20;
+
+    bool converged = false;
+    for (int iter = 0; iter < max_iter && !converged; iter++) {
+        const double* __restrict r = radius.data();
+        const double* __restrict d = delta.data();
+        double* __restrict d_new = next_delta.data();
+
+        size_t n_active = 0;
+        for (size_t j = 0; j < n; j++) {
+            const double xmd2 = (r[j] - d[j]) * (r[j] - d[j]);
+            d_new[j] = std::sqrt(xmd2 / (xmd2 + hmt2) * (t2 + d[j] * d[j])) * inv_n;
+
+            const double error =
+                std::abs(d_new[j] - d[j]) / (d_new[j] + std::numeric_limits<double>::epsilon());
+            n_active += (error >= tolerance);
+        }
+
+        converged = (n_active == 0);
+        if (!converged) {
+            std::swap(delta, next_delta);
+        }
+    }
+
+    // Map to pixels in FFT space, see WavevectorOverMeniscus::getOffset().
+    k_offset.set_size(2, n_leds, n_tiles);
+    {
+        const double* __restrict x = rel_x.data();
+        const double* __restrict y = rel_y.data();
+        const double* __restrict r = radius.data();
+        const double* __restrict d = delta.data();
+        int32_t* __restrict out = k_offset.memptr();
+
+        const double scale = tile_width * pixel_size / wavelength;
+        const double center = tile_width * (zeropad_factor - 1) * 0.5;
+        for (size_t j = 0; j < n; j++) {
+            const double k =
+                d[j] / std::sqrt(d[j] * d[j] + t2) * medium_refractive_index * scale;
+            const double inv_r = 1.0 / (r[j] + std::numeric_limits<double>::epsilon());
+            out[2 * j] = static_cast<int32_t>(x[j] * inv_r * k + center);
+            out[2 * j + 1] = static_cast<int32_t>(y[j] * inv_r * k + center);
+        }
+    }
+
+    return converged;
+}
+
+void
+BatchedWavevector::getSchedules(arma::umat& schedule, arma::uvec& n_brightfield) const {
+    const size_t n_tiles = n_leds ? radius.size() / n_leds : 0;
+    schedule.set_size(n_leds, n_tiles);
+    n_brightfield.set_size(n_tiles);
+
+    const double t2 = medium_height * medium_height;
+    std::vector<double> k(n_leds), sort_key(n_leds);
+    std::vector<arma::uword> imseq(n_leds);
+    for (size_t t = 0; t < n_tiles; t++) {
+        const size_t first = t * n_leds;
+        for (size_t i = 0; i < n_leds; i++) {
+            const double d = delta[first + i];
+            k[i] = d / std::sqrt(d * d + t2) * medium_refractive_index;
+        }
+
+        // Sort by the rings of the wavevector, as multiples of the second
+        // smallest one, and then by angle, see WavevectorOverMeniscus::solve().
+        std::vector<double> sorted_k = k;
+        std::nth_element(sorted_k.begin(), sorted_k.begin() + 1, sorted_k.end());
+        const double k_ring = sorted_k[1];
+        for (size_t i = 0; i < n_leds; i++) {
+            const double angle = std::atan2(rel_y[first + i], rel_x[first + i]);
+            sort_key[i] = std::round(k[i] / k_ring) + angle / arma::datum::pi / 2;
+        }
+        std::iota(imseq.begin(), imseq.end(), 0);
+        std::stable_sort(imseq.begin(), imseq.end(),
+                         [&](arma::uword a, arma::uword b) { return sort_key[a] < sort_key[b]; });
+
+        // Stable partition: brightfield first, see
+        // WavevectorOverMeniscus::isBrightfield().
+        const auto isBrightfield = [&](arma::uword i) {
+            const double r = radius[first + i];
+            return r / (r + std::numeric_limits<double>::epsilon()) * k[i] <
+                   numerical_aperture * 0.9;
+        };
+        const auto middle = std::stable_partition(imseq.begin(), imseq.end(), isBrightfield);
+
+        std::copy(imseq.begin(), imseq.end(), schedule.colptr(t));
+        n_brightfield(t) = std::distance(imseq.begin(), middle);
+    }
+}
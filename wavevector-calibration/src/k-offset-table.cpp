@@ -0,0 +1,255 @@
+#include "k-offset-table.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "batched-wavevector.hpp"
+
+struct KOffsetTable::header_t {
+    char magic[8];
+    uint64_t key;
+    uint32_t n_tiles;
+    uint32_t n_leds;
+};
+
+namespace {
+
+/** Format, and solver, of the sidecar files. Bump both whenever the solver
+ * changes its output, e.g. 2: solved by BatchedWavevector. The tables of the
+ * earlier solvers are then rejected, and solved again. */
+constexpr char magic[8] = {'K', 'O', 'F', 'F', 'S', 'E', 'T', '2'};
+constexpr uint32_t solver_version = 2;
+
+/** Size of the header, padded to keep the tables aligned. */
+constexpr size_t header_size = 32;
+
+/** FNV-1a hash. */
+class Hasher {
+   public:
+    template <typename T>
+    void update(const T* ptr, size_t n) {
+        const auto* bytes = reinterpret_cast<const uint8_t*>(ptr);
+        for (size_t i = 0; i < n * sizeof(T); i++) {
+            state = (state ^ bytes[i]) * 0x100000001b3ULL;
+        }
+    }
+
+    template <typename T>
+    void update(const T& value) {
+        update(&value, 1);
+    }
+
+    uint64_t digest() const { return state; }
+
+   private:
+    uint64_t state{0xcbf29ce484222325ULL};
+};
+
+std::string
+sidecarPath(const std::string& cache_dir, uint64_t key) {
+    char filename[32];
+    std::snprintf(filename, sizeof(filename), "k-offset-%016llx.lut",
+                  static_cast<unsigned long long>(key));
+    return cache_dir + "/" + filename;
+}
+
+size_t
+tableSize(size_t n_tiles, size_t n_leds) {
+    return header_size + n_tiles * n_leds * 2 * sizeof(int32_t) +
+           n_tiles * n_leds * sizeof(uint32_t) + n_tiles * sizeof(uint32_t);
+}
+
+/** Map the sidecar file read-only. @return nullptr if missing or corrupted. */
+std::shared_ptr<const uint8_t>
+mapSidecar(const std::string& path, uint64_t key, size_t n_tiles, size_t n_leds) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    const size_t size = tableSize(n_tiles, n_leds);
+    struct stat st {};
+    void* ptr = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && size_t(st.st_size) == size) {
+        ptr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    // The mapping stays valid after closing the file descriptor.
+    ::close(fd);
+
+    if (ptr == MAP_FAILED) {
+        return nullptr;
+    }
+
+    std::shared_ptr<const uint8_t> data{static_cast<const uint8_t*>(ptr),
+                                        [size](const uint8_t* p) {
+                                            ::munmap(const_cast<uint8_t*>(p), size);
+                                        }};
+
+    uint64_t mapped_key;
+    std::memcpy(&mapped_key, data.get() + sizeof(magic), sizeof(mapped_key));
+    if (std::memcmp(data.get(), magic, sizeof(magic)) != 0 || mapped_key != key) {
+        return nullptr;
+    }
+
+    return data;
+}
+
+/** Write to a temporary file, then rename, so that concurrent jobs never map
+ * a partial table. */
+bool
+writeSidecar(const std::string& path, const uint8_t* data, size_t size) {
+    const std::string tmp_path = path + ".tmp." + std::to_string(::getpid());
+    FILE* f = std::fopen(tmp_path.c_str(), "wb");
+    if (f == nullptr) {
+        return false;
+    }
+
+    const bool success = std::fwrite(data, 1, size, f) == size;
+    if (std::fclose(f) != 0 || !success) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+}  // namespace
+
+KOffsetTable::KOffsetTable(std::shared_ptr<const uint8_t> d, bool m)
+    : data{std::move(d)}, mapped{m} {}
+
+uint64_t
+KOffsetTable::key(const WavevectorOverMeniscus& w, const arma::cx_vec& tile_position) {
+    Hasher h;
+    h.update(solver_version);
+    for (const double param :
+         {w.meniscus_factor, w.led_height, w.medium_height, w.medium_refractive_index,
+          w.numerical_aperture, w.tile_width, w.pixel_size, w.wavelength, w.zeropad_factor}) {
+        h.update(param);
+    }
+
+    h.update(w.led_position.memptr(), w.led_position.n_elem);
+    h.update(tile_position.memptr(), tile_position.n_elem);
+    return h.digest();
+}
+
+KOffsetTable
+KOffsetTable::solve(const WavevectorOverMeniscus& wavevector, const arma::cx_vec& tile_position) {
+    const size_t n_tiles = tile_position.n_elem;
+    const size_t n_leds = wavevector.led_position.n_elem;
+
+    const size_t size = tableSize(n_tiles, n_leds);
+    std::shared_ptr<uint8_t> buffer{new uint8_t[size](), std::default_delete<uint8_t[]>()};
+
+    header_t h{};
+    std::memcpy(h.magic, magic, sizeof(magic));
+    h.key = key(wavevector, tile_position);
+    h.n_tiles = n_tiles;
+    h.n_leds = n_leds;
+    std::memcpy(buffer.get(), &h, sizeof(h));
+
+    auto* offset_ptr = reinterpret_cast<int32_t*>(buffer.get() + header_size);
+    auto* schedule_ptr = reinterpret_cast<uint32_t*>(offset_ptr + n_tiles * n_leds * 2);
+    auto* n_brightfield_ptr = schedule_ptr + n_tiles * n_leds;
+
+    // All tiles at once; the offsets are laid out as (2, n_leds, n_tiles)
+    // already.
+    BatchedWavevector batch{wavevector};
+    arma::Cube<int32_t> offset;
+    if (!batch.solve(tile_position, offset)) {
+        std::cerr << "Warning: wavevector estimation does not converge for all tiles\n";
+    }
+    std::copy(offset.begin(), offset.end(), offset_ptr);
+
+    arma::umat schedule;
+    arma::uvec n_brightfield;
+    batch.getSchedules(schedule, n_brightfield);
+    std::copy(schedule.begin(), schedule.end(), schedule_ptr);
+    std::copy(n_brightfield.begin(), n_brightfield.end(), n_brightfield_ptr);
+
+    return {std::move(buffer), false};
+}
+
+KOffsetTable
+KOffsetTable::load(const std::string& cache_dir, const WavevectorOverMeniscus& wavevector,
+                   const arma::cx_vec& tile_position) {
+    if (cache_dir.empty()) {
+        return solve(wavevector, tile_position);
+    }
+
+    const uint64_t k = key(wavevector, tile_position);
+    const auto path = sidecarPath(cache_dir, k);
+    const size_t n_leds = wavevector.led_position.n_elem;
+
+    if (auto data = mapSidecar(path, k, tile_position.n_elem, n_leds)) {
+        return {std::move(data), true};
+    }
+
+    auto table = solve(wavevector, tile_position);
+    if (!writeSidecar(path, table.data.get(), tableSize(tile_position.n_elem, n_leds))) {
+        std::cerr << "Warning: cannot cache the k-offset table to " << path << '\n';
+    }
+    return table;
+}
+
+const KOffsetTable::header_t&
+KOffsetTable::header() const {
+    static_assert(sizeof(header_t) <= header_size);
+    return *reinterpret_cast<const header_t*>(data.get());
+}
+
+size_t
+KOffsetTable::nTiles() const {
+    return header().n_tiles;
+}
+
+size_t
+KOffsetTable::nLeds() const {
+    return header().n_leds;
+}
+
+const int32_t*
+KOffsetTable::offsets(size_t tile_id) const {
+    assert(tile_id < nTiles());
+    return reinterpret_cast<const int32_t*>(data.get() + header_size) + tile_id * nLeds() * 2;
+}
+
+const uint32_t*
+KOffsetTable::schedule(size_t tile_id) const {
+    assert(tile_id < nTiles());
+    const auto* schedule_begin =
+        reinterpret_cast<const uint32_t*>(offsets(0) + nTiles() * nLeds() * 2);
+    return schedule_begin + tile_id * nLeds();
+}
+
+arma::uvec
+KOffsetTable::getSchedule(size_t tile_id, bool brightfield_only) const {
+    const uint32_t* s = schedule(tile_id);
+    const uint32_t* n_brightfield = schedule(0) + nTiles() * nLeds();
+    const size_t n = brightfield_only ? n_brightfield[tile_id] : nLeds();
+
+    arma::uvec out(n);
+    std::copy(s, s + n, out.begin());
+    return out;
+}
+
+arma::Mat<int32_t>
+KOffsetTable::getOffsets(size_t tile_id, const arma::uvec& frame_id) const {
+    const int32_t* o = offsets(tile_id);
+
+    arma::Mat<int32_t> out(2, frame_id.n_elem);
+    for (arma::uword i = 0; i < frame_id.n_elem; i++) {
+        assert(frame_id(i) < nLeds());
+        out(0, i) = o[frame_id(i) * 2];
+        out(1, i) = o[frame_id(i) * 2 + 1];
+    }
+    return out;
+}
@@ -65,6 +65,41 @@ WavevectorOverMeniscus::getOffset(unsigned short i) const {
     return out;
 }
 
+arma::uvec
+WavevectorOverMeniscus::getSchedule(bool brightfield_only) const {
+    assert(imseq.n_elem == led_position.n_elem && "Call solve() first");
+
+    // Stable partition: brightfield first, then darkfield, each in the order
+    // of imseq.
+    arma::uvec schedule(imseq.n_elem);
+    arma::uword n = 0;
+    for (const auto i : imseq) {
+        if (isBrightfield(i)) {
+            schedule(n++) = i;
+        }
+    }
+
+    if (!brightfield_only) {
+        for (const auto i : imseq) {
+            if (!isBrightfield(i)) {
+                schedule(n++) = i;
+            }
+        }
+    }
+
+    return schedule.head(n);
+}
+
+arma::Mat<int32_t>
+WavevectorOverMeniscus::getOffsets(const arma::uvec& frame_id) const {
+    arma::Mat<int32_t> offset(2, frame_id.n_elem);
+    for (arma::uword i = 0; i < frame_id.n_elem; i++) {
+        offset.col(i) = arma::conv_to<arma::Col<int32_t>>::from(getOffset(frame_id(i)));
+    }
+
+    return offset;
+}
+
 bool
 WavevectorOverMeniscus::solve(const arma::cx_double tile_position) {
     // Alternative way to construct cx_vec from vec
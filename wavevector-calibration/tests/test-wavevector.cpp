@@ -1,6 +1,13 @@
 #include <algorithm>
+#include <catch2/benchmark/catch_benchmark.hpp>
 #include <catch2/catch_test_macros.hpp>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
 
+#include "batched-wavevector.hpp"
+#include "default-geometry.hpp"
+#include "k-offset-table.hpp"
 #include "types.h"
 #include "wavevector_utility.hpp"
 
@@ -63,4 +70,207 @@ SCENARIO("Can find wavevector by fixed-point iterations") {
             }
         }
     }
-}
\ No newline at end of file
+}
+
+SCENARIO("Can schedule the illuminations by increasing angle") {
+    WavevectorOverMeniscus wavevector_engine{geometry::n_leds};
+    geometry::setDefault(wavevector_engine);
+
+    GIVEN("Wavevectors of a tile off the optical axis") {
+        const arma::cx_double tile_position{1e-4, -2e-4};
+        wavevector_engine.solve(tile_position);
+
+        WHEN("Schedule all illuminations") {
+            const auto schedule = wavevector_engine.getSchedule();
+
+            THEN("Every illumination is visited once, brightfield first") {
+                REQUIRE(schedule.n_elem == geometry::n_leds);
+                REQUIRE(arma::all(arma::sort(schedule) ==
+                                  arma::regspace<arma::uvec>(0, geometry::n_leds - 1)));
+
+                const auto n_brightfield = wavevector_engine.getSchedule(true).n_elem;
+                for (arma::uword i = 0; i < n_brightfield; i++) {
+                    REQUIRE(wavevector_engine.isBrightfield(schedule(i)));
+                }
+            }
+        }
+
+        WHEN("Schedule the brightfield illuminations only") {
+            const auto schedule = wavevector_engine.getSchedule(true);
+            const auto k_offset = wavevector_engine.getOffsets(schedule);
+
+            THEN("The darkfield images are dropped") {
+                REQUIRE(schedule.n_elem > 0);
+                REQUIRE(schedule.n_elem < geometry::n_leds);
+                for (const auto i : schedule) {
+                    REQUIRE(wavevector_engine.isBrightfield(i));
+                }
+
+                AND_THEN("The offsets follow the schedule") {
+                    REQUIRE(k_offset.n_rows == 2);
+                    REQUIRE(k_offset.n_cols == schedule.n_elem);
+                    for (arma::uword i = 0; i < schedule.n_elem; i++) {
+                        const auto offset = wavevector_engine.getOffset(schedule(i));
+                        REQUIRE(k_offset(0, i) == int32_t(offset(0)));
+                        REQUIRE(k_offset(1, i) == int32_t(offset(1)));
+                    }
+                }
+            }
+        }
+    }
+}
+
+namespace {
+
+/** Tile centers of a regular grid over the sensor, in meters. */
+arma::cx_vec
+tileGrid(unsigned n_x, unsigned n_y, double pitch) {
+    arma::cx_vec tile_position(n_x * n_y);
+    for (unsigned j = 0; j < n_y; j++) {
+        for (unsigned i = 0; i < n_x; i++) {
+            tile_position(j * n_x + i) = {(i - (n_x - 1) * 0.5) * pitch,
+                                          (j - (n_y - 1) * 0.5) * pitch};
+        }
+    }
+    return tile_position;
+}
+
+// 10 x 8 tiles of 256 pixels, same as the full field-of-view reconstruction.
+constexpr unsigned n_tiles_x = 10;
+constexpr unsigned n_tiles_y = 8;
+constexpr double tile_pitch = 256 * 0.4375e-6;
+
+}  // namespace
+
+SCENARIO("Can solve the wavevectors of many tiles at once") {
+    WavevectorOverMeniscus wavevector_engine{geometry::n_leds};
+    geometry::setDefault(wavevector_engine);
+
+    GIVEN("Tile positions over the full field-of-view") {
+        const auto tile_position = tileGrid(n_tiles_x, n_tiles_y, tile_pitch);
+
+        WHEN("Solve the batch") {
+            BatchedWavevector batch{wavevector_engine};
+            arma::Cube<int32_t> k_offset;
+            REQUIRE(batch.solve(tile_position, k_offset));
+
+            THEN("The offsets agree with the per-tile solver") {
+                REQUIRE(k_offset.n_rows == 2);
+                REQUIRE(k_offset.n_cols == geometry::n_leds);
+                REQUIRE(k_offset.n_slices == tile_position.n_elem);
+
+                const arma::uvec all_leds = arma::regspace<arma::uvec>(0, geometry::n_leds - 1);
+                for (arma::uword t = 0; t < tile_position.n_elem; t++) {
+                    wavevector_engine.solve(tile_position(t));
+                    const arma::Mat<int32_t> expected = wavevector_engine.getOffsets(all_leds);
+
+                    // Off by one pixel at most, due to rounding at the pixel
+                    // boundaries.
+                    REQUIRE(arma::abs(k_offset.slice(t) - expected).max() <= 1);
+                }
+            }
+
+            AND_WHEN("Solve again with the same batch size") {
+                arma::Cube<int32_t> k_offset_again;
+                REQUIRE(batch.solve(tile_position, k_offset_again));
+
+                THEN("The scratch arrays are reused, same result") {
+                    REQUIRE(arma::all(arma::vectorise(k_offset_again == k_offset)));
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Can cache the k-offset table of the sensor") {
+    WavevectorOverMeniscus wavevector_engine{geometry::n_leds};
+    geometry::setDefault(wavevector_engine);
+
+    const auto tile_position = tileGrid(n_tiles_x, n_tiles_y, tile_pitch);
+    // Unique per run, so that concurrent test runs do not share the cache.
+    std::string cache_dir =
+        (std::filesystem::temp_directory_path() / "test-k-offset-table-XXXXXX").string();
+    REQUIRE(mkdtemp(cache_dir.data()) != nullptr);
+
+    GIVEN("An empty cache") {
+        const auto solved = KOffsetTable::load(cache_dir, wavevector_engine, tile_position);
+        REQUIRE_FALSE(solved.isMapped());
+        REQUIRE(solved.nTiles() == tile_position.n_elem);
+        REQUIRE(solved.nLeds() == geometry::n_leds);
+
+        WHEN("Load the table again") {
+            const auto cached = KOffsetTable::load(cache_dir, wavevector_engine, tile_position);
+
+            THEN("The table is memory-mapped from the sidecar file") {
+                REQUIRE(cached.isMapped());
+
+                const arma::uvec all_leds = arma::regspace<arma::uvec>(0, geometry::n_leds - 1);
+                for (arma::uword t = 0; t < tile_position.n_elem; t++) {
+                    wavevector_engine.solve(tile_position(t));
+
+                    const arma::uvec schedule = cached.getSchedule(t);
+                    REQUIRE(arma::all(schedule == wavevector_engine.getSchedule()));
+                    REQUIRE(arma::all(cached.getSchedule(t, true) ==
+                                      wavevector_engine.getSchedule(true)));
+                    REQUIRE(arma::all(arma::vectorise(cached.getOffsets(t, schedule) ==
+                                                      solved.getOffsets(t, schedule))));
+
+                    // The table is solved in one batch: off by one pixel at
+                    // most, see BatchedWavevector.
+                    REQUIRE(arma::abs(cached.getOffsets(t, schedule) -
+                                      wavevector_engine.getOffsets(schedule))
+                                .max() <= 1);
+                }
+            }
+        }
+
+        WHEN("The sidecar file was written by an earlier solver") {
+            for (const auto& entry : std::filesystem::directory_iterator(cache_dir)) {
+                std::fstream sidecar{entry.path(), std::ios::in | std::ios::out | std::ios::binary};
+                sidecar.seekp(7);
+                sidecar.put('1');
+            }
+            const auto table = KOffsetTable::load(cache_dir, wavevector_engine, tile_position);
+
+            THEN("The cached table is not reused") {
+                REQUIRE_FALSE(table.isMapped());
+            }
+        }
+
+        WHEN("Change the geometry") {
+            wavevector_engine.medium_height = 2.5e-3;
+            const auto table = KOffsetTable::load(cache_dir, wavevector_engine, tile_position);
+
+            THEN("The cached table is not reused") {
+                REQUIRE_FALSE(table.isMapped());
+            }
+        }
+    }
+
+    std::filesystem::remove_all(cache_dir);
+}
+
+SCENARIO("Benchmark the per-tile wavevector calibration", "[.][benchmark]") {
+    WavevectorOverMeniscus wavevector_engine{geometry::n_leds};
+    geometry::setDefault(wavevector_engine);
+
+    const auto tile_position = tileGrid(n_tiles_x, n_tiles_y, tile_pitch);
+    const arma::uvec all_leds = arma::regspace<arma::uvec>(0, geometry::n_leds - 1);
+
+    // Divide the reported time by 80 for the per-tile cost.
+    BENCHMARK("Per-tile solver, 80 tiles") {
+        int32_t checksum = 0;
+        for (arma::uword t = 0; t < tile_position.n_elem; t++) {
+            wavevector_engine.solve(tile_position(t));
+            checksum += wavevector_engine.getOffsets(all_leds)(0, 0);
+        }
+        return checksum;
+    };
+
+    BatchedWavevector batch{wavevector_engine};
+    arma::Cube<int32_t> k_offset;
+    BENCHMARK("Batched solver, 80 tiles") {
+        batch.solve(tile_position, k_offset);
+        return k_offset(0, 0, 0);
+    };
+}